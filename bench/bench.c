@@ -0,0 +1,72 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench.h"
+
+/*****************************************************************************//**
+  function to get the time for timing a bench
+
+ @return	seconds from an arbitrary start, monotonic
+*******************************************************************************/
+
+double bench_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*****************************************************************************//**
+  function to get a size from the command line
+
+ @param	argc    the count of args
+ @param	argv    the args
+ @param	i       the index of the arg
+ @param	dflt    the size to use if it was not given
+
+ @return	the size
+*******************************************************************************/
+
+long bench_arg (
+    int argc,
+    char **argv,
+    int i,
+    long dflt)
+{
+    if (i < argc && atol(argv[i]) > 0)
+        return atol(argv[i]);
+
+    return dflt;
+}
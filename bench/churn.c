@@ -0,0 +1,107 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+/***** the cost of adding and evicting mapfiles as the cache grows
+
+       churn [mapfiles]
+
+       each mapfile is rendered and inserted with cache_get(), then the
+       budget drops to 1 byte and every one is evicted. changing a shard
+       table in place keeps both flat as the shards fill *****/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hash.h"
+#include "DLList.h"
+#include "timer.h"
+#include "sketch.h"
+#include "buffer.h"
+#include "frag.h"
+#include "cache.h"
+#include "bench.h"
+
+/*****************************************************************************//**
+  function to render a mapfile
+*******************************************************************************/
+
+static int bench_load (
+    int mapfile_id,
+    buffer *buf)
+{
+    buffer_printf(buf, "MAP\n  NAME \"map%d\"\nEND\n", mapfile_id);
+
+    return 0;
+}
+
+int main (
+    int argc,
+    char **argv)
+{
+    cache_version *version;
+    cache_stats stats;
+    double start;
+    double insert, evict;
+    long mapfiles;
+    long i;
+    int err;
+
+    mapfiles = bench_arg(argc, argv, 1, 100000);
+
+    if ((err = cache_init(bench_load, NULL))) {
+        fprintf(stderr, "churn: cache_init: %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    start = bench_now();
+    for (i = 0; i < mapfiles; i++) {
+        if (!(version = cache_get(i, &err))) {
+            fprintf(stderr, "churn: cache_get: %d\n", err);
+            return EXIT_FAILURE;
+        }
+        cache_release(version);
+    }
+    insert = (bench_now() - start) / mapfiles * 1e9;
+
+    start = bench_now();
+    cache_set_budget(1);
+    evict = bench_now() - start;
+
+    cache_get_stats(&stats);
+    if (stats.evictions)
+        evict = evict / stats.evictions * 1e9;
+
+    printf("%ld mapfiles: get+render %6.0f ns, evict %6.0f ns (%lu evicted)\n",
+           mapfiles, insert, evict, stats.evictions);
+
+    cache_destroy();
+
+    return EXIT_SUCCESS;
+}
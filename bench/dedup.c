@@ -0,0 +1,257 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+/***** how much of a set of mapfiles the fragment store keeps once
+
+       dedup [mapfiles] [layers]
+
+       each mapfile has a WEB, a LEGEND and a SCALEBAR block out of a few
+       shared rows, the same ten SYMBOL rows, and LAYER blocks of its own
+       whose CLASS blocks come in five styles. a shared row is one fragment
+       held by many mapfiles, rows of a style render the same bytes and are
+       stored once. the ratio is the bytes the mapfiles hold over the bytes
+       stored *****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "hash.h"
+#include "DLList.h"
+#include "timer.h"
+#include "sketch.h"
+#include "buffer.h"
+#include "frag.h"
+#include "cache.h"
+#include "deps.h"
+#include "bench.h"
+
+#define BENCH_SYMBOLS 10
+
+static int bench_layers;
+
+/*****************************************************************************//**
+  function to render a block of any table
+*******************************************************************************/
+
+static int bench_block (
+    buffer *buf,
+    int table,
+    int row_id)
+{
+    int i;
+
+    switch (table) {
+    case DEPS_WEB:
+
+        /***** the web rows differ only in their id, they render the same *****/
+
+        buffer_printf(buf, "WEB\n");
+        buf->indent++;
+        buffer_printf(buf, "IMAGEPATH \"/tmp/ms_tmp/\"\n");
+        buffer_printf(buf, "METADATA\n");
+        buf->indent++;
+        buffer_printf(buf, "\"wms_enable_request\" \"*\"\n");
+        buffer_printf(buf, "\"wms_srs\" \"EPSG:4326 EPSG:3857 EPSG:25832\"\n");
+        buffer_printf(buf, "\"wms_feature_info_mime_type\" \"text/html\"\n");
+        buf->indent--;
+        buffer_printf(buf, "END\n");
+        buf->indent--;
+        buffer_printf(buf, "END\n");
+        break;
+
+    case DEPS_LEGEND:
+        buffer_printf(buf, "LEGEND\n");
+        buf->indent++;
+        buffer_printf(buf, "KEYSIZE %d %d\n", 18 + row_id, 12);
+        buffer_printf(buf, "LABEL\n");
+        buf->indent++;
+        buffer_printf(buf, "TYPE TRUETYPE\nFONT \"sans\"\nSIZE 8\n");
+        buf->indent--;
+        buffer_printf(buf, "END\n");
+        buf->indent--;
+        buffer_printf(buf, "END\n");
+        break;
+
+    case DEPS_SCALEBAR:
+        buffer_printf(buf, "SCALEBAR\n");
+        buf->indent++;
+        buffer_printf(buf, "STATUS %s\nUNITS KILOMETERS\nINTERVALS 4\n",
+                      row_id ? "EMBED" : "ON");
+        buf->indent--;
+        buffer_printf(buf, "END\n");
+        break;
+
+    case DEPS_SYMBOL:
+        buffer_printf(buf, "SYMBOL\n");
+        buf->indent++;
+        buffer_printf(buf, "NAME \"symbol%d\"\nTYPE VECTOR\nFILLED TRUE\n",
+                      row_id);
+        buffer_printf(buf, "POINTS\n");
+        for (i = 0; i < 8; i++)
+            buffer_printf(buf, "  %d %d\n", i, (i * row_id) % 7);
+        buffer_printf(buf, "END\n");
+        buf->indent--;
+        buffer_printf(buf, "END\n");
+        break;
+
+    case DEPS_CLASS:
+
+        /***** every class row of a style renders the same *****/
+
+        buffer_printf(buf, "CLASS\n");
+        buf->indent++;
+        buffer_printf(buf, "STYLE\n");
+        buf->indent++;
+        buffer_printf(buf, "COLOR %d %d %d\nWIDTH %d\n",
+                      row_id % 5 * 50, 100, 200, row_id % 5 + 1);
+        buf->indent--;
+        buffer_printf(buf, "END\n");
+        buf->indent--;
+        buffer_printf(buf, "END\n");
+        break;
+
+    default:
+        buffer_printf(buf, "LAYER\n");
+        buf->indent++;
+        buffer_printf(buf, "NAME \"layer%d\"\nTYPE POLYGON\nSTATUS ON\n",
+                      row_id);
+        buffer_printf(buf, "DATA \"the_geom from layer%d\"\n", row_id);
+        buf->indent--;
+        break;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to render the mapfile, the way mapfileFS_load() runs do_map()
+*******************************************************************************/
+
+static int bench_load (
+    int mapfile_id,
+    buffer *buf)
+{
+    deps_render *render;
+    int res;
+    int row;
+    int i;
+
+    if (!(render = deps_begin(mapfile_id)))
+        return -ENOMEM;
+
+    buf->deps = render;
+
+    buffer_printf(buf, "MAP\n");
+    buf->indent++;
+    buffer_printf(buf, "NAME \"map%d\"\n", mapfile_id);
+
+    res = frag_add(buf, mapfile_id, DEPS_WEB, mapfile_id % 4, bench_block);
+    if (!res)
+        res = frag_add(buf, mapfile_id, DEPS_LEGEND, mapfile_id % 8,
+                       bench_block);
+    if (!res)
+        res = frag_add(buf, mapfile_id, DEPS_SCALEBAR, mapfile_id % 2,
+                       bench_block);
+
+    for (i = 0; i < BENCH_SYMBOLS && !res; i++)
+        res = frag_add(buf, mapfile_id, DEPS_SYMBOL, i, bench_block);
+
+    for (i = 0; i < bench_layers && !res; i++) {
+        row = mapfile_id * bench_layers + i;
+        if ((res = frag_add(buf, mapfile_id, DEPS_LAYER, row, bench_block)))
+            break;
+        buf->indent++;
+        res = frag_add(buf, mapfile_id, DEPS_CLASS, row, bench_block);
+        buf->indent--;
+        buffer_printf(buf, "END\n");
+    }
+
+    buf->indent--;
+    buffer_printf(buf, "END\n");
+
+    buf->deps = NULL;
+    deps_end(render, res);
+
+    return res;
+}
+
+int main (
+    int argc,
+    char **argv)
+{
+    cache_version *version;
+    cache_stats stats;
+    frag_stats fstats;
+    size_t size = 0;
+    double start;
+    long mapfiles;
+    long i;
+    int err;
+
+    mapfiles = bench_arg(argc, argv, 1, 1000);
+    bench_layers = bench_arg(argc, argv, 2, 20);
+
+    if ((err = cache_init(bench_load, NULL)) || (err = deps_init()) ||
+        (err = frag_init())) {
+        fprintf(stderr, "dedup: init: %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    start = bench_now();
+    for (i = 0; i < mapfiles; i++) {
+        if (!(version = cache_get(i, &err))) {
+            fprintf(stderr, "dedup: cache_get: %d\n", err);
+            return EXIT_FAILURE;
+        }
+        size += version->size;
+        cache_release(version);
+    }
+    start = bench_now() - start;
+
+    cache_get_stats(&stats);
+    frag_get_stats(&fstats);
+
+    printf("%ld mapfiles of %d layers, %zu bytes rendered, %.1f us each\n",
+           mapfiles, bench_layers, size, start / mapfiles * 1e6);
+    printf("fragments: %lu rendered, %lu reused, %lu held in %lu blobs\n",
+           fstats.renders, fstats.reuses, fstats.count, fstats.blobs);
+    printf("fragments: %zu bytes held, %zu stored, dedup ratio %.2f\n",
+           fstats.bytes, fstats.stored,
+           fstats.stored ? (double) fstats.bytes / fstats.stored : 0);
+    printf("cache charged %zu bytes, each mapfile for its own text, its "
+           "pieces and its fragments at full size\n", stats.bytes);
+
+    cache_destroy();
+    frag_destroy();
+    deps_destroy();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,324 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+/***** per request cost of the high level and low level fuse front ends
+
+       frontend [mapfiles] [requests]
+
+       fuse can not be linked here, so this times what each front end does
+       in the daemon for a getattr and for an open and release of a cached
+       mapfile: the high level one gets a path libfuse built from the inode,
+       compares it, parses the id out of it and checks the dir index, the
+       low level one gets the inode and subtracts MAPFILEFS_INO_BASE. the
+       kernel round trip, the same for both, is not counted *****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "hash.h"
+#include "DLList.h"
+#include "timer.h"
+#include "sketch.h"
+#include "buffer.h"
+#include "frag.h"
+#include "cache.h"
+#include "bloom.h"
+#include "dir.h"
+#include "mapfileFS.h"
+#include "bench.h"
+
+/***** as fuse_lowlevel.h has it *****/
+
+typedef uint64_t fuse_ino_t;
+
+static int bench_mapfiles;
+
+/*****************************************************************************//**
+  function to render a mapfile, a hit never calls it
+*******************************************************************************/
+
+static int bench_load (
+    int mapfile_id,
+    buffer *buf)
+{
+    buffer_printf(buf, "MAP\n  NAME \"map%d\"\nEND\n", mapfile_id);
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to list the mapfiles for the dir index
+*******************************************************************************/
+
+static int bench_list (
+    int **ids,
+    size_t *length)
+{
+    int i;
+
+    if (!(*ids = malloc(bench_mapfiles * sizeof(int))))
+        return -ENOMEM;
+
+    for (i = 0; i < bench_mapfiles; i++)
+        (*ids)[i] = i;
+    *length = bench_mapfiles;
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to get the mapfile id from a file name, mapfileFS_name_id() in
+  fuse.c, which can not be linked without fuse
+*******************************************************************************/
+
+static int bench_name_id (
+    const char *name)
+{
+    char *end;
+    long id;
+
+    if (*name < '0' || *name > '9')
+        return -1;
+
+    id = strtol(name, &end, 10);
+    if (strcmp(end, MAPFILEFS_EXT) != 0 || id < 0 || id > 0x7fffffff)
+        return -1;
+
+    return id;
+}
+
+/*****************************************************************************//**
+  function to do what the high level front end does for a getattr, from
+  building the path on
+*******************************************************************************/
+
+static int bench_hl_getattr (
+    int mapfile_id,
+    struct stat *stbuf)
+{
+    char path[32];
+    cache_attr attr;
+    int res = 0;
+    int id;
+
+    /***** libfuse builds the path from its node for every request *****/
+
+    snprintf(path, sizeof(path), "/%d" MAPFILEFS_EXT, mapfile_id);
+
+    memset(stbuf, 0, sizeof(struct stat));
+
+    if (strcmp(path, "/") == 0) {
+        stbuf->st_mode = S_IFDIR | 0755;
+        stbuf->st_nlink = 2;
+    } else if (strcmp(path, "/" MAPFILEFS_STATS) == 0) {
+        stbuf->st_mode = S_IFREG | 0444;
+        stbuf->st_nlink = 1;
+    } else if (*path == '/' && (id = bench_name_id(path + 1)) >= 0) {
+        if (!(res = dir_lookup(id)) && !(res = cache_getattr(id, &attr))) {
+            stbuf->st_mode = S_IFREG | 0444;
+            stbuf->st_nlink = 1;
+            stbuf->st_size = attr.size;
+            stbuf->st_mtime = attr.mtime;
+            stbuf->st_ctime = attr.mtime;
+        }
+    } else
+        res = -ENOENT;
+
+    return res;
+}
+
+/*****************************************************************************//**
+  function to do what the low level front end does for a getattr
+*******************************************************************************/
+
+static int bench_ll_getattr (
+    fuse_ino_t ino,
+    struct stat *stbuf)
+{
+    cache_attr attr;
+    int res;
+
+    memset(stbuf, 0, sizeof(struct stat));
+
+    if (ino == 1) {
+        stbuf->st_mode = S_IFDIR | 0755;
+        stbuf->st_nlink = 2;
+    } else if (ino == MAPFILEFS_STATS_INO) {
+        stbuf->st_mode = S_IFREG | 0444;
+        stbuf->st_nlink = 1;
+    } else if (ino >= MAPFILEFS_INO_BASE) {
+        if ((res = cache_getattr(MAPFILEFS_ID(ino), &attr)))
+            return res;
+
+        stbuf->st_mode = S_IFREG | 0444;
+        stbuf->st_nlink = 1;
+        stbuf->st_size = attr.size;
+        stbuf->st_mtime = attr.mtime;
+        stbuf->st_ctime = attr.mtime;
+    } else
+        return -ENOENT;
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to do what the high level front end does for an open and a
+  release
+*******************************************************************************/
+
+static int bench_hl_open (
+    int mapfile_id)
+{
+    char path[32];
+    cache_version *version;
+    int res;
+    int id;
+
+    snprintf(path, sizeof(path), "/%d" MAPFILEFS_EXT, mapfile_id);
+
+    if (strcmp(path, "/" MAPFILEFS_STATS) == 0 || *path != '/' ||
+        (id = bench_name_id(path + 1)) < 0 || dir_lookup(id))
+        return -ENOENT;
+
+    if (!(version = cache_get(id, &res)))
+        return res;
+
+    res = cache_keep(version);
+
+    /***** the release gets the path too, it is not used *****/
+
+    snprintf(path, sizeof(path), "/%d" MAPFILEFS_EXT, mapfile_id);
+    cache_release(version);
+
+    return res < 0 ? res : 0;
+}
+
+/*****************************************************************************//**
+  function to do what the low level front end does for an open and a
+  release
+*******************************************************************************/
+
+static int bench_ll_open (
+    fuse_ino_t ino)
+{
+    cache_version *version;
+    int res;
+
+    if (ino < MAPFILEFS_INO_BASE)
+        return -EISDIR;
+
+    if (!(version = cache_get(MAPFILEFS_ID(ino), &res)))
+        return res;
+
+    res = cache_keep(version);
+    cache_release(version);
+
+    return res < 0 ? res : 0;
+}
+
+int main (
+    int argc,
+    char **argv)
+{
+    struct stat stbuf;
+    cache_version *version;
+    unsigned int seed;
+    long requests;
+    long i;
+    double start;
+    double hl_getattr, ll_getattr, hl_open, ll_open;
+    int bad = 0;
+    int err;
+
+    bench_mapfiles = bench_arg(argc, argv, 1, 10000);
+    requests = bench_arg(argc, argv, 2, 2000000);
+
+    if ((err = cache_init(bench_load, NULL)) || (err = dir_init(bench_list))) {
+        fprintf(stderr, "frontend: init: %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < bench_mapfiles; i++) {
+        if (!(version = cache_get(i, &err))) {
+            fprintf(stderr, "frontend: cache_get: %d\n", err);
+            return EXIT_FAILURE;
+        }
+        cache_release(version);
+    }
+
+    /***** the same ids in the same order for each *****/
+
+    seed = 1;
+    start = bench_now();
+    for (i = 0; i < requests; i++)
+        bad += bench_hl_getattr(rand_r(&seed) % bench_mapfiles, &stbuf) != 0;
+    hl_getattr = (bench_now() - start) / requests * 1e9;
+
+    seed = 1;
+    start = bench_now();
+    for (i = 0; i < requests; i++) {
+        bad += bench_ll_getattr(MAPFILEFS_INO(rand_r(&seed) % bench_mapfiles),
+                                &stbuf) != 0;
+    }
+    ll_getattr = (bench_now() - start) / requests * 1e9;
+
+    seed = 1;
+    start = bench_now();
+    for (i = 0; i < requests; i++)
+        bad += bench_hl_open(rand_r(&seed) % bench_mapfiles) != 0;
+    hl_open = (bench_now() - start) / requests * 1e9;
+
+    seed = 1;
+    start = bench_now();
+    for (i = 0; i < requests; i++)
+        bad += bench_ll_open(MAPFILEFS_INO(rand_r(&seed) % bench_mapfiles)) != 0;
+    ll_open = (bench_now() - start) / requests * 1e9;
+
+    printf("%d mapfiles, %ld requests each\n", bench_mapfiles, requests);
+    printf("getattr       high level %6.1f ns  low level %6.1f ns\n",
+           hl_getattr, ll_getattr);
+    printf("open+release  high level %6.1f ns  low level %6.1f ns\n",
+           hl_open, ll_open);
+
+    cache_destroy();
+    dir_destroy();
+
+    if (bad) {
+        fprintf(stderr, "frontend: %d requests failed\n", bad);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,3 @@
+/***** src/BSTree.c includes ../include/BSTree.h *****/
+
+#include "../../src/BSTree.h"
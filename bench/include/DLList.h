@@ -0,0 +1,3 @@
+/***** src/DLList.c includes ../include/DLList.h *****/
+
+#include "../../src/DLList.h"
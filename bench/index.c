@@ -0,0 +1,175 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+/***** lookups in the hash table the cache is indexed by against the
+       BSTree it replaced, for sequential and random mapfile_ids
+
+       index [mapfiles] [lookups]
+
+       a serial db key hands out sequential ids, which the unbalanced BSTree
+       turns into a list *****/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hash.h"
+#include "BSTree.h"
+#include "bench.h"
+
+/*****************************************************************************//**
+  function to compare mapfile_ids, the way cache_cmp() did
+*******************************************************************************/
+
+static int bench_cmp (
+    void *data1,
+    void *data2)
+{
+    int id1 = *(int *) data1;
+    int id2 = *(int *) data2;
+
+    return (id1 > id2) - (id1 < id2);
+}
+
+/*****************************************************************************//**
+  function to free the data of a tree node, the ids are not the trees
+*******************************************************************************/
+
+static void bench_free (
+    void *data)
+{
+    (void) data;
+}
+
+/*****************************************************************************//**
+  function to time inserting ids into each index and then looking them up in
+  a random order
+
+ @param	name    what the ids are, for the output
+ @param	ids     the ids
+ @param	length  number of ids
+ @param	lookups number of lookups to time
+
+ @return	0 on success
+ @return	-1 if a lookup failed
+*******************************************************************************/
+
+static int bench_index (
+    const char *name,
+    int *ids,
+    size_t length,
+    long lookups)
+{
+    BSTree tree = { 0, NULL, bench_cmp, bench_free, NULL };
+    hash_table table = { 0 };
+    unsigned int seed;
+    double start;
+    double tree_insert, tree_find, hash_insert_ns, hash_find_ns;
+    long i;
+    int bad = 0;
+
+    start = bench_now();
+    for (i = 0; i < (long) length; i++)
+        BSTree_insert(&tree, &ids[i]);
+    tree_insert = (bench_now() - start) / length * 1e9;
+
+    start = bench_now();
+    for (i = 0; i < (long) length; i++)
+        hash_insert(&table, ids[i], &ids[i]);
+    hash_insert_ns = (bench_now() - start) / length * 1e9;
+
+    seed = 1;
+    start = bench_now();
+    for (i = 0; i < lookups; i++)
+        bad += !BSTree_find(&tree, &ids[rand_r(&seed) % length]);
+    tree_find = (bench_now() - start) / lookups * 1e9;
+
+    seed = 1;
+    start = bench_now();
+    for (i = 0; i < lookups; i++)
+        bad += !hash_find(&table, ids[rand_r(&seed) % length]);
+    hash_find_ns = (bench_now() - start) / lookups * 1e9;
+
+    printf("%-10s  insert: BSTree %9.1f ns  hash %6.1f ns\n"
+           "%-10s  find:   BSTree %9.1f ns  hash %6.1f ns\n",
+           name, tree_insert, hash_insert_ns, "", tree_find, hash_find_ns);
+
+    BSTree_delete_all(&tree);
+    hash_delete_all(&table);
+
+    return bad ? -1 : 0;
+}
+
+int main (
+    int argc,
+    char **argv)
+{
+    size_t length;
+    long lookups;
+    unsigned int seed = 1;
+    int *ids;
+    size_t i, j;
+    int tmp;
+    int res = 0;
+
+    length = bench_arg(argc, argv, 1, 10000);
+    lookups = bench_arg(argc, argv, 2, 200000);
+
+    if (!(ids = malloc(length * sizeof(int))))
+        return EXIT_FAILURE;
+
+    printf("%zu mapfiles, %ld lookups\n", length, lookups);
+
+    /***** in the order a serial key hands them out *****/
+
+    for (i = 0; i < length; i++)
+        ids[i] = i + 1;
+
+    res |= bench_index("sequential", ids, length, lookups);
+
+    /***** the same ids, shuffled *****/
+
+    for (i = length - 1; i > 0; i--) {
+        j = rand_r(&seed) % (i + 1);
+        tmp = ids[i];
+        ids[i] = ids[j];
+        ids[j] = tmp;
+    }
+
+    res |= bench_index("random", ids, length, lookups);
+
+    free(ids);
+
+    if (res) {
+        fprintf(stderr, "index: a lookup failed\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
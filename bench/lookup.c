@@ -0,0 +1,255 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+/***** cache hits with no lock against the same lookups behind a reader
+       writer lock per shard, at 1 to 64 threads
+
+       lookup [mapfiles] [ms]
+
+       the locked side is the sharded cache before epoch reclamation: take
+       the shard read lock, find the cache, take a reference on its version,
+       unlock, and drop the reference once done *****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "hash.h"
+#include "DLList.h"
+#include "timer.h"
+#include "sketch.h"
+#include "buffer.h"
+#include "frag.h"
+#include "cache.h"
+#include "bench.h"
+
+#define BENCH_THREADS_MAX 64
+
+/*****************************************************************************//**
+  structure for a shard of the locked index
+*******************************************************************************/
+
+typedef struct {
+    pthread_rwlock_t lock;
+    hash_table table;
+} bench_shard;
+
+/*****************************************************************************//**
+  structure for a version in the locked index
+*******************************************************************************/
+
+typedef struct {
+    unsigned long refs;
+} bench_version;
+
+static bench_shard bench_shards[CACHE_SHARDS];
+static bench_version *bench_versions;
+static int bench_mapfiles;
+static volatile int bench_stop;
+
+/*****************************************************************************//**
+  function to render a mapfile, a hit never calls it
+*******************************************************************************/
+
+static int bench_load (
+    int mapfile_id,
+    buffer *buf)
+{
+    buffer_printf(buf, "MAP\n  NAME \"map%d\"\nEND\n", mapfile_id);
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function run by each reader thread on the cache
+
+ @param	arg     where to store the number of gets it did
+
+ @return	NULL
+*******************************************************************************/
+
+static void *bench_lockless (
+    void *arg)
+{
+    unsigned long *gets = arg;
+    unsigned int seed = (unsigned int)(uintptr_t) arg;
+    cache_version *version;
+    int err;
+    int i;
+
+    while (!bench_stop) {
+        for (i = 0; i < 64; i++) {
+            if ((version = cache_get(rand_r(&seed) % bench_mapfiles, &err)))
+                cache_release(version);
+        }
+        *gets += 64;
+    }
+
+    return NULL;
+}
+
+/*****************************************************************************//**
+  function run by each reader thread on the locked index
+
+ @param	arg     where to store the number of gets it did
+
+ @return	NULL
+*******************************************************************************/
+
+static void *bench_locked (
+    void *arg)
+{
+    unsigned long *gets = arg;
+    unsigned int seed = (unsigned int)(uintptr_t) arg;
+    bench_shard *shard;
+    bench_version *version;
+    int mapfile_id;
+    int i;
+
+    while (!bench_stop) {
+        for (i = 0; i < 64; i++) {
+            mapfile_id = rand_r(&seed) % bench_mapfiles;
+            shard = &bench_shards[mapfile_id % CACHE_SHARDS];
+
+            pthread_rwlock_rdlock(&shard->lock);
+            if ((version = hash_find(&shard->table, mapfile_id)))
+                __sync_fetch_and_add(&version->refs, 1);
+            pthread_rwlock_unlock(&shard->lock);
+
+            if (version)
+                __sync_fetch_and_sub(&version->refs, 1);
+        }
+        *gets += 64;
+    }
+
+    return NULL;
+}
+
+/*****************************************************************************//**
+  function to run readers for a while and get their rate
+
+ @param	reader  the function each thread runs
+ @param	count   number of threads
+ @param	ms      how long to run them
+
+ @return	millions of gets a second
+*******************************************************************************/
+
+static double bench_run (
+    void *(*reader) (void *),
+    int count,
+    long ms)
+{
+    static unsigned long gets[BENCH_THREADS_MAX][8];
+    pthread_t threads[BENCH_THREADS_MAX];
+    struct timespec run;
+    unsigned long total = 0;
+    double start;
+    int i;
+
+    bench_stop = 0;
+
+    /***** a row of gets per thread so the counts do not share a line *****/
+
+    for (i = 0; i < count; i++) {
+        gets[i][0] = 0;
+        pthread_create(&threads[i], NULL, reader, gets[i]);
+    }
+
+    start = bench_now();
+    run.tv_sec = ms / 1000;
+    run.tv_nsec = (ms % 1000) * 1000000;
+    nanosleep(&run, NULL);
+    bench_stop = 1;
+
+    for (i = 0; i < count; i++) {
+        pthread_join(threads[i], NULL);
+        total += gets[i][0];
+    }
+
+    return total / (bench_now() - start) / 1e6;
+}
+
+int main (
+    int argc,
+    char **argv)
+{
+    static const int counts[] = { 1, 4, 16, BENCH_THREADS_MAX };
+    cache_version *version;
+    long ms;
+    int err;
+    int c, i;
+
+    bench_mapfiles = bench_arg(argc, argv, 1, 1000);
+    ms = bench_arg(argc, argv, 2, 500);
+
+    if ((err = cache_init(bench_load, NULL))) {
+        fprintf(stderr, "lookup: cache_init: %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    if (!(bench_versions = calloc(bench_mapfiles, sizeof(bench_version))))
+        return EXIT_FAILURE;
+
+    for (i = 0; i < CACHE_SHARDS; i++)
+        pthread_rwlock_init(&bench_shards[i].lock, NULL);
+
+    for (i = 0; i < bench_mapfiles; i++) {
+        if (!(version = cache_get(i, &err))) {
+            fprintf(stderr, "lookup: cache_get: %d\n", err);
+            return EXIT_FAILURE;
+        }
+        cache_release(version);
+
+        bench_versions[i].refs = 1;
+        hash_insert(&bench_shards[i % CACHE_SHARDS].table, i,
+                    &bench_versions[i]);
+    }
+
+    printf("%d hot mapfiles, %ld ms per run, M gets/s\n", bench_mapfiles, ms);
+
+    for (c = 0; c < (int) (sizeof(counts) / sizeof(counts[0])); c++) {
+        printf("%2d threads: no lock %6.1f  rwlock %6.1f\n", counts[c],
+               bench_run(bench_lockless, counts[c], ms),
+               bench_run(bench_locked, counts[c], ms));
+    }
+
+    for (i = 0; i < CACHE_SHARDS; i++) {
+        hash_delete_all(&bench_shards[i].table);
+        pthread_rwlock_destroy(&bench_shards[i].lock);
+    }
+
+    free(bench_versions);
+    cache_destroy();
+
+    return EXIT_SUCCESS;
+}
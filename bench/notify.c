@@ -0,0 +1,274 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+/***** throughput and latency of the change listener while threads read the
+       cache
+
+       notify [notifications] [threads]
+
+       a fifo source stands in for the db. first the notifications are
+       written as fast as the fifo takes them, a bulk update, and the time
+       till the listener has read them all is its throughput. then single
+       notifications are written a while apart, each its own burst, and the
+       listener counters give the time from a notification to the cache
+       being expired, the debounce included. the readers get random
+       mapfiles of the hot set all the while *****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "hash.h"
+#include "DLList.h"
+#include "timer.h"
+#include "sketch.h"
+#include "buffer.h"
+#include "frag.h"
+#include "cache.h"
+#include "bloom.h"
+#include "dir.h"
+#include "deps.h"
+#include "rows.h"
+#include "listen.h"
+#include "bench.h"
+
+#define BENCH_THREADS_MAX 64
+#define BENCH_MAPFILES 1000
+#define BENCH_DEBOUNCE 20
+#define BENCH_SINGLES 20
+
+static volatile int bench_stop;
+
+/*****************************************************************************//**
+  function to render a mapfile
+*******************************************************************************/
+
+static int bench_load (
+    int mapfile_id,
+    buffer *buf)
+{
+    buffer_printf(buf, "MAP\n  NAME \"map%d\"\nEND\n", mapfile_id);
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to list the mapfiles, they are all there so a notification of one
+  does not read the index again
+*******************************************************************************/
+
+static int bench_list (
+    int **ids,
+    size_t *length)
+{
+    int i;
+
+    if (!(*ids = malloc(BENCH_MAPFILES * sizeof(int))))
+        return -1;
+
+    for (i = 0; i < BENCH_MAPFILES; i++)
+        (*ids)[i] = i;
+    *length = BENCH_MAPFILES;
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function run by each reader thread
+
+ @param	arg     where to store the number of gets it did
+
+ @return	NULL
+*******************************************************************************/
+
+static void *bench_reader (
+    void *arg)
+{
+    unsigned long *gets = arg;
+    unsigned int seed = (unsigned int)(uintptr_t) arg;
+    cache_version *version;
+    int err;
+    int i;
+
+    while (!bench_stop) {
+        for (i = 0; i < 64; i++) {
+            if ((version = cache_get(rand_r(&seed) % BENCH_MAPFILES, &err)))
+                cache_release(version);
+        }
+        *gets += 64;
+    }
+
+    return NULL;
+}
+
+/*****************************************************************************//**
+  function to wait till the listener has read a number of notifications
+
+ @param	events  the count of events to wait for
+ @param	stats   filled in with the counters
+
+ @return	0 once it has
+ @return	-1 if it has not in 10 seconds
+*******************************************************************************/
+
+static int bench_wait (
+    unsigned long events,
+    listen_stats *stats)
+{
+    double give_up = bench_now() + 10;
+
+    for (;;) {
+        listen_get_stats(stats);
+        if (stats->events >= events)
+            return 0;
+        if (bench_now() > give_up)
+            return -1;
+        usleep(100);
+    }
+}
+
+int main (
+    int argc,
+    char **argv)
+{
+    static unsigned long gets[BENCH_THREADS_MAX][8];
+    pthread_t threads[BENCH_THREADS_MAX];
+    cache_version *version;
+    listen_stats before;
+    listen_stats stats;
+    char source[64];
+    FILE *fifo;
+    unsigned long total;
+    double start;
+    double read;
+    double took;
+    long notifications;
+    long nthreads;
+    long i;
+    int err;
+
+    notifications = bench_arg(argc, argv, 1, 100000);
+    nthreads = bench_arg(argc, argv, 2, 4);
+    if (nthreads > BENCH_THREADS_MAX)
+        nthreads = BENCH_THREADS_MAX;
+
+    if ((err = cache_init(bench_load, NULL)) || (err = deps_init()) ||
+        (err = frag_init()) || (err = rows_init()) ||
+        (err = dir_init(bench_list)) || (err = dir_reload())) {
+        fprintf(stderr, "notify: init: %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < BENCH_MAPFILES; i++) {
+        if (!(version = cache_get(i, &err))) {
+            fprintf(stderr, "notify: cache_get: %d\n", err);
+            return EXIT_FAILURE;
+        }
+        cache_release(version);
+    }
+
+    snprintf(source, sizeof(source), "fifo:/tmp/notify.%d", (int) getpid());
+
+    if ((err = listen_start(source, BENCH_DEBOUNCE))) {
+        fprintf(stderr, "notify: listen_start: %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    if (!(fifo = fopen(source + 5, "w"))) {
+        perror("notify: fopen");
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < nthreads; i++)
+        pthread_create(&threads[i], NULL, bench_reader, gets[i]);
+
+    /***** a bulk update, every mapfile many times over *****/
+
+    start = bench_now();
+    for (i = 0; i < notifications; i++)
+        fprintf(fifo, "%ld\n", i % BENCH_MAPFILES);
+    fflush(fifo);
+
+    if (bench_wait(notifications, &stats)) {
+        fprintf(stderr, "notify: only %lu of %ld notifications read\n",
+                stats.events, notifications);
+        return EXIT_FAILURE;
+    }
+    read = bench_now() - start;
+
+    usleep(BENCH_DEBOUNCE * LISTEN_MAX_HOLD * 2000);
+    listen_get_stats(&stats);
+
+    printf("%ld notifications, %ld readers, %d ms debounce\n",
+           notifications, nthreads, BENCH_DEBOUNCE);
+    printf("bulk:   %8.0f notifications/s, %lu flushes, %lu expired, "
+           "%.1f ms avg %.1f ms max\n", notifications / read, stats.flushes,
+           stats.expired,
+           stats.flushes ? stats.latency_sum / 1e3 / stats.flushes : 0,
+           stats.latency_max / 1e3);
+
+    /***** one at a time, the debounce is all the wait there should be *****/
+
+    before = stats;
+
+    for (i = 0; i < BENCH_SINGLES; i++) {
+        fprintf(fifo, "%ld\n", i);
+        fflush(fifo);
+        usleep(BENCH_DEBOUNCE * 5000);
+    }
+
+    listen_get_stats(&stats);
+    stats.flushes -= before.flushes;
+    stats.latency_sum -= before.latency_sum;
+
+    printf("single: %lu flushes, %.1f ms avg from notification to expired\n",
+           stats.flushes,
+           stats.flushes ? stats.latency_sum / 1e3 / stats.flushes : 0);
+
+    took = bench_now() - start;
+    bench_stop = 1;
+
+    for (total = 0, i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+        total += gets[i][0];
+    }
+
+    printf("readers: %.1f M gets/s through both\n", total / took / 1e6);
+
+    fclose(fifo);
+    listen_stop();
+    unlink(source + 5);
+    cache_destroy();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,265 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+/***** a full refresh of a large mapfile against an incremental one where a
+       single layer changed
+
+       refresh [layers] [refreshes]
+
+       the mapfile has a LAYER and a CLASS block per layer, each rendered
+       from a row of its own with a spin standing in for the row fetch *****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "hash.h"
+#include "DLList.h"
+#include "timer.h"
+#include "sketch.h"
+#include "buffer.h"
+#include "frag.h"
+#include "cache.h"
+#include "deps.h"
+#include "bench.h"
+
+#define BENCH_MAPFILE 1
+
+static int bench_layers;
+static int *bench_gen;
+static unsigned long bench_renders;
+
+/*****************************************************************************//**
+  function to stand in for fetching a row from the db
+*******************************************************************************/
+
+static void bench_fetch (void)
+{
+    volatile int i;
+
+    for (i = 0; i < 20000; i++);
+}
+
+/*****************************************************************************//**
+  function to render a LAYER block, its PROCESSING values change with the
+  row
+*******************************************************************************/
+
+static int bench_layer (
+    buffer *buf,
+    int table,
+    int row_id)
+{
+    int i;
+
+    (void) table;
+
+    bench_fetch();
+    bench_renders++;
+
+    buffer_printf(buf, "LAYER\n");
+    buf->indent++;
+    buffer_printf(buf, "NAME \"layer%d\"\n", row_id);
+    for (i = 0; i < 20; i++)
+        buffer_printf(buf, "PROCESSING \"k%d=v%d-%d\"\n", i, row_id,
+                      bench_gen[row_id]);
+    buf->indent--;
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to render a CLASS block
+*******************************************************************************/
+
+static int bench_class (
+    buffer *buf,
+    int table,
+    int row_id)
+{
+    (void) table;
+
+    bench_fetch();
+    bench_renders++;
+
+    buffer_printf(buf, "CLASS\n");
+    buf->indent++;
+    buffer_printf(buf, "NAME \"class%d\"\n", row_id);
+    buf->indent--;
+    buffer_printf(buf, "END\n");
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to render the mapfile, the way mapfileFS_load() runs do_map()
+*******************************************************************************/
+
+static int bench_load (
+    int mapfile_id,
+    buffer *buf)
+{
+    deps_render *render;
+    int res = 0;
+    int l;
+
+    if (!(render = deps_begin(mapfile_id)))
+        return -ENOMEM;
+
+    buf->deps = render;
+
+    buffer_printf(buf, "MAP\n");
+    buf->indent++;
+    buffer_printf(buf, "NAME \"map%d\"\n", mapfile_id);
+
+    for (l = 0; l < bench_layers && !res; l++) {
+        if ((res = frag_add(buf, mapfile_id, DEPS_LAYER, l, bench_layer)))
+            break;
+        buf->indent++;
+        res = frag_add(buf, mapfile_id, DEPS_CLASS, l, bench_class);
+        buf->indent--;
+        buffer_printf(buf, "END\n");
+    }
+
+    buf->indent--;
+    buffer_printf(buf, "END\n");
+
+    buf->deps = NULL;
+    deps_end(render, res);
+
+    return res;
+}
+
+int main (
+    int argc,
+    char **argv)
+{
+    cache_version *version;
+    cache_stats stats;
+    frag_stats fstats;
+    unsigned long renders;
+    double start;
+    double full, incremental;
+    long refreshes;
+    long i;
+    int l;
+    int err;
+    char want[64];
+    char *copy;
+
+    bench_layers = bench_arg(argc, argv, 1, 2000);
+    refreshes = bench_arg(argc, argv, 2, 20);
+
+    if (!(bench_gen = calloc(bench_layers, sizeof(int))))
+        return EXIT_FAILURE;
+
+    if ((err = cache_init(bench_load, NULL)) || (err = deps_init()) ||
+        (err = frag_init())) {
+        fprintf(stderr, "refresh: init: %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    if (!(version = cache_get(BENCH_MAPFILE, &err))) {
+        fprintf(stderr, "refresh: cache_get: %d\n", err);
+        return EXIT_FAILURE;
+    }
+    cache_release(version);
+
+    /***** every block dirty *****/
+
+    renders = bench_renders;
+    start = bench_now();
+    for (i = 0; i < refreshes; i++) {
+        for (l = 0; l < bench_layers; l++) {
+            frag_expire(DEPS_LAYER, l);
+            frag_expire(DEPS_CLASS, l);
+        }
+        cache_refresh(BENCH_MAPFILE);
+    }
+    full = (bench_now() - start) / refreshes;
+    renders = (bench_renders - renders) / refreshes;
+
+    printf("%d layers, %ld refreshes each\n", bench_layers, refreshes);
+    printf("full refresh         %8.2f ms  %5lu block renders\n",
+           full * 1e3, renders);
+
+    /***** one layer row changed, as a notification for it would *****/
+
+    renders = bench_renders;
+    start = bench_now();
+    for (i = 0; i < refreshes; i++) {
+        bench_gen[bench_layers / 2]++;
+        deps_expire(DEPS_LAYER, bench_layers / 2);
+        cache_refresh(BENCH_MAPFILE);
+    }
+    incremental = (bench_now() - start) / refreshes;
+    renders = (bench_renders - renders) / refreshes;
+
+    printf("incremental refresh  %8.2f ms  %5lu block renders\n",
+           incremental * 1e3, renders);
+
+    /***** the change made it in *****/
+
+    if (!(version = cache_get(BENCH_MAPFILE, &err)) ||
+        !(copy = malloc(version->size + 1))) {
+        fprintf(stderr, "refresh: cache_get: %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    if (version->gather)
+        frag_list_copy(version->gather, copy, version->size, 0);
+    else
+        memcpy(copy, version->buf->buf, version->size);
+    copy[version->size] = '\0';
+    snprintf(want, sizeof(want), "v%d-%d", bench_layers / 2,
+             bench_gen[bench_layers / 2]);
+
+    cache_get_stats(&stats);
+    frag_get_stats(&fstats);
+
+    printf("mapfile %zu bytes, cache charged %zu bytes, fragments %zu bytes\n",
+           version->size, stats.bytes, fstats.stored);
+
+    cache_release(version);
+
+    if (!strstr(copy, want)) {
+        fprintf(stderr, "refresh: the changed layer is not in the mapfile\n");
+        return EXIT_FAILURE;
+    }
+
+    free(copy);
+    cache_destroy();
+    frag_destroy();
+    deps_destroy();
+    free(bench_gen);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,294 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+/***** hit ratio of lru against tinylfu replaying a trace of gets
+
+       replay [trace] [capacity]
+
+       the trace has one mapfile id per line, with no trace or with - a made
+       up one is used: a few hundred hot mapfiles asked for by a zipf
+       distribution, and every so often a crawler sweeping 20000 mapfiles
+       once each in between. capacity is how many mapfiles fit in the budget.
+       each policy runs in a process of its own on a fresh cache *****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "hash.h"
+#include "DLList.h"
+#include "timer.h"
+#include "sketch.h"
+#include "buffer.h"
+#include "frag.h"
+#include "cache.h"
+#include "bench.h"
+
+#define BENCH_GETS 1000000
+#define BENCH_HOT 500
+#define BENCH_SWEEP 20000
+#define BENCH_SWEEP_EVERY 200000
+
+/*****************************************************************************//**
+  function to render a mapfile, all the same size so capacity is a count
+*******************************************************************************/
+
+static int bench_load (
+    int mapfile_id,
+    buffer *buf)
+{
+    char pad[1024];
+
+    memset(pad, '#', sizeof(pad) - 1);
+    pad[sizeof(pad) - 1] = '\0';
+    buffer_printf(buf, "MAP\n  NAME \"map%d\"\n  # %s\nEND\n", mapfile_id, pad);
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to read a trace
+
+ @param	path    the trace file
+ @param	length  set to the number of gets
+
+ @return	the mapfile ids in the order they were asked for
+ @return	NULL on failure
+*******************************************************************************/
+
+static int *bench_read (
+    const char *path,
+    size_t *length)
+{
+    FILE *fp;
+    char line[256];
+    char *end;
+    int *ids = NULL;
+    int *grown;
+    size_t alloced = 0;
+    long id;
+
+    if (!(fp = fopen(path, "r")))
+        return NULL;
+
+    *length = 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+        id = strtol(line, &end, 10);
+        if (end == line || id < 0)
+            continue;
+
+        if (*length == alloced) {
+            alloced = alloced ? alloced * 2 : 4096;
+            if (!(grown = realloc(ids, alloced * sizeof(int)))) {
+                free(ids);
+                fclose(fp);
+                return NULL;
+            }
+            ids = grown;
+        }
+
+        ids[(*length)++] = id;
+    }
+
+    fclose(fp);
+
+    return ids;
+}
+
+/*****************************************************************************//**
+  function to make up a trace of hot mapfiles and crawler sweeps
+
+ @param	length  set to the number of gets
+
+ @return	the mapfile ids in the order they were asked for
+ @return	NULL if malloc fails
+*******************************************************************************/
+
+static int *bench_synth (
+    size_t *length)
+{
+    double cdf[BENCH_HOT];
+    double sum = 0;
+    double r;
+    unsigned int seed = 1;
+    int *ids;
+    int swept = BENCH_SWEEP;
+    size_t lo, hi, mid;
+    size_t i;
+
+    if (!(ids = malloc(BENCH_GETS * sizeof(int))))
+        return NULL;
+
+    for (i = 0; i < BENCH_HOT; i++)
+        cdf[i] = sum += 1.0 / (i + 1);
+
+    for (i = 0; i < BENCH_GETS; i++) {
+        if (i % BENCH_SWEEP_EVERY == 0)
+            swept = 0;
+
+        /***** while a sweep runs every other get is the crawler's *****/
+
+        if (swept < BENCH_SWEEP && i % 2) {
+            ids[i] = BENCH_HOT + swept++;
+            continue;
+        }
+
+        r = (double) rand_r(&seed) / RAND_MAX * sum;
+        for (lo = 0, hi = BENCH_HOT - 1; lo < hi;) {
+            mid = lo + (hi - lo) / 2;
+            if (cdf[mid] < r)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        ids[i] = lo;
+    }
+
+    *length = BENCH_GETS;
+
+    return ids;
+}
+
+/*****************************************************************************//**
+  function to replay the trace under a policy, run in a child
+
+ @param	policy      the eviction policy
+ @param	name        the name of the policy
+ @param	ids         the trace
+ @param	length      number of gets in the trace
+ @param	capacity    number of mapfiles that fit in the budget
+
+ @return	an exit status
+*******************************************************************************/
+
+static int bench_replay (
+    cache_policy policy,
+    const char *name,
+    int *ids,
+    size_t length,
+    long capacity)
+{
+    cache_version *version;
+    cache_stats stats;
+    double start;
+    size_t i;
+    int err;
+
+    if ((err = cache_init(bench_load, NULL)) ||
+        (err = cache_set_policy(policy))) {
+        fprintf(stderr, "replay: cache_init: %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    /***** one mapfile charges the same as any other, size the budget by it *****/
+
+    if (!(version = cache_get(ids[0], &err))) {
+        fprintf(stderr, "replay: cache_get: %d\n", err);
+        return EXIT_FAILURE;
+    }
+    cache_release(version);
+    cache_get_stats(&stats);
+    cache_set_budget(stats.bytes * capacity);
+
+    start = bench_now();
+    for (i = 0; i < length; i++) {
+        if (!(version = cache_get(ids[i], &err))) {
+            fprintf(stderr, "replay: cache_get: %d\n", err);
+            return EXIT_FAILURE;
+        }
+        cache_release(version);
+    }
+    start = bench_now() - start;
+
+    /***** the first get sized the budget, it is not part of the trace *****/
+
+    cache_get_stats(&stats);
+    stats.loads--;
+
+    printf("%-8s hit ratio %6.2f%%, %lu loads, %lu evicted, %.0f ns a get\n",
+           name, 100.0 * (length - stats.loads) / length, stats.loads,
+           stats.evictions, start / length * 1e9);
+
+    cache_destroy();
+
+    return EXIT_SUCCESS;
+}
+
+int main (
+    int argc,
+    char **argv)
+{
+    const char *names[] = { "lru", "tinylfu" };
+    cache_policy policies[] = { CACHE_POLICY_LRU, CACHE_POLICY_TINYLFU };
+    const char *path = argc > 1 ? argv[1] : "-";
+    long capacity;
+    size_t length = 0;
+    int *ids;
+    int status;
+    pid_t pid;
+    int i;
+
+    capacity = bench_arg(argc, argv, 2, 1000);
+
+    if (strcmp(path, "-"))
+        ids = bench_read(path, &length);
+    else
+        ids = bench_synth(&length);
+
+    if (!ids || !length) {
+        fprintf(stderr, "replay: no trace from %s\n", path);
+        return EXIT_FAILURE;
+    }
+
+    printf("%zu gets, %ld mapfiles fit\n", length, capacity);
+    fflush(stdout);
+
+    /***** the cache keeps its counters across cache_destroy(), a fresh
+           process gives each policy a fresh cache *****/
+
+    for (i = 0; i < 2; i++) {
+        if ((pid = fork()) < 0) {
+            perror("replay: fork");
+            return EXIT_FAILURE;
+        }
+        if (!pid)
+            exit(bench_replay(policies[i], names[i], ids, length, capacity));
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+            WEXITSTATUS(status))
+            return EXIT_FAILURE;
+    }
+
+    free(ids);
+
+    return EXIT_SUCCESS;
+}
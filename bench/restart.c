@@ -0,0 +1,264 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+/***** time to the first hit after a restart from a snapshot, against
+       starting with an empty cache
+
+       restart [mapfiles] [kib]
+
+       every mapfile is rendered with a sleep standing in for the db, and
+       the cache is saved with snap_save(). a fresh process then does a
+       cache_init() and snap_load(), and the first cache_get() is timed, then
+       a get of every mapfile. one mapfile changed while the daemon was down,
+       the restored versions are checked against the db behind the gets and
+       all but that one are kept *****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "hash.h"
+#include "DLList.h"
+#include "timer.h"
+#include "sketch.h"
+#include "buffer.h"
+#include "frag.h"
+#include "snap.h"
+#include "cache.h"
+#include "bench.h"
+
+#define BENCH_DB_US 2000
+#define BENCH_CHANGED 7
+
+static long bench_kib;
+static int bench_gen;
+
+/*****************************************************************************//**
+  function to render a mapfile, kib of LAYER blocks after a wait for the db
+*******************************************************************************/
+
+static int bench_load (
+    int mapfile_id,
+    buffer *buf)
+{
+    long i;
+
+    usleep(BENCH_DB_US);
+
+    buffer_printf(buf, "MAP\n  NAME \"map%d\"\n", mapfile_id);
+    for (i = 0; i < bench_kib * 16; i++)
+        buffer_printf(buf, "  LAYER NAME \"layer%05ld\" STATUS ON END #%06d\n",
+                      i, mapfile_id == BENCH_CHANGED ? bench_gen : 0);
+    buffer_printf(buf, "END\n");
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to get every mapfile once
+
+ @param	mapfiles    number of mapfiles
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+static int bench_get_all (
+    long mapfiles)
+{
+    cache_version *version;
+    long i;
+    int err;
+
+    for (i = 0; i < mapfiles; i++) {
+        if (!(version = cache_get(i, &err)))
+            return err;
+        cache_release(version);
+    }
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to restart from the snapshot, run in a child so the cache starts
+  as empty as a new daemon's
+
+ @param	path        the snapshot
+ @param	mapfiles    number of mapfiles in it
+
+ @return	an exit status
+*******************************************************************************/
+
+static int bench_restart (
+    const char *path,
+    long mapfiles)
+{
+    cache_version *version;
+    cache_stats stats;
+    double start;
+    double restore, first, all, checked;
+    double give_up;
+    char want[64];
+    size_t skip;
+    int replaced;
+    int err;
+
+    start = bench_now();
+
+    if ((err = cache_init(bench_load, NULL))) {
+        fprintf(stderr, "restart: cache_init: %d\n", err);
+        return EXIT_FAILURE;
+    }
+    cache_set_stale(0, 2);
+
+    if ((err = snap_load(path)) || (err = cache_start())) {
+        fprintf(stderr, "restart: snap_load: %d\n", err);
+        return EXIT_FAILURE;
+    }
+    restore = bench_now() - start;
+
+    /***** the row changed while the daemon was down *****/
+
+    bench_gen = 1;
+
+    start = bench_now();
+    if (!(version = cache_get(0, &err))) {
+        fprintf(stderr, "restart: cache_get: %d\n", err);
+        return EXIT_FAILURE;
+    }
+    cache_release(version);
+    first = bench_now() - start;
+
+    start = bench_now();
+    if ((err = bench_get_all(mapfiles))) {
+        fprintf(stderr, "restart: cache_get: %d\n", err);
+        return EXIT_FAILURE;
+    }
+    all = bench_now() - start;
+
+    /***** the checks against the db run on the refresh threads *****/
+
+    give_up = bench_now() + 30;
+    do {
+        usleep(10000);
+        cache_get_stats(&stats);
+    } while (stats.revalidated < (unsigned long) mapfiles - 1 &&
+             bench_now() < give_up);
+    checked = bench_now() - start;
+
+    /***** the changed one has its new render *****/
+
+    if (!(version = cache_get(BENCH_CHANGED, &err))) {
+        fprintf(stderr, "restart: cache_get: %d\n", err);
+        return EXIT_FAILURE;
+    }
+    skip = snprintf(want, sizeof(want), "MAP\n  NAME \"map%d\"\n",
+                    BENCH_CHANGED);
+    snprintf(want, sizeof(want), "  LAYER NAME \"layer00000\" STATUS ON "
+             "END #%06d\n", bench_gen);
+    replaced = version->size >= skip + strlen(want) &&
+               !memcmp(version->buf->buf + skip, want, strlen(want));
+    cache_release(version);
+
+    printf("restore (cache_init + snap_load) %8.2f ms, %lu restored\n",
+           restore * 1e3, stats.restored);
+    printf("first hit after restore          %8.2f ms\n", first * 1e3);
+    printf("all served once                  %8.2f ms warm\n", all * 1e3);
+    printf("checked against the db           %8.2f ms, %lu kept, the changed "
+           "one %s\n", checked * 1e3, stats.revalidated,
+           replaced ? "replaced" : "NOT replaced");
+
+    cache_destroy();
+
+    return EXIT_SUCCESS;
+}
+
+int main (
+    int argc,
+    char **argv)
+{
+    char path[64];
+    double start;
+    double cold, save;
+    long mapfiles;
+    int status;
+    pid_t pid;
+    int err;
+
+    mapfiles = bench_arg(argc, argv, 1, 2000);
+    bench_kib = bench_arg(argc, argv, 2, 64);
+
+    snprintf(path, sizeof(path), "/tmp/restart.%d.snap", (int) getpid());
+
+    if ((err = cache_init(bench_load, NULL))) {
+        fprintf(stderr, "restart: cache_init: %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    start = bench_now();
+    if ((err = bench_get_all(mapfiles))) {
+        fprintf(stderr, "restart: cache_get: %d\n", err);
+        return EXIT_FAILURE;
+    }
+    cold = bench_now() - start;
+
+    start = bench_now();
+    if ((err = snap_save(path))) {
+        fprintf(stderr, "restart: snap_save: %d\n", err);
+        return EXIT_FAILURE;
+    }
+    save = bench_now() - start;
+
+    cache_destroy();
+
+    printf("%ld mapfiles of %ld KiB, %d ms of db a render\n", mapfiles,
+           bench_kib, BENCH_DB_US / 1000);
+    printf("all served once                  %8.2f ms cold\n", cold * 1e3);
+    printf("snap_save                        %8.2f ms\n", save * 1e3);
+    fflush(stdout);
+
+    if ((pid = fork()) < 0) {
+        perror("restart: fork");
+        return EXIT_FAILURE;
+    }
+    if (!pid)
+        exit(bench_restart(path, mapfiles));
+
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+        status = EXIT_FAILURE;
+    else
+        status = WEXITSTATUS(status);
+
+    unlink(path);
+
+    return status;
+}
@@ -0,0 +1,17 @@
+/***** the error.h src/buffer.c includes, it is not in the tree *****/
+
+#ifndef _ERROR_H
+#define _ERROR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define ERROR(msg) do { \
+    fprintf(stderr, "%s:%i: %s: %s\n", __FILE__, __LINE__, msg, \
+            strerror(errno)); \
+    exit(EXIT_FAILURE); \
+} while (0)
+
+#endif
@@ -0,0 +1,163 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+/***** throughput of cache hits with 1, 4, 16 and 64 reader threads
+
+       threads [mapfiles] [ms]
+
+       each thread gets random mapfiles of the hot set, all rendered
+       before the clock starts, so every get is a hit *****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "hash.h"
+#include "DLList.h"
+#include "timer.h"
+#include "sketch.h"
+#include "buffer.h"
+#include "frag.h"
+#include "cache.h"
+#include "bench.h"
+
+#define BENCH_THREADS_MAX 64
+
+static int bench_mapfiles;
+static volatile int bench_stop;
+
+/*****************************************************************************//**
+  function to render a mapfile, a hit never calls it
+*******************************************************************************/
+
+static int bench_load (
+    int mapfile_id,
+    buffer *buf)
+{
+    buffer_printf(buf, "MAP\n  NAME \"map%d\"\nEND\n", mapfile_id);
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function run by each reader thread
+
+ @param	arg     where to store the number of gets it did
+
+ @return	NULL
+*******************************************************************************/
+
+static void *bench_reader (
+    void *arg)
+{
+    unsigned long *gets = arg;
+    unsigned int seed = (unsigned int)(uintptr_t) arg;
+    cache_version *version;
+    int err;
+    int i;
+
+    while (!bench_stop) {
+        for (i = 0; i < 64; i++) {
+            if ((version = cache_get(rand_r(&seed) % bench_mapfiles, &err)))
+                cache_release(version);
+        }
+        *gets += 64;
+    }
+
+    return NULL;
+}
+
+int main (
+    int argc,
+    char **argv)
+{
+    static const int counts[] = { 1, 4, 16, BENCH_THREADS_MAX };
+    static unsigned long gets[BENCH_THREADS_MAX][8];
+    pthread_t threads[BENCH_THREADS_MAX];
+    struct timespec run;
+    unsigned long total;
+    double start;
+    double took;
+    long ms;
+    int err;
+    int c, i;
+
+    bench_mapfiles = bench_arg(argc, argv, 1, 1000);
+    ms = bench_arg(argc, argv, 2, 500);
+
+    if ((err = cache_init(bench_load, NULL))) {
+        fprintf(stderr, "threads: cache_init: %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < bench_mapfiles; i++) {
+        cache_version *version;
+
+        if (!(version = cache_get(i, &err))) {
+            fprintf(stderr, "threads: cache_get: %d\n", err);
+            return EXIT_FAILURE;
+        }
+        cache_release(version);
+    }
+
+    printf("%d hot mapfiles, %ld ms per run\n", bench_mapfiles, ms);
+
+    for (c = 0; c < (int) (sizeof(counts) / sizeof(counts[0])); c++) {
+        bench_stop = 0;
+
+        /***** a row of gets per thread so the counts do not share a line *****/
+
+        for (i = 0; i < counts[c]; i++) {
+            gets[i][0] = 0;
+            pthread_create(&threads[i], NULL, bench_reader, gets[i]);
+        }
+
+        start = bench_now();
+        run.tv_sec = ms / 1000;
+        run.tv_nsec = (ms % 1000) * 1000000;
+        nanosleep(&run, NULL);
+        bench_stop = 1;
+
+        total = 0;
+        for (i = 0; i < counts[c]; i++) {
+            pthread_join(threads[i], NULL);
+            total += gets[i][0];
+        }
+        took = bench_now() - start;
+
+        printf("%2d threads: %6.1f M gets/s\n", counts[c], total / took / 1e6);
+    }
+
+    cache_destroy();
+
+    return EXIT_SUCCESS;
+}
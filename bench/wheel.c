@@ -0,0 +1,208 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+/***** the timer wheel with a million entries
+
+       wheel [entries]
+
+       timer.c is built in so the wheel can be turned a second at a time on
+       a made up clock with timer_tick(), without the timer thread. the
+       deadlines are spread over 300000 s and a few are past the wheel, a
+       quarter are cancelled and a tenth moved. each entry must fire once,
+       on the tick of its deadline. an O(n) scan of the same entries is
+       timed for comparison *****/
+
+#include "timer.c"
+
+#include <stdint.h>
+
+#include "bench.h"
+
+#define BENCH_START 1000
+
+/*****************************************************************************//**
+  structure for something with a deadline
+*******************************************************************************/
+
+typedef struct {
+    timer_entry entry;
+    time_t want;
+    int fired;
+    int cancelled;
+} bench_item;
+
+static long bench_fired;
+static long bench_late;
+static uint64_t bench_seed = 88172645463325252ULL;
+
+/*****************************************************************************//**
+  function to get a random number, xorshift
+*******************************************************************************/
+
+static uint64_t bench_random (void)
+{
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 7;
+    bench_seed ^= bench_seed << 17;
+
+    return bench_seed;
+}
+
+/*****************************************************************************//**
+  function called when an item is due, a deadline already past fires on the
+  first tick
+*******************************************************************************/
+
+static void bench_fire (
+    timer_entry *entry)
+{
+    bench_item *item = (bench_item *) entry;
+    time_t tick = timer_base - 1;
+    time_t want = item->want < BENCH_START ? BENCH_START : item->want;
+
+    if (tick != want || item->cancelled)
+        bench_late++;
+
+    item->fired++;
+    bench_fired++;
+}
+
+int main (
+    int argc,
+    char **argv)
+{
+    bench_item *items;
+    long length;
+    long cancelled = 0;
+    long missing = 0;
+    long due = 0;
+    long i;
+    time_t last = 0;
+    time_t want;
+    double start;
+    double ticks;
+    int r;
+
+    length = bench_arg(argc, argv, 1, 1000000);
+
+    if (!(items = calloc(length + 4, sizeof(bench_item))))
+        return EXIT_FAILURE;
+
+    epoch_init();
+    timer_init();
+    timer_base = BENCH_START;
+
+    /***** a quarter each in the first minute, the first hour, the next 3.5
+           days and around now, some already past *****/
+
+    start = bench_now();
+    for (i = 0; i < length; i++) {
+        switch (i % 4) {
+        case 0:
+            want = BENCH_START + bench_random() % 64;
+            break;
+        case 1:
+            want = BENCH_START + bench_random() % 4096;
+            break;
+        case 2:
+            want = BENCH_START + bench_random() % 300000;
+            break;
+        default:
+            want = BENCH_START - 5 + bench_random() % 20;
+        }
+        items[i].want = want;
+        if (want > last)
+            last = want;
+        timer_add(&items[i].entry, want, bench_fire);
+    }
+    printf("insert %ld: %6.1f ns each\n", length,
+           (bench_now() - start) * 1e9 / length);
+
+    /***** past the end of the wheel, they wait in the last slot *****/
+
+    for (i = length; i < length + 4; i++) {
+        items[i].want = BENCH_START + 20000000 + i - length;
+        timer_add(&items[i].entry, items[i].want, bench_fire);
+        last = items[i].want;
+    }
+
+    start = bench_now();
+    for (i = 0; i < length; i += 4) {
+        bench_item *item = &items[(i * 7) % length];
+
+        if (timer_cancel(&item->entry)) {
+            item->cancelled = 1;
+            cancelled++;
+        }
+    }
+    printf("cancel %ld: %6.1f ns each\n", cancelled,
+           (bench_now() - start) * 1e9 / cancelled);
+
+    for (i = 0; i < length; i += 10) {
+        if (!items[i].cancelled) {
+            items[i].want = BENCH_START + bench_random() % 100000;
+            timer_add(&items[i].entry, items[i].want, bench_fire);
+        }
+    }
+
+    /***** timer_tick() expects the lock held, as the timer thread has it *****/
+
+    pthread_mutex_lock(&timer_lock);
+    start = bench_now();
+    while (timer_base <= last)
+        timer_tick();
+    ticks = bench_now() - start;
+    pthread_mutex_unlock(&timer_lock);
+
+    for (i = 0; i < length + 4; i++) {
+        if (!items[i].cancelled && items[i].fired != 1)
+            missing++;
+    }
+
+    printf("%ld ticks: %6.1f ns each with the callbacks, "
+           "%ld fired, %ld late, %ld missing\n",
+           (long) (last - BENCH_START + 1),
+           ticks * 1e9 / (last - BENCH_START + 1),
+           bench_fired, bench_late, missing);
+
+    /***** what each tick would cost scanning every entry *****/
+
+    start = bench_now();
+    for (r = 0; r < 10; r++) {
+        for (i = 0; i < length; i++)
+            due += items[i].want <= BENCH_START + r;
+    }
+    printf("scan of %ld: %6.2f ms each tick (%ld due)\n", length,
+           (bench_now() - start) * 1e3 / 10, due);
+
+    free(items);
+
+    return bench_late || missing ? EXIT_FAILURE : EXIT_SUCCESS;
+}
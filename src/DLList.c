@@ -397,6 +397,50 @@ void *DLList_delete_before (
 }
 
 
+/*******************************************************************************
+	function to move a node to the tail of a double linked list
+	
+	Arguments:
+				list	the linked list
+				node	the node you wish to move
+	
+	returns:
+				nothing
+
+	notes:
+				nothing is alloced or free'ed, the node is only relinked
+				
+*******************************************************************************/
+
+void DLList_move_tail (
+	DLList * list,
+	DLList_node * node)
+{
+
+	/***** already the tail? *****/
+
+	if (node == list->tail)
+		return;
+
+	/***** unlink it *****/
+
+	if (node == list->head)
+		list->head = node->next;
+	else
+		node->prev->next = node->next;
+
+	node->next->prev = node->prev;
+
+	/***** link it at the tail *****/
+
+	node->prev = list->tail;
+	node->next = NULL;
+	list->tail->next = node;
+	list->tail = node;
+	
+	return;
+}
+
 /*******************************************************************************
 	function to count the nodes in a double linked list
 	
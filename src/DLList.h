@@ -225,6 +225,23 @@ void *DLList_delete_before (
 	DLList * list,
 	DLList_node * node);
 
+/*****************************************************************************//**
+	function to move a node to the tail of a double linked list
+	
+ @param	list	the linked list
+ @param	node	the node you wish to move
+	
+ @return	nothing
+
+	notes:
+				nothing is alloced or free'ed, the node is only relinked
+				
+*******************************************************************************/
+
+void DLList_move_tail (
+	DLList * list,
+	DLList_node * node);
+
 /*****************************************************************************//**
 	function to count the nodes in a double linked list
 	
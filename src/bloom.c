@@ -0,0 +1,149 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "bloom.h"
+
+/*******************************************************************************
+  function to get the word and the bits of a key
+*******************************************************************************/
+
+static inline uint64_t *bloom_bits (
+    bloom *bf,
+    int key,
+    uint64_t *bits)
+{
+    uint64_t h = (uint64_t)(unsigned int)key + 1;
+    int i;
+
+    /***** mix so every bit of the key moves every bit of the hash, the
+           high bits pick the word and each hash is 6 of the low bits *****/
+
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+
+    *bits = 0;
+    for (i = 0; i < BLOOM_HASHES; i++)
+        *bits |= (uint64_t) 1 << ((h >> (6 * i)) & 63);
+
+    return bf->words + ((h >> 40) & bf->mask);
+}
+
+/*******************************************************************************
+  function to setup a bloom filter
+
+  args:
+        bf      the filter
+        keys    number of keys that will be added
+
+  returns:
+        0 on success
+        -1 if malloc fails
+*******************************************************************************/
+
+int bloom_init (
+    bloom *bf,
+    size_t keys)
+{
+    size_t words = keys * BLOOM_BITS_PER_KEY / 64 + 1;
+    size_t size;
+
+    for (size = 1; size < words; size <<= 1);
+
+    if (!(bf->words = calloc(size, sizeof(uint64_t))))
+        return -1;
+
+    bf->mask = size - 1;
+
+    return 0;
+}
+
+/*******************************************************************************
+  function to free a bloom filter
+
+  args:
+        bf      the filter
+
+  returns:
+        nothing
+*******************************************************************************/
+
+void bloom_free (
+    bloom *bf)
+{
+    free(bf->words);
+    bf->words = NULL;
+}
+
+/*******************************************************************************
+  function to add a key to a bloom filter
+
+  args:
+        bf      the filter
+        key     the key
+
+  returns:
+        nothing
+*******************************************************************************/
+
+void bloom_add (
+    bloom *bf,
+    int key)
+{
+    uint64_t bits;
+    uint64_t *word = bloom_bits(bf, key, &bits);
+
+    *word |= bits;
+}
+
+/*******************************************************************************
+  function to check if a key may have been added to a bloom filter
+
+  args:
+        bf      the filter
+        key     the key
+
+  returns:
+        0 if the key was never added
+        non zero if it may have been
+*******************************************************************************/
+
+int bloom_check (
+    bloom *bf,
+    int key)
+{
+    uint64_t bits;
+    uint64_t *word = bloom_bits(bf, key, &bits);
+
+    return (*word & bits) == bits;
+}
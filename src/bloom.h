@@ -0,0 +1,111 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+#ifndef bloom_h
+#define bloom_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/***** bits set for each key and bits kept for each key before rounding up
+       to a power of 2, about 1 in 500 keys that were never added pass *****/
+
+#define BLOOM_HASHES 6
+#define BLOOM_BITS_PER_KEY 16
+
+/*****************************************************************************//**
+  structure for a bloom filter of integer keys
+
+ @param	words   the bits, 64 to a word
+ @param	mask    number of words minus 1, the number of words is a power of 2
+
+  note:
+        all the bits of a key are in one word so a check is one hash of the
+        key, one load and a compare, it touches a single cache line
+*******************************************************************************/
+
+typedef struct {
+    uint64_t *words;
+    size_t mask;
+} bloom;
+
+/*****************************************************************************//**
+  function to setup a bloom filter
+
+ @param	bf      the filter
+ @param	keys    number of keys that will be added
+
+ @return	0 on success
+ @return	-1 if malloc fails
+*******************************************************************************/
+
+int bloom_init (
+    bloom *bf,
+    size_t keys);
+
+/*****************************************************************************//**
+  function to free a bloom filter
+
+ @param	bf      the filter
+
+ @return	nothing
+*******************************************************************************/
+
+void bloom_free (
+    bloom *bf);
+
+/*****************************************************************************//**
+  function to add a key to a bloom filter
+
+ @param	bf      the filter
+ @param	key     the key
+
+ @return	nothing
+*******************************************************************************/
+
+void bloom_add (
+    bloom *bf,
+    int key);
+
+/*****************************************************************************//**
+  function to check if a key may have been added to a bloom filter
+
+ @param	bf      the filter
+ @param	key     the key
+
+ @return	0 if the key was never added
+ @return	non zero if it may have been
+*******************************************************************************/
+
+int bloom_check (
+    bloom *bf,
+    int key);
+
+#endif
@@ -99,6 +99,18 @@ int buffer_printf(
 	int spaces = buf->indent * INDENTSPACES;
 	need = 1 + spaces;
 	
+	/***** only counting? *****/
+	
+	if (buf->sizeonly) {
+		va_start (ap, format);
+		result = vsnprintf (NULL, 0, format, ap);
+		va_end (ap);
+		
+		buf->used += spaces + result;
+		
+		return result + spaces;
+	}
+	
 	/***** alocate for spaces *****/
 	
 	if (buf->alloced < buf->used + need )
@@ -174,6 +186,18 @@ int buffer_printf_noindent(
 	va_list ap;
 	size_t result = 0;
 	
+	/***** only counting? *****/
+	
+	if (buf->sizeonly) {
+		va_start (ap, format);
+		result = vsnprintf (NULL, 0, format, ap);
+		va_end (ap);
+		
+		buf->used += result;
+		
+		return result;
+	}
+	
 	/***** try to print to the buffer *****/
 	
 	va_start (ap, format);
@@ -206,6 +230,41 @@ int buffer_printf_noindent(
 	return result;
 }
 
+/*******************************************************************************
+	function to append bytes to a buffer as they are, with no indent
+
+	args:
+						buf			the buffer to append to
+						data		the bytes
+						length	number of bytes
+	
+ returns:
+						nothing
+*******************************************************************************/
+
+void buffer_write(
+	buffer *buf,
+	const char *data,
+	size_t length)
+{
+	
+	/***** only counting? *****/
+	
+	if (buf->sizeonly) {
+		buf->used += length;
+		return;
+	}
+	
+	if (buf->alloced < buf->used + length + 1)
+		buffer_alloc(buf, length + 1);
+	
+	memcpy(buf->buf + buf->used, data, length);
+	buf->used += length;
+	*(buf->buf + buf->used) = '\0';
+	
+	return;
+}
+
 /*******************************************************************************
 	function to free a buffer
 
@@ -37,13 +37,26 @@
 							buf				the buffer
 							alloced		amount of space allocated in the buffer
 							used			amount of space used in the buffer
+							indent		number of levels to indent each line
+							sizeonly	if non zero nothing is stored, used only
+												counts the chars that would have been
+							gather		if not NULL blocks added with frag_add() are
+												pieces of this list instead of copied in
+							deps			if not NULL the render the rows of blocks
+												added with frag_add() are recorded to
 *******************************************************************************/
 
+struct frag_list;
+struct deps_render;
+
 typedef struct {
 	char *buf;
 	size_t alloced;
 	size_t used;
 	int indent;
+	int sizeonly;
+	struct frag_list *gather;
+	struct deps_render *deps;
 } buffer;
 
 /*******************************************************************************
@@ -80,6 +93,23 @@ int buffer_printf_noindent(
 	char *format,
 	...);
 
+/*******************************************************************************
+	function to append bytes to a buffer as they are, with no indent
+
+	args:
+						buf			the buffer to append to
+						data		the bytes
+						length	number of bytes
+	
+ returns:
+						nothing
+*******************************************************************************/
+
+void buffer_write(
+	buffer *buf,
+	const char *data,
+	size_t length);
+
 /*******************************************************************************
 	function to free a buffer
 
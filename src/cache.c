@@ -27,47 +27,2918 @@
  ****************************************************************************/
 
 
-#include "BSTree.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include "hash.h"
+#include "DLList.h"
+#include "worker.h"
+#include "epoch.h"
+#include "timer.h"
+#include "sketch.h"
+#include "buffer.h"
+#include "frag.h"
+#include "snap.h"
 #include "cache.h"
+#include "stats.h"
+
+
+cache_shard CACHE[CACHE_SHARDS];
+
+static cache_load_func cache_load = NULL;
+static cache_expire_func cache_expired = NULL;
+
+static unsigned long cache_serial = 0;
+
+static cache_stats cache_counters = {0};
+
+static size_t cache_budget = 0;
+
+static cache_policy cache_evict_policy = CACHE_POLICY_LRU;
+
+static time_t cache_stale_max = 0;
+static time_t cache_negative_ttl = 0;
+static time_t cache_ttl = 0;
+static time_t cache_ahead_time = 0;
+static unsigned int cache_ahead_hits = 0;
+static int cache_ahead_threads = 0;
+static int cache_ahead_running = 0;
+static int cache_stale_threads = 0;
+static int cache_stale_running = 0;
+
+/***** number of restored caches not yet checked against the db *****/
+
+static unsigned long cache_unchecked = 0;
+
+/***** percent of the budget the cold tier may use, 0 if there is none *****/
+
+static unsigned int cache_cold_share = 0;
+
+/***** idle buffers to decompress cold mapfiles into *****/
 
+static pthread_mutex_t cache_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static buffer *cache_pool[CACHE_POOL_MAX];
+static int cache_pool_length = 0;
 
-BSTree CACHE = {0};
-CACHE.cmp = cache_cmp;
-CACHE.free = cache_free;
+static worker_pool cache_workers;
+static worker_pool cache_ahead_workers;
+
+static void cache_timer_fire (
+    timer_entry *entry);
+static int cache_expire_locked (
+    cache_shard *shard,
+    int mapfile_id);
+
+/***** counters in each row of a shards sketch *****/
+
+#define CACHE_SKETCH_WIDTH 2048
+
+/***** the window holds this share of a shards caches, at least 1 *****/
+
+#define CACHE_WINDOW_MAX(s) ((s)->table->length / 100 + 1)
+
+#define CACHE_LIST(s, c) ((c)->incold ? &(s)->cold : \
+                          (c)->inmain ? &(s)->lru : &(s)->window)
+
+/***** bytes charged for a cache and for a version on top of its buffer *****/
+
+#define CACHE_ENTRY_BYTES (sizeof(cache_node_data) + sizeof(DLList_node) + \
+                           sizeof(hash_slot))
+#define CACHE_VERSION_BYTES(v) (sizeof(cache_version) + sizeof(buffer) + \
+                                (v)->buf->alloced + \
+                                ((v)->gather ? (v)->gather->bytes : 0))
+#define CACHE_PACKED_BYTES(p) (sizeof(cache_packed) + (p)->length)
+
+/***** the budget may be changed while the cache is in use *****/
+
+#define CACHE_BUDGET __atomic_load_n(&cache_budget, __ATOMIC_RELAXED)
+
+#define CACHE_COLD_MAX (CACHE_BUDGET / 100 * cache_cold_share)
+
+#define CACHE_SHARD(id) (&CACHE[(unsigned int)(id) & (CACHE_SHARDS - 1)])
+
+/***** the members of a cache the fast path reads with no lock *****/
+
+#define CACHE_LOAD(m) __atomic_load_n(&(m), __ATOMIC_ACQUIRE)
+#define CACHE_STORE(m, v) __atomic_store_n(&(m), (v), __ATOMIC_RELEASE)
 
 
 /*****************************************************************************//**
-  function to compare cache data
+  function to delete a cache
   
- @param	cache1  the first cache pointer to be compared
- @param	cache2   the second cache pointer to be compared
+ @param	cache pointer to the cache to be free'ed
   
- @return	less than 0 if cache1 is less than cache2
- @return	0 if cache1 is equal to cache2
- @return	greater than 0 if cache1 is greater than cache2
-        
+ @return	nothing
+
 *******************************************************************************/
 
-int (BSTree_data_cmp_func)cache_cmp (
-    cache_node_data* cache1,
-    cache_node_data* cache2)
+void cache_free (
+    void *cache)
 {
-    return cache1->mapfile_id - cache2->mapfile_id;
+    cache_node_data *c = cache;
+
+    if (c->current)
+        cache_release(c->current);
+    free(c->packed);
+    free(c);
 }
 
+#ifdef HAVE_LZ4
+
+/***** only cache_unpack() takes buffers from the pool *****/
+
 /*****************************************************************************//**
-  function to delete a cache
-  
- @param	cache pointer to the cache to be free'ed
-  
+  function to get a buffer from the pool
+
+ @param	size    number of bytes the buffer must have room for
+
+ @return	the buffer
+ @return	NULL if malloc fails
+*******************************************************************************/
+
+static buffer *cache_pool_get (
+    size_t size)
+{
+    buffer *buf = NULL;
+    char *grown;
+
+    pthread_mutex_lock(&cache_pool_lock);
+    if (cache_pool_length)
+        buf = cache_pool[--cache_pool_length];
+    pthread_mutex_unlock(&cache_pool_lock);
+
+    if (!buf && !(buf = calloc(1, sizeof(buffer))))
+        return NULL;
+
+    if (buf->alloced < size) {
+        if (!(grown = realloc(buf->buf, size))) {
+            buffer_free(buf);
+            free(buf);
+            return NULL;
+        }
+        buf->buf = grown;
+        buf->alloced = size;
+    }
+
+    buf->used = 0;
+
+    return buf;
+}
+
+#endif
+
+/*****************************************************************************//**
+  function to put a buffer back in the pool, it is free'ed if the pool is full
+*******************************************************************************/
+
+static void cache_pool_put (
+    buffer *buf)
+{
+    pthread_mutex_lock(&cache_pool_lock);
+
+    if (cache_pool_length < CACHE_POOL_MAX) {
+        cache_pool[cache_pool_length++] = buf;
+        buf = NULL;
+    }
+
+    pthread_mutex_unlock(&cache_pool_lock);
+
+    if (buf) {
+        buffer_free(buf);
+        free(buf);
+    }
+}
+
+/*****************************************************************************//**
+  function to free a version once the last reference is gone
+*******************************************************************************/
+
+static void cache_version_free (
+    cache_version *version)
+{
+    if (version->gather)
+        frag_list_free(version->gather);
+    if (version->snap) {
+        snap_release(version->snap);
+        free(version->buf);
+    }
+    else if (version->pooled)
+        cache_pool_put(version->buf);
+    else {
+        buffer_free(version->buf);
+        free(version->buf);
+    }
+    free(version);
+}
+
+/*****************************************************************************//**
+  function to drop the reference a cache held on a version it no longer has
+  as current, once no reader can still be taking a reference from it
+*******************************************************************************/
+
+static void cache_version_retire (
+    void *data)
+{
+    cache_release(data);
+}
+
+/*****************************************************************************//**
+  function to free a table that has been replaced, the caches are not free'ed
+*******************************************************************************/
+
+static void cache_table_free (
+    void *data)
+{
+    hash_table *table = data;
+
+    free(table->slots);
+    free(table);
+}
+
+/*****************************************************************************//**
+  function to copy the table of a shard for a change
+
+ @param	shard   the shard, locked
+
+ @return	the copy
+ @return	NULL if malloc fails
+*******************************************************************************/
+
+static hash_table *cache_table_copy (
+    cache_shard *shard)
+{
+    hash_table *table;
+
+    if (!(table = malloc(sizeof(hash_table))))
+        return NULL;
+
+    if (hash_copy(table, shard->table)) {
+        free(table);
+        return NULL;
+    }
+
+    return table;
+}
+
+/*****************************************************************************//**
+  function to publish a grown copy of the table of a shard
+
+ @param	shard   the shard, locked
+ @param	table   the copy from cache_table_copy()
+
+ @return	the old table
+
+  note:
+        readers that loaded the old table keep using it, the caller frees it
+        with epoch_defer() once the shard is unlocked
+*******************************************************************************/
+
+static hash_table *cache_table_publish (
+    cache_shard *shard,
+    hash_table *table)
+{
+    hash_table *old = shard->table;
+
+    CACHE_STORE(shard->table, table);
+
+    return old;
+}
+
+/*****************************************************************************//**
+  function to add a cache to the table of a shard
+
+ @param	shard       the shard, locked
+ @param	mapfile_id  the id of the mapfile
+ @param	cache       the cache
+ @param	retired     set to the table replaced if it had to grow, else NULL
+
+ @return	0 on success
+ @return	-1 if malloc fails
+
+  note:
+        the key is placed in the published table while it has room, readers
+        look again if they race it. only when the slots have to grow is the
+        table copied, once per doubling
+*******************************************************************************/
+
+static int cache_table_insert (
+    cache_shard *shard,
+    int mapfile_id,
+    cache_node_data *cache,
+    hash_table **retired)
+{
+    hash_table *table;
+
+    *retired = NULL;
+
+    if (hash_room(shard->table))
+        return hash_insert(shard->table, mapfile_id, cache);
+
+    if (!(table = cache_table_copy(shard)))
+        return -1;
+
+    if (hash_insert(table, mapfile_id, cache)) {
+        cache_table_free(table);
+        return -1;
+    }
+
+    *retired = cache_table_publish(shard, table);
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to unlock a shard and free the table a cache_find_add() replaced
+
+ @param	shard   the shard, locked
+ @param	retired the table replaced, may be NULL
+
+ @return	nothing
+
+  note:
+        the table is not deferred with the shard locked, on a failed malloc
+        epoch_defer() waits for the readers and a reader may be waiting on
+        the lock
+*******************************************************************************/
+
+static void cache_shard_unlock (
+    cache_shard *shard,
+    hash_table *retired)
+{
+    pthread_mutex_unlock(&shard->lock);
+
+    if (retired)
+        epoch_defer(cache_table_free, retired);
+}
+
+/*****************************************************************************//**
+  function to setup the cache
+
+ @param	load    function to render a mapfile from the db
+ @param	expire  function to call when a cache expires, may be NULL
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+int cache_init (
+    cache_load_func load,
+    cache_expire_func expire)
+{
+    int i;
+
+    cache_load = load;
+    cache_expired = expire;
+
+    epoch_init();
+    timer_init();
+
+    for (i = 0; i < CACHE_SHARDS; i++) {
+        if (pthread_mutex_init(&CACHE[i].lock, NULL))
+            return -ENOMEM;
+
+        if (!(CACHE[i].table = calloc(1, sizeof(hash_table))))
+            return -ENOMEM;
+
+        CACHE[i].lru.length = 0;
+        CACHE[i].lru.head = NULL;
+        CACHE[i].lru.tail = NULL;
+        CACHE[i].window.length = 0;
+        CACHE[i].window.head = NULL;
+        CACHE[i].window.tail = NULL;
+        CACHE[i].cold.length = 0;
+        CACHE[i].cold.head = NULL;
+        CACHE[i].cold.tail = NULL;
+        CACHE[i].freq.counters = NULL;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to set the eviction policy of the cache
+
+ @param	policy  the policy
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        must be called after cache_init() and before the cache is used
+*******************************************************************************/
+
+int cache_set_policy (
+    cache_policy policy)
+{
+    int i;
+
+    if (policy == CACHE_POLICY_TINYLFU) {
+        for (i = 0; i < CACHE_SHARDS; i++) {
+            if (!CACHE[i].freq.counters &&
+                sketch_init(&CACHE[i].freq, CACHE_SKETCH_WIDTH))
+                return -ENOMEM;
+        }
+    }
+
+    cache_evict_policy = policy;
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to serve expired mapfiles while they are refreshed in the background
+
+ @param	max_stale   seconds an expired version may still be handed out, 0 to
+                    always wait for the db
+ @param	nthreads    number of threads to refresh on
+
+ @return	nothing
+
+  note:
+        must be called after cache_init() and before cache_start(). an open
+        of a mapfile expired longer than max_stale waits for the refresh
+*******************************************************************************/
+
+void cache_set_stale (
+    time_t max_stale,
+    int nthreads)
+{
+    cache_stale_max = max_stale;
+    cache_stale_threads = nthreads;
+}
+
+/*****************************************************************************//**
+  function to remember mapfiles the db says do not exist
+
+ @param	ttl     seconds a negative entry is kept, 0 to ask the db every time
+
+ @return	nothing
+
+  note:
+        an expire of the mapfile drops its negative entry at once
+*******************************************************************************/
+
+void cache_set_negative (
+    time_t ttl)
+{
+    cache_negative_ttl = ttl;
+}
+
+/*****************************************************************************//**
+  function to expire rendered mapfiles after a time even if the db never
+  says they changed
+
+ @param	ttl     seconds a render is trusted, 0 to trust it till an expire
+
+ @return	nothing
+
+  note:
+        a safety net for changes no notification was sent for. the deadline
+        of each cache is kept in the timer wheel so nothing scans the caches
+        for the ones that ran out, call it before cache_start()
+*******************************************************************************/
+
+void cache_set_ttl (
+    time_t ttl)
+{
+    cache_ttl = ttl;
+}
+
+/*****************************************************************************//**
+  function to render hot mapfiles again before they are asked for
+
+ @param	ahead       seconds before the ttl runs out a hot mapfile is rendered
+                    again, 0 to only render it again once it has expired
+ @param	hits        gets since it was last refreshed ahead for a mapfile to
+                    count as hot, 0 for no refresh ahead
+ @param	nthreads    number of threads to render on
+
  @return	nothing
 
+  note:
+        must be called after cache_init() and before cache_start(). the
+        pool is separate from the one of cache_set_stale() so speculative
+        renders never hold up a refresh a get is waiting on
+*******************************************************************************/
+
+void cache_set_ahead (
+    time_t ahead,
+    unsigned int hits,
+    int nthreads)
+{
+    cache_ahead_time = ahead;
+    cache_ahead_hits = hits;
+    cache_ahead_threads = nthreads;
+}
+
+/*****************************************************************************//**
+  function to get how long a negative entry is kept
+
+ @return	the ttl in seconds, 0 if negative entries are off
+*******************************************************************************/
+
+time_t cache_get_negative (void)
+{
+    return cache_negative_ttl;
+}
+
+/*****************************************************************************//**
+  function to keep cold mapfiles compressed instead of evicting them
+
+ @param	share   percent of the budget the cold tier may use, 0 for no cold
+                tier
+
+ @return	0 on success
+ @return	-ENOTSUP if not built with HAVE_LZ4
+ @return	-EINVAL if the share is over 100
+
+  note:
+        the coldest mapfile is compressed with lz4 when the cache is over
+        its budget, once the cold tier is over its share the coldest
+        compressed one is evicted. rendered mapfiles are repetitive text
+        and compress several times over, so many more fit in the budget.
+        the hot tier is read with no copy, a get from the cold tier
+        decompresses
+*******************************************************************************/
+
+int cache_set_cold (
+    unsigned int share)
+{
+    if (share > 100)
+        return -EINVAL;
+
+#ifndef HAVE_LZ4
+    if (share)
+        return -ENOTSUP;
+#endif
+
+    cache_cold_share = share;
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to start the background threads of the cache
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        threads do not survive a fork so this is called once the filesystem
+        has daemonized, if it fails expired mapfiles are read in the
+        foreground as if cache_set_stale() was never called. the timer
+        thread is only started if there is a ttl to keep
+*******************************************************************************/
+
+int cache_start (void)
+{
+    int res;
+
+    if ((cache_ttl || cache_negative_ttl) && (res = timer_start()))
+        return res;
+
+    if (cache_ahead_hits && cache_ahead_threads > 0 && !cache_ahead_running) {
+        if ((res = worker_init(&cache_ahead_workers, cache_ahead_threads)))
+            return res;
+
+        cache_ahead_running = 1;
+    }
+
+    if ((!cache_stale_max && !cache_unchecked) || cache_stale_threads < 1 ||
+        cache_stale_running)
+        return 0;
+
+    if ((res = worker_init(&cache_workers, cache_stale_threads)))
+        return res;
+
+    cache_stale_running = 1;
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to free all the caches
+
+ @return	nothing
 *******************************************************************************/
 
-void  (BSTree_data_free_func)cache_free (
-    cache_node_data* cache)
+void cache_destroy (void)
 {
-    buffer_free(cache->buf);
+    int i;
+
+    /***** refreshes still queued and ttls running out need the shards *****/
+
+    timer_stop();
+
+    if (cache_ahead_running) {
+        cache_ahead_running = 0;
+        worker_destroy(&cache_ahead_workers);
+    }
+
+    if (cache_stale_running) {
+        cache_stale_running = 0;
+        worker_destroy(&cache_workers);
+    }
+
+    /***** evicted caches and replaced tables waiting on readers *****/
+
+    epoch_barrier();
+
+    for (i = 0; i < CACHE_SHARDS; i++) {
+        pthread_mutex_lock(&CACHE[i].lock);
+        DLList_delete_all(&CACHE[i].lru, cache_free);
+        DLList_delete_all(&CACHE[i].window, cache_free);
+        DLList_delete_all(&CACHE[i].cold, cache_free);
+        sketch_free(&CACHE[i].freq);
+        cache_table_free(CACHE[i].table);
+        CACHE[i].table = NULL;
+        pthread_mutex_unlock(&CACHE[i].lock);
+        pthread_mutex_destroy(&CACHE[i].lock);
+    }
+
+    while (cache_pool_length) {
+        buffer_free(cache_pool[--cache_pool_length]);
+        free(cache_pool[cache_pool_length]);
+    }
 }
 
+/*****************************************************************************//**
+  function to render a new version of a mapfile from the db
+
+ @param	mapfile_id  the id of the mapfile
+ @param	err         set to a negative errno on failure
+
+ @return	the new version with one reference held
+ @return	NULL on failure
+*******************************************************************************/
+
+static cache_version *cache_version_new (
+    int mapfile_id,
+    int *err)
+{
+    cache_version *version;
+    int res;
+
+    if (!(version = calloc(1, sizeof(cache_version)))) {
+        *err = -ENOMEM;
+        return NULL;
+    }
+
+    if (!(version->buf = calloc(1, sizeof(buffer)))) {
+        free(version);
+        *err = -ENOMEM;
+        return NULL;
+    }
+
+    version->mapfile_id = mapfile_id;
+    version->refs = 1;
+
+    /***** blocks the render adds with frag_add() become pieces of the
+           gather list, the unchanged ones are not rendered again *****/
+
+    if (!(version->gather = frag_list_new())) {
+        cache_version_free(version);
+        *err = -ENOMEM;
+        return NULL;
+    }
+    version->buf->gather = version->gather;
+
+    if ((res = cache_load(mapfile_id, version->buf)) ||
+        (res = frag_list_finish(version->gather, version->buf))) {
+        cache_version_free(version);
+        *err = res;
+        return NULL;
+    }
+
+    version->buf->gather = NULL;
+    version->size = version->gather->length;
+
+    /***** nothing was added, it is all in buf *****/
+
+    if (version->gather->npieces < 2 && !(version->gather->npieces &&
+                                         version->gather->pieces[0].frag)) {
+        frag_list_free(version->gather);
+        version->gather = NULL;
+    }
+
+    version->serial = __sync_add_and_fetch(&cache_serial, 1);
+    version->mtime = time(NULL);
+
+    /***** hashed with no lock held in case it checks a restored one *****/
 
+    if (CACHE_LOAD(cache_unchecked))
+        cache_etag(version);
+
+    return version;
+}
+
+/*****************************************************************************//**
+  function to move a cache from the window to main
+
+ @param	shard   the shard, locked
+ @param	cache   the cache, in the window
+
+ @return	0 on success
+ @return	-1 if malloc fails
+*******************************************************************************/
+
+static int cache_promote (
+    cache_shard *shard,
+    cache_node_data *cache)
+{
+    DLList_node *node;
+
+    if (!(node = DLList_append(&shard->lru, cache)))
+        return -1;
+
+    DLList_delete(&shard->window, cache->lru);
+    cache->lru = node;
+    cache->inmain = 1;
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to find a cache in a shard, adding an empty one if not found
+
+ @param	shard       the shard, locked
+ @param	mapfile_id  the id of the mapfile
+ @param	retired     set to the table replaced if it had to grow, the caller
+                    frees it with cache_shard_unlock()
+
+ @return	the cache
+ @return	NULL if malloc fails
+*******************************************************************************/
+
+static cache_node_data *cache_find_add (
+    cache_shard *shard,
+    int mapfile_id,
+    hash_table **retired)
+{
+    cache_node_data *cache;
+
+    *retired = NULL;
+
+    if ((cache = hash_find(shard->table, mapfile_id)))
+        return cache;
+
+    if (!(cache = calloc(1, sizeof(cache_node_data))))
+        return NULL;
+
+    cache->mapfile_id = mapfile_id;
+
+    /***** under tinylfu a new cache has to earn its way into main *****/
+
+    cache->inmain = cache_evict_policy != CACHE_POLICY_TINYLFU;
+
+    if (!(cache->lru = DLList_append(CACHE_LIST(shard, cache), cache))) {
+        free(cache);
+        return NULL;
+    }
+
+    if (cache_table_insert(shard, mapfile_id, cache, retired)) {
+        DLList_delete(CACHE_LIST(shard, cache), cache->lru);
+        free(cache);
+        return NULL;
+    }
+
+    cache->bytes = CACHE_ENTRY_BYTES;
+    __sync_fetch_and_add(&cache_counters.bytes, cache->bytes);
+
+    /***** while there is room the window spills into main freely, once the
+           cache is full it takes a contest in cache_victim() *****/
+
+    if (!cache->inmain && shard->window.length > CACHE_WINDOW_MAX(shard) &&
+        (!CACHE_BUDGET || cache_counters.bytes < CACHE_BUDGET))
+        cache_promote(shard, shard->window.head->data);
+
+    return cache;
+}
+
+/*****************************************************************************//**
+  function to charge a cache for its current version
+
+ @param	cache   the cache, its shard locked
+
+ @return	nothing
+*******************************************************************************/
+
+static void cache_charge (
+    cache_node_data *cache)
+{
+    size_t bytes = CACHE_ENTRY_BYTES;
+
+    if (cache->current)
+        bytes += CACHE_VERSION_BYTES(cache->current);
+    if (cache->packed)
+        bytes += CACHE_PACKED_BYTES(cache->packed);
+
+    __sync_fetch_and_add(&cache_counters.bytes, bytes - cache->bytes);
+    cache->bytes = bytes;
+}
+
+/*****************************************************************************//**
+  function to count the hits a cache took with no lock in the sketch
+
+ @param	shard   the shard, locked
+ @param	cache   the cache
+
+ @return	the number of hits
+*******************************************************************************/
+
+static unsigned int cache_drain (
+    cache_shard *shard,
+    cache_node_data *cache)
+{
+    unsigned int touched;
+    unsigned int i;
+
+    if (!(touched = __atomic_exchange_n(&cache->touched, 0, __ATOMIC_RELAXED)))
+        return 0;
+
+    if (cache_evict_policy == CACHE_POLICY_TINYLFU) {
+        for (i = 0; i < touched; i++)
+            sketch_add(&shard->freq, cache->mapfile_id);
+    }
+
+    return touched;
+}
+
+/*****************************************************************************//**
+  function to get the coldest cache in a list that has no load in flight
+
+ @param	shard   the shard, locked
+ @param	list    the list
+
+ @return	the cache
+ @return	NULL if every cache in the list has a load in flight
+
+  note:
+        a cache hit since it was last looked at goes to the tail instead,
+        so the list is only put in recency order when something is evicted
+*******************************************************************************/
+
+static cache_node_data *cache_coldest (
+    cache_shard *shard,
+    DLList *list)
+{
+    DLList_node *node;
+    DLList_node *next;
+    cache_node_data *cache;
+    size_t n = list->length;
+
+    for (node = list->head; node && n; node = next, n--) {
+        cache = node->data;
+        next = node->next;
+
+        if (cache_drain(shard, cache))
+            DLList_move_tail(list, node);
+        else if (!cache->flight)
+            return cache;
+    }
+
+    /***** all of them were hit, the first one now is the coldest *****/
+
+    for (node = list->head; node; node = node->next) {
+        if (!((cache_node_data *)node->data)->flight)
+            return node->data;
+    }
+
+    return NULL;
+}
+
+/*****************************************************************************//**
+  function to pick the cache to evict from a shard
+
+ @param	shard   the shard, locked
+
+ @return	the cache to evict
+ @return	NULL if there is nothing that can be evicted
+
+  note:
+        under tinylfu a cache leaving the full window is compared with the
+        coldest main cache, the one asked for less often is evicted and the
+        other is kept in main
+*******************************************************************************/
+
+static cache_node_data *cache_victim (
+    cache_shard *shard)
+{
+    cache_node_data *cand;
+    cache_node_data *victim;
+
+    victim = cache_coldest(shard, &shard->lru);
+
+    if (cache_evict_policy != CACHE_POLICY_TINYLFU)
+        return victim;
+
+    cand = cache_coldest(shard, &shard->window);
+
+    if (!cand || (victim && shard->window.length < CACHE_WINDOW_MAX(shard)))
+        return victim ? victim : cand;
+
+    /***** the candidate leaves the window, it only gets in to main if it has
+           been asked for more often than the cache it would push out *****/
+
+    if (victim &&
+        sketch_estimate(&shard->freq, cand->mapfile_id) <=
+        sketch_estimate(&shard->freq, victim->mapfile_id))
+        return cand;
+
+    if (cache_promote(shard, cand))
+        return cand;
+
+    /***** main was empty, nothing to push out but the window *****/
+
+    if (!victim)
+        return cache_coldest(shard, &shard->window);
+
+    return victim;
+}
+
+/*****************************************************************************//**
+  function to count a get towards refreshing the cache ahead
+
+ @param	cache   the cache, its shard locked or found in a read section
+
+  note:
+        like touched the count stops at the hot threshold so a hot cache
+        is not written on every hit
+*******************************************************************************/
+
+static void cache_heat (
+    cache_node_data *cache)
+{
+    unsigned int heat;
+
+    if (!cache_ahead_hits)
+        return;
+
+    if ((heat = __atomic_load_n(&cache->heat, __ATOMIC_RELAXED)) <
+        cache_ahead_hits)
+        __atomic_store_n(&cache->heat, heat + 1, __ATOMIC_RELAXED);
+}
+
+/*****************************************************************************//**
+  function to note a mapfile was asked for
+
+ @param	shard   the shard, locked
+ @param	cache   the cache, NULL if it is not in the shard
+ @param	mapfile_id  the id of the mapfile
+*******************************************************************************/
+
+static void cache_touch (
+    cache_shard *shard,
+    cache_node_data *cache,
+    int mapfile_id)
+{
+    if (cache_evict_policy == CACHE_POLICY_TINYLFU)
+        sketch_add(&shard->freq, mapfile_id);
+
+    if (cache) {
+        cache_drain(shard, cache);
+        DLList_move_tail(CACHE_LIST(shard, cache), cache->lru);
+        cache_heat(cache);
+    }
+}
+
+/*****************************************************************************//**
+  function to note a hit with no lock held
+
+ @param	cache   the cache, found in a read section
+
+  note:
+        the count is only stored while it is under SKETCH_MAX, a hot cache
+        is read and never written so its line is not bounced between the
+        threads hitting it. hits that race may count as one
+*******************************************************************************/
+
+static void cache_touch_lockless (
+    cache_node_data *cache)
+{
+    unsigned int touched = __atomic_load_n(&cache->touched, __ATOMIC_RELAXED);
+
+    if (touched < SKETCH_MAX)
+        __atomic_store_n(&cache->touched, touched + 1, __ATOMIC_RELAXED);
+
+    cache_heat(cache);
+}
+
+/*****************************************************************************//**
+  function to note a restored cache no longer needs checking
+
+ @param	cache   the cache, its shard locked
+*******************************************************************************/
+
+static void cache_checked (
+    cache_node_data *cache)
+{
+    if (!cache->unchecked)
+        return;
+
+    CACHE_STORE(cache->unchecked, 0);
+    __sync_fetch_and_sub(&cache_unchecked, 1);
+}
+
+/*****************************************************************************//**
+  function to compress a version for the cold tier
+
+ @param	version the version, a reference held
+
+ @return	the compressed version
+ @return	NULL if it does not get enough smaller or malloc fails
+*******************************************************************************/
+
+static cache_packed *cache_pack (
+    cache_version *version)
+{
+#ifdef HAVE_LZ4
+    cache_packed *packed;
+    cache_packed *shrunk;
+    buffer *flat = NULL;
+    const char *src = version->buf->buf;
+    int bound;
+    int length;
+
+    if (!version->size || version->size > LZ4_MAX_INPUT_SIZE)
+        return NULL;
+
+    /***** lz4 wants the mapfile in one piece *****/
+
+    if (version->gather) {
+        if (!(flat = cache_pool_get(version->size)))
+            return NULL;
+        frag_list_copy(version->gather, flat->buf, version->size, 0);
+        src = flat->buf;
+    }
+
+    bound = LZ4_compressBound(version->size);
+
+    if ((packed = malloc(sizeof(cache_packed) + bound))) {
+        length = LZ4_compress_default(src, packed->data, version->size, bound);
+
+        /***** not worth a decompress on every get *****/
+
+        if (length <= 0 || (size_t) length > version->size / 4 * 3) {
+            free(packed);
+            packed = NULL;
+        }
+        else {
+            if ((shrunk = realloc(packed, sizeof(cache_packed) + length)))
+                packed = shrunk;
+            packed->size = version->size;
+            packed->length = length;
+            packed->serial = version->serial;
+            packed->mtime = version->mtime;
+            packed->etag = version->etag;
+        }
+    }
+
+    if (flat)
+        cache_pool_put(flat);
+
+    return packed;
+#else
+    (void) version;
+
+    return NULL;
+#endif
+}
+
+/*****************************************************************************//**
+  function to decompress a mapfile from the cold tier
+
+ @param	packed      the compressed mapfile, in a read section
+ @param	mapfile_id  the id of the mapfile
+ @param	err         set to a negative errno on failure
+
+ @return	a version of its own with one reference held, its buffer is from
+            the pool
+ @return	NULL on failure
+*******************************************************************************/
+
+static cache_version *cache_unpack (
+    cache_packed *packed,
+    int mapfile_id,
+    int *err)
+{
+#ifdef HAVE_LZ4
+    cache_version *version;
+
+    if (!(version = calloc(1, sizeof(cache_version)))) {
+        *err = -ENOMEM;
+        return NULL;
+    }
+
+    if (!(version->buf = cache_pool_get(packed->size))) {
+        free(version);
+        *err = -ENOMEM;
+        return NULL;
+    }
+
+    version->pooled = 1;
+    version->mapfile_id = mapfile_id;
+    version->refs = 1;
+    version->serial = packed->serial;
+    version->mtime = packed->mtime;
+    version->etag = packed->etag;
+    version->size = packed->size;
+
+    if (LZ4_decompress_safe(packed->data, version->buf->buf, packed->length,
+                            packed->size) != (int) packed->size) {
+        cache_version_free(version);
+        *err = -EIO;
+        return NULL;
+    }
+
+    version->buf->used = packed->size;
+
+    return version;
+#else
+    (void) packed;
+    (void) mapfile_id;
+
+    *err = -ENOTSUP;
+
+    return NULL;
+#endif
+}
+
+/*****************************************************************************//**
+  function to take a cache out of the cold tier once it has a current version
+  again
+
+ @param	shard   the shard, locked
+ @param	cache   the cache, current already set
+
+ @return	the compressed version it dropped, the caller frees it with
+            epoch_defer() once the shard is unlocked
+ @return	NULL if it was not cold
+*******************************************************************************/
+
+static cache_packed *cache_warm (
+    cache_shard *shard,
+    cache_node_data *cache)
+{
+    cache_packed *packed = cache->packed;
+    DLList_node *node;
+
+    if (!packed)
+        return NULL;
+
+    CACHE_STORE(cache->packed, NULL);
+    __sync_fetch_and_sub(&cache_counters.cold_bytes, CACHE_PACKED_BYTES(packed));
+
+    /***** if the move fails it stays in the cold list till it is evicted *****/
+
+    if ((node = DLList_append(&shard->lru, cache))) {
+        DLList_delete(&shard->cold, cache->lru);
+        cache->lru = node;
+        cache->incold = 0;
+        cache->inmain = 1;
+    }
+
+    return packed;
+}
+
+/*****************************************************************************//**
+  function to move a cache into the cold tier
+
+ @param	shard   the shard, locked
+ @param	cache   the cache, its current version is the one packed is of
+ @param	packed  the compressed current version, given to the cache on
+                success
+
+ @return	0 on success, the reference the cache held on its current version
+            is the callers to retire
+ @return	-1 if malloc fails
+
+  note:
+        packed is set before current is cleared so a reader sees one of them
+*******************************************************************************/
+
+static int cache_demote (
+    cache_shard *shard,
+    cache_node_data *cache,
+    cache_packed *packed)
+{
+    DLList_node *node;
+
+    if (!(node = DLList_append(&shard->cold, cache)))
+        return -1;
+
+    DLList_delete(CACHE_LIST(shard, cache), cache->lru);
+    cache->lru = node;
+    cache->incold = 1;
+    CACHE_STORE(cache->packed, packed);
+    CACHE_STORE(cache->current, NULL);
+    __atomic_store_n(&cache->touched, 0, __ATOMIC_RELAXED);
+    cache_charge(cache);
+    __sync_fetch_and_add(&cache_counters.cold_bytes,
+                         CACHE_PACKED_BYTES(packed));
+    __sync_fetch_and_add(&cache_counters.demotions, 1);
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to take a cache out of its shard
+
+ @param	shard   the shard, locked
+ @param	cache   the cache
+
+ @return	nothing
+
+  note:
+        a reader may have found it just before it was unlinked, the caller
+        frees it with epoch_defer(), or timer_defer() in a timer callback.
+        the key is deleted from the published table in place, nothing is
+        alloced or deferred here so it is safe in a read section
+*******************************************************************************/
+
+static void cache_unlink (
+    cache_shard *shard,
+    cache_node_data *cache)
+{
+    hash_delete(shard->table, cache->mapfile_id);
+    DLList_delete(CACHE_LIST(shard, cache), cache->lru);
+    __sync_fetch_and_sub(&cache_counters.bytes, cache->bytes);
+    if (cache->packed)
+        __sync_fetch_and_sub(&cache_counters.cold_bytes,
+                             CACHE_PACKED_BYTES(cache->packed));
+    cache_checked(cache);
+    timer_cancel(&cache->timer);
+}
+
+/*****************************************************************************//**
+  function to evict the coldest caches till the cache is in its budget
+
+ @param	first   shard to evict from first, the one that just grew, may be NULL
+
+ @return	nothing
+
+  note:
+        must be called with no shard locked, one shard is locked at a time
+        and a cache with a load in flight is never evicted. with a cold tier
+        the coldest cache is compressed instead while the tier is in its
+        share, and the coldest compressed one is evicted once it is not
+*******************************************************************************/
+
+static void cache_evict (
+    cache_shard *first)
+{
+    static unsigned int next = 0;
+    unsigned int idle = 0;
+    cache_shard *shard;
+    cache_node_data *cache;
+    cache_version *version;
+    cache_packed *packed;
+
+    while (CACHE_BUDGET && cache_counters.bytes > CACHE_BUDGET &&
+           idle < CACHE_SHARDS) {
+
+        if (first) {
+            shard = first;
+            first = NULL;
+        }
+        else
+            shard = &CACHE[__sync_fetch_and_add(&next, 1) & (CACHE_SHARDS - 1)];
+
+        pthread_mutex_lock(&shard->lock);
+
+        cache = NULL;
+
+        if (cache_cold_share && cache_counters.cold_bytes > CACHE_COLD_MAX)
+            cache = cache_coldest(shard, &shard->cold);
+
+        if (!cache && (cache = cache_victim(shard)) && cache_cold_share &&
+            cache->current && !cache->expired && !cache->unchecked) {
+            version = cache->current;
+            __sync_fetch_and_add(&version->refs, 1);
+
+            /***** compressed with no lock held, the read section keeps the
+                   cache from being freed meanwhile *****/
+
+            epoch_enter();
+            pthread_mutex_unlock(&shard->lock);
+
+            packed = cache_pack(version);
+
+            pthread_mutex_lock(&shard->lock);
+
+            /***** once it is known to be linked the lock keeps it *****/
+
+            if (hash_find(shard->table, cache->mapfile_id) != cache)
+                cache = NULL;
+
+            epoch_exit();
+
+            /***** evicted, or asked for or changed, while it compressed *****/
+
+            if (!cache || cache->current != version || cache->expired ||
+                cache->flight) {
+                pthread_mutex_unlock(&shard->lock);
+                free(packed);
+                cache_release(version);
+                if (cache)
+                    idle++;
+                else
+                    idle = 0;
+                continue;
+            }
+
+            if (packed && !cache_demote(shard, cache, packed)) {
+                pthread_mutex_unlock(&shard->lock);
+                epoch_defer(cache_version_retire, version);
+                cache_release(version);
+                idle = 0;
+                continue;
+            }
+
+            /***** it did not compress, evict it. the cache still holds the
+                   version so this is not the last reference *****/
+
+            free(packed);
+            cache_release(version);
+        }
+
+        if (!cache)
+            cache = cache_coldest(shard, &shard->cold);
+
+        if (cache) {
+            cache_unlink(shard, cache);
+            idle = 0;
+        }
+        else
+            idle++;
+
+        pthread_mutex_unlock(&shard->lock);
+
+        /***** a reader may have found it just before it was unlinked *****/
+
+        if (cache) {
+            __sync_fetch_and_add(&cache_counters.evictions, 1);
+            epoch_defer(cache_free, cache);
+        }
+    }
+}
+
+/*****************************************************************************//**
+  function to put a mapfile asked for often while in the cold tier back in
+  the hot tier
+
+ @param	shard   the shard, not locked
+ @param	version the version decompressed for the get, a reference is taken
+                for the cache
+*******************************************************************************/
+
+static void cache_thaw (
+    cache_shard *shard,
+    cache_version *version)
+{
+    cache_node_data *cache;
+    cache_packed *packed = NULL;
+
+    pthread_mutex_lock(&shard->lock);
+
+    if ((cache = hash_find(shard->table, version->mapfile_id)) &&
+        !cache->current && !cache->expired && cache->packed &&
+        cache->packed->serial == version->serial) {
+        __sync_fetch_and_add(&version->refs, 1);
+        CACHE_STORE(cache->current, version);
+        packed = cache_warm(shard, cache);
+        cache_charge(cache);
+        __sync_fetch_and_add(&cache_counters.promotions, 1);
+    }
+    else
+        cache = NULL;
+
+    pthread_mutex_unlock(&shard->lock);
+
+    /***** a reader may still be decompressing it *****/
+
+    if (packed)
+        epoch_defer(free, packed);
+
+    if (cache)
+        cache_evict(shard);
+}
+
+/*****************************************************************************//**
+  function to set the timer of a cache for the ttl of its current version
+
+ @param	cache       the cache, its shard locked
+ @param	rendered    when the current version was known to be up to date
+
+  note:
+        with refresh ahead the timer goes off early enough to render a hot
+        mapfile again before the ttl runs out, cache_timer_fire() tells the
+        two apart by due
+*******************************************************************************/
+
+static void cache_arm (
+    cache_node_data *cache,
+    time_t rendered)
+{
+    time_t when;
+
+    if (!cache_ttl)
+        return;
+
+    when = cache->due = rendered + cache_ttl;
+
+    if (cache_ahead_hits && cache_ahead_time && cache_ahead_time < cache_ttl)
+        when -= cache_ahead_time;
+
+    timer_add(&cache->timer, when, cache_timer_fire);
+}
+
+/*****************************************************************************//**
+  function to publish a new version of a mapfile
+
+ @param	version     the new version, the reference held on it is given to the
+                    cache
+ @param	force       if non zero replace a current version as well as an
+                    expired one
+ @param	tell        if non zero call the expire function when a version the
+                    kernel may have cached is replaced
+ @param	err         set to a negative errno on failure
+
+ @return	the version that is current after the publish with a reference held
+ @return	NULL on failure
+
+  note:
+        tell must be 0 on the request path, telling the kernel about the
+        mapfile a lookup is for waits on the lookup. a get only replaces a
+        version that expired, the kernel was told then
+*******************************************************************************/
+
+static cache_version *cache_publish (
+    cache_version *version,
+    int force,
+    int tell,
+    int *err)
+{
+    cache_shard *shard = CACHE_SHARD(version->mapfile_id);
+    cache_node_data *cache;
+    cache_version *old = NULL;
+    cache_version *lost = NULL;
+    cache_packed *packed = NULL;
+    hash_table *retired;
+    int replaced = 0;
+
+    pthread_mutex_lock(&shard->lock);
+
+    if (!(cache = cache_find_add(shard, version->mapfile_id, &retired))) {
+        cache_shard_unlock(shard, retired);
+        cache_release(version);
+        *err = -ENOMEM;
+        return NULL;
+    }
+
+    /***** a restored version the db rendered the same is kept, nothing
+           the kernel has of it needs to be dropped *****/
+
+    if (!force && cache->unchecked &&
+        cache_etag(cache->current) == cache_etag(version)) {
+        CACHE_STORE(cache->expired, 0);
+        cache_checked(cache);
+        __sync_fetch_and_add(&cache_counters.revalidated, 1);
+        cache_arm(cache, time(NULL));
+        lost = version;
+    }
+
+    /***** replace it, unless someone beat us to it. current is set before
+           expired is cleared so a reader that sees it unexpired sees the
+           new version *****/
+
+    else if (force || cache->expired || !cache->current) {
+        old = cache->current;
+        replaced = old || cache->packed;
+        CACHE_STORE(cache->current, version);
+        CACHE_STORE(cache->expired, 0);
+        CACHE_STORE(cache->missing, 0);
+        cache->attr.size = version->size;
+        cache->attr.serial = version->serial;
+        cache->attr.mtime = version->mtime;
+        packed = cache_warm(shard, cache);
+        cache_charge(cache);
+        cache_checked(cache);
+        cache_arm(cache, version->mtime);
+    }
+    else
+        lost = version;
+
+    DLList_move_tail(CACHE_LIST(shard, cache), cache->lru);
+
+    version = cache->current;
+    __sync_fetch_and_add(&version->refs, 1);
+
+    cache_shard_unlock(shard, retired);
+
+    /***** a reader may still take a reference from the old current, the
+           caches reference is kept till it can not *****/
+
+    if (old)
+        epoch_defer(cache_version_retire, old);
+    if (packed)
+        epoch_defer(free, packed);
+    if (lost)
+        cache_release(lost);
+
+    /***** the kernel may hold the size of the old one for as long as the
+           attr timeout, a stale or restored one was stat'ed unexpired *****/
+
+    if (replaced && tell && cache_expired)
+        cache_expired(version->mapfile_id);
+
+    return version;
+}
+
+/*****************************************************************************//**
+  function to check if the db said a mapfile does not exist within the ttl
+
+ @param	cache   the cache, the shard locked or in a read section
+
+ @return	non zero if the negative entry is still good
+*******************************************************************************/
+
+static int cache_missing (
+    cache_node_data *cache)
+{
+    time_t missing = CACHE_LOAD(cache->missing);
+
+    return missing && time(NULL) - missing < cache_negative_ttl;
+}
+
+/*****************************************************************************//**
+  function to note the db said a mapfile does not exist
+
+ @param	cache   the cache, its shard locked
+ @param	err     the negative errno of the load
+*******************************************************************************/
+
+static void cache_set_missing (
+    cache_node_data *cache,
+    int err)
+{
+    time_t now;
+
+    if (err == -ENOENT && cache_negative_ttl) {
+        now = time(NULL);
+        CACHE_STORE(cache->missing, now);
+        timer_add(&cache->timer, now + cache_negative_ttl, cache_timer_fire);
+    }
+}
+
+/*****************************************************************************//**
+  function to start a load in flight
+
+ @return	the flight with the loaders reference held
+ @return	NULL if malloc fails
+*******************************************************************************/
+
+static cache_flight *cache_flight_new (void)
+{
+    cache_flight *flight;
+
+    if (!(flight = calloc(1, sizeof(cache_flight))))
+        return NULL;
+
+    if (pthread_mutex_init(&flight->lock, NULL)) {
+        free(flight);
+        return NULL;
+    }
+
+    if (pthread_cond_init(&flight->done, NULL)) {
+        pthread_mutex_destroy(&flight->lock);
+        free(flight);
+        return NULL;
+    }
+
+    flight->refs = 1;
+
+    return flight;
+}
+
+/*****************************************************************************//**
+  function to release a reference on a flight
+*******************************************************************************/
+
+static void cache_flight_release (
+    cache_flight *flight)
+{
+    if (__sync_sub_and_fetch(&flight->refs, 1))
+        return;
+
+    if (flight->version)
+        cache_release(flight->version);
+    pthread_cond_destroy(&flight->done);
+    pthread_mutex_destroy(&flight->lock);
+    free(flight);
+}
+
+/*****************************************************************************//**
+  function to wait for a load in flight
+
+ @param	flight  the flight with a reference held, it is released
+ @param	err     set to the negative errno of the load if it failed
+
+ @return	the version that was loaded with a reference held
+ @return	NULL if the load failed
+*******************************************************************************/
+
+static cache_version *cache_flight_wait (
+    cache_flight *flight,
+    int *err)
+{
+    cache_version *version;
+
+    pthread_mutex_lock(&flight->lock);
+
+    while (!flight->finished)
+        pthread_cond_wait(&flight->done, &flight->lock);
+
+    if ((version = flight->version))
+        __sync_fetch_and_add(&version->refs, 1);
+    else
+        *err = flight->err;
+
+    pthread_mutex_unlock(&flight->lock);
+
+    cache_flight_release(flight);
+
+    return version;
+}
+
+/*****************************************************************************//**
+  function to finish a load in flight and wake everyone waiting on it
+
+ @param	flight      the flight, the loaders reference is released
+ @param	mapfile_id  the id of the mapfile
+ @param	version     the version that was loaded, NULL if it failed
+ @param	err         the negative errno of the load if it failed
+*******************************************************************************/
+
+static void cache_flight_finish (
+    cache_flight *flight,
+    int mapfile_id,
+    cache_version *version,
+    int err)
+{
+    cache_shard *shard = CACHE_SHARD(mapfile_id);
+    cache_node_data *cache;
+
+    /***** new misses start their own load from here on *****/
+
+    pthread_mutex_lock(&shard->lock);
+
+    if ((cache = hash_find(shard->table, mapfile_id))) {
+        if (cache->flight == flight)
+            CACHE_STORE(cache->flight, NULL);
+        if (!version)
+            cache_set_missing(cache, err);
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+
+    pthread_mutex_lock(&flight->lock);
+
+    if ((flight->version = version))
+        __sync_fetch_and_add(&version->refs, 1);
+    flight->err = err;
+    flight->finished = 1;
+    pthread_cond_broadcast(&flight->done);
+
+    pthread_mutex_unlock(&flight->lock);
+
+    cache_flight_release(flight);
+}
+
+/*****************************************************************************//**
+  function to check if an expired cache may still be handed out
+
+ @param	cache   the cache, the shard locked or in a read section
+
+ @return	non zero if the current version is within the max staleness, or
+            was restored and is waiting to be checked
+*******************************************************************************/
+
+static int cache_stale_ok (
+    cache_node_data *cache)
+{
+    return cache_stale_running && CACHE_LOAD(cache->current) &&
+           (CACHE_LOAD(cache->unchecked) || (cache_stale_max &&
+            time(NULL) - CACHE_LOAD(cache->expired_at) <= cache_stale_max));
+}
+
+/*****************************************************************************//**
+  structure for a refresh queued on the workers
+*******************************************************************************/
+
+typedef struct {
+    int mapfile_id;
+    cache_flight *flight;
+    int ahead;
+} cache_job;
+
+/*****************************************************************************//**
+  function run on a worker to refresh an expired cache, or a hot one ahead
+  of its need
+*******************************************************************************/
+
+static void cache_background (
+    void *arg)
+{
+    cache_job *job = arg;
+    cache_version *version;
+    int outdated;
+    int err = 0;
+
+    __sync_fetch_and_add(&cache_counters.loads, 1);
+    if (job->ahead)
+        __sync_fetch_and_add(&cache_counters.ahead, 1);
+    else
+        __sync_fetch_and_add(&cache_counters.refreshes, 1);
+
+    /***** a render ahead replaces a version that has not expired *****/
+
+    if ((version = cache_version_new(job->mapfile_id, &err))) {
+        version->ahead = job->ahead;
+        version = cache_publish(version, job->ahead, 1, &err);
+    }
+
+    /***** an expire after the publish expires the new version itself *****/
+
+    outdated = __atomic_load_n(&job->flight->outdated, __ATOMIC_ACQUIRE);
+
+    cache_flight_finish(job->flight, job->mapfile_id, version, err);
+
+    if (version)
+        cache_release(version);
+
+    /***** the db changed while it rendered, what it read may be older *****/
+
+    if (version && outdated)
+        cache_expire(job->mapfile_id);
+
+    cache_evict(CACHE_SHARD(job->mapfile_id));
+
+    free(job);
+}
+
+/*****************************************************************************//**
+  function to queue the refresh of an expired cache
+
+ @param	flight      the flight the refresh is for with the loaders reference
+                    held, it is finished by the worker
+ @param	mapfile_id  the id of the mapfile
+ @param	ahead       non zero to render a hot cache ahead of its need on the
+                    refresh ahead pool
+*******************************************************************************/
+
+static void cache_queue_refresh (
+    cache_flight *flight,
+    int mapfile_id,
+    int ahead)
+{
+    cache_job *job;
+    int res = -ENOMEM;
+
+    if ((job = malloc(sizeof(cache_job)))) {
+        job->mapfile_id = mapfile_id;
+        job->flight = flight;
+        job->ahead = ahead;
+
+        if (!(res = worker_queue(ahead ? &cache_ahead_workers : &cache_workers,
+                                 cache_background, job)))
+            return;
+
+        free(job);
+    }
+
+    /***** the next get past max staleness tries again *****/
+
+    cache_flight_finish(flight, mapfile_id, NULL, res);
+}
+
+/*****************************************************************************//**
+  function to start rendering a cache ahead of its need if it is hot
+
+ @param	cache   the cache, its shard locked
+
+ @return	the flight to pass to cache_queue_refresh() once the shard is
+            unlocked
+ @return	NULL if the cache is cold or already has a load in flight
+
+  note:
+        the heat is counted again from 0 so a mapfile that stops being
+        asked for is only rendered ahead once more
+*******************************************************************************/
+
+static cache_flight *cache_ahead_locked (
+    cache_node_data *cache)
+{
+    cache_flight *flight;
+
+    if (!cache_ahead_running || cache->flight || cache->missing ||
+        __atomic_load_n(&cache->heat, __ATOMIC_RELAXED) < cache_ahead_hits ||
+        !(flight = cache_flight_new()))
+        return NULL;
+
+    CACHE_STORE(cache->flight, flight);
+    __atomic_store_n(&cache->heat, 0, __ATOMIC_RELAXED);
+
+    return flight;
+}
+
+/*****************************************************************************//**
+  function to render a cache that just expired again if it is hot
+
+ @param	mapfile_id  the id of the mapfile
+
+ @return	nothing
+*******************************************************************************/
+
+static void cache_ahead (
+    int mapfile_id)
+{
+    cache_shard *shard = CACHE_SHARD(mapfile_id);
+    cache_node_data *cache;
+    cache_flight *flight = NULL;
+
+    pthread_mutex_lock(&shard->lock);
+
+    if ((cache = hash_find(shard->table, mapfile_id)) && cache->expired)
+        flight = cache_ahead_locked(cache);
+
+    pthread_mutex_unlock(&shard->lock);
+
+    if (flight)
+        cache_queue_refresh(flight, mapfile_id, 1);
+}
+
+/*****************************************************************************//**
+  function to count a version rendered ahead as used the first time it is
+  handed out
+
+ @param	version the version
+*******************************************************************************/
+
+static void cache_ahead_used (
+    cache_version *version)
+{
+    if (__atomic_load_n(&version->ahead, __ATOMIC_RELAXED) &&
+        __sync_bool_compare_and_swap(&version->ahead, 1, 0))
+        __sync_fetch_and_add(&cache_counters.ahead_used, 1);
+}
+
+/*****************************************************************************//**
+  function to get the current version of a mapfile, reading a new one from the
+  db if not found or expired
+
+ @param	mapfile_id  the id of the mapfile
+ @param	err         set to a negative errno on failure
+
+ @return	the version with a reference held, release it with cache_release()
+ @return	NULL on failure
+
+  note:
+        a hit takes no lock, the only shared write is the reference taken on
+        the version. a miss locks only the shard the mapfile_id falls in, and
+        only while the table is changed, the db is read without any lock held.
+        only the first miss reads the db, misses while it is in flight wait
+        for its result. an expired version is returned as is within the max
+        staleness set with cache_set_stale(), the first such get queues the
+        refresh. a mapfile in the cold tier is decompressed into a version
+        that is not cached unless it is asked for again
+*******************************************************************************/
+
+cache_version *cache_get (
+    int mapfile_id,
+    int *err)
+{
+    cache_shard *shard = CACHE_SHARD(mapfile_id);
+    cache_node_data *cache;
+    cache_version *version = NULL;
+    cache_flight *flight;
+    cache_packed *packed;
+    int stale = 0;
+    int missing = 0;
+    int cold = 0;
+    int thaw = 0;
+    int outdated;
+    hash_table *retired;
+
+    /***** fast path, a current version, or a stale one with its refresh
+           already in flight. the cache holds its reference on any version
+           it has had as current until every read section that could see it
+           has left, so taking one here is safe. a compressed one is
+           decompressed into a version of its own *****/
+
+    epoch_enter();
+
+    if ((cache = hash_find_lockless(CACHE_LOAD(shard->table), mapfile_id))) {
+        if (cache_missing(cache))
+            missing = 1;
+        else if (!CACHE_LOAD(cache->expired)) {
+            if (!(version = CACHE_LOAD(cache->current)) &&
+                (packed = CACHE_LOAD(cache->packed))) {
+                version = cache_unpack(packed, mapfile_id, err);
+                cold = 1;
+            }
+        }
+        else if (CACHE_LOAD(cache->flight) && cache_stale_ok(cache)) {
+            version = CACHE_LOAD(cache->current);
+            stale = 1;
+        }
+
+        if (version) {
+            if (!cold)
+                __sync_fetch_and_add(&version->refs, 1);
+            cache_touch_lockless(cache);
+            thaw = cold && __atomic_load_n(&cache->touched, __ATOMIC_RELAXED) >=
+                           CACHE_COLD_PROMOTE;
+        }
+    }
+
+    epoch_exit();
+
+    if (cold) {
+        if (!version)
+            return NULL;
+
+        stats_count(STATS_CACHE_COLD);
+        if (thaw)
+            cache_thaw(shard, version);
+
+        return version;
+    }
+
+    if (version) {
+        stats_count(stale ? STATS_CACHE_STALE : STATS_CACHE_HITS);
+        cache_ahead_used(version);
+        return version;
+    }
+
+    /***** the db said it does not exist a moment ago *****/
+
+    if (missing) {
+        stats_count(STATS_CACHE_NEGATIVE);
+        *err = -ENOENT;
+        return NULL;
+    }
+
+    /***** not found or expired, join the load in flight or start one *****/
+
+    pthread_mutex_lock(&shard->lock);
+
+    if (!(cache = cache_find_add(shard, mapfile_id, &retired))) {
+        cache_shard_unlock(shard, retired);
+        *err = -ENOMEM;
+        return NULL;
+    }
+
+    cache_touch(shard, cache, mapfile_id);
+
+    if (cache_missing(cache)) {
+        cache_shard_unlock(shard, retired);
+        stats_count(STATS_CACHE_NEGATIVE);
+        *err = -ENOENT;
+        return NULL;
+    }
+
+    if (!cache->expired && (version = cache->current)) {
+        __sync_fetch_and_add(&version->refs, 1);
+        cache_shard_unlock(shard, retired);
+        stats_count(STATS_CACHE_HITS);
+        cache_ahead_used(version);
+        return version;
+    }
+
+    /***** compressed since the fast path looked *****/
+
+    if (!cache->expired && (packed = cache->packed)) {
+        epoch_enter();
+        pthread_mutex_unlock(&shard->lock);
+        version = cache_unpack(packed, mapfile_id, err);
+        epoch_exit();
+
+        if (retired)
+            epoch_defer(cache_table_free, retired);
+
+        if (version)
+            stats_count(STATS_CACHE_COLD);
+
+        return version;
+    }
+
+    /***** expired but fresh enough, hand it out and refresh behind it *****/
+
+    if (cache_stale_ok(cache)) {
+        version = cache->current;
+        __sync_fetch_and_add(&version->refs, 1);
+
+        if (!cache->flight && (flight = cache_flight_new()))
+            CACHE_STORE(cache->flight, flight);
+        else
+            flight = NULL;
+
+        cache_shard_unlock(shard, retired);
+        stats_count(STATS_CACHE_STALE);
+        cache_ahead_used(version);
+
+        if (flight)
+            cache_queue_refresh(flight, mapfile_id, 0);
+
+        return version;
+    }
+
+    __sync_fetch_and_add(&cache_counters.misses, 1);
+
+    if ((flight = cache->flight)) {
+        __sync_fetch_and_add(&flight->refs, 1);
+        cache_shard_unlock(shard, retired);
+        __sync_fetch_and_add(&cache_counters.coalesced, 1);
+
+        /***** joining a render ahead is still a shorter wait *****/
+
+        if ((version = cache_flight_wait(flight, err)))
+            cache_ahead_used(version);
+
+        return version;
+    }
+
+    if (!(flight = cache_flight_new())) {
+        cache_shard_unlock(shard, retired);
+        *err = -ENOMEM;
+        return NULL;
+    }
+    CACHE_STORE(cache->flight, flight);
+
+    cache_shard_unlock(shard, retired);
+
+    /***** read it with no lock held *****/
+
+    __sync_fetch_and_add(&cache_counters.loads, 1);
+
+    if ((version = cache_version_new(mapfile_id, err)))
+        version = cache_publish(version, 0, 0, err);
+
+    /***** an expire after the publish expires the new version itself *****/
+
+    outdated = __atomic_load_n(&flight->outdated, __ATOMIC_ACQUIRE);
+
+    cache_flight_finish(flight, mapfile_id, version, *err);
+
+    /***** the db changed while it rendered, it is handed out this once. the
+           expire function is not called on the request path, the kernel
+           was told when the row changed *****/
+
+    if (version && outdated) {
+        pthread_mutex_lock(&shard->lock);
+        cache_expire_locked(shard, mapfile_id);
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    cache_evict(shard);
+
+    return version;
+}
+
+/*****************************************************************************//**
+  function to get the metadata of a mapfile without rendering it
+
+ @param	mapfile_id  the id of the mapfile
+ @param	attr        filled in with the metadata
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        if the mapfile has not been rendered since it was read or expired a
+        size only pass of the load function is done, nothing is stored but
+        the length. attr->current tells if it may be trusted until the
+        mapfile expires
+*******************************************************************************/
+
+int cache_getattr (
+    int mapfile_id,
+    cache_attr *attr)
+{
+    cache_shard *shard = CACHE_SHARD(mapfile_id);
+    cache_node_data *cache;
+    cache_version *version;
+    cache_packed *packed;
+    buffer sized = {0};
+    int wait = 0;
+    int res = 1;
+    hash_table *retired;
+
+    /***** fast path, metadata of the current version, it never changes *****/
+
+    epoch_enter();
+
+    if ((cache = hash_find_lockless(CACHE_LOAD(shard->table), mapfile_id))) {
+        if (cache_missing(cache))
+            res = -ENOENT;
+        else if (!CACHE_LOAD(cache->expired) &&
+                 (version = CACHE_LOAD(cache->current))) {
+            attr->size = version->size;
+            attr->serial = version->serial;
+            attr->mtime = version->mtime;
+            attr->current = 1;
+            res = 0;
+        }
+        else if (!CACHE_LOAD(cache->expired) &&
+                 (packed = CACHE_LOAD(cache->packed))) {
+            attr->size = packed->size;
+            attr->serial = packed->serial;
+            attr->mtime = packed->mtime;
+            attr->current = 1;
+            res = 0;
+        }
+    }
+
+    epoch_exit();
+
+    if (res == -ENOENT)
+        stats_count(STATS_CACHE_NEGATIVE);
+    if (res != 1)
+        return res;
+
+    /***** metadata from the last render or sizing pass *****/
+
+    pthread_mutex_lock(&shard->lock);
+
+    if ((cache = hash_find(shard->table, mapfile_id))) {
+        *attr = cache->attr;
+        attr->current = !cache->expired && cache->current;
+        if (cache->expired && attr->mtime && !cache_stale_ok(cache))
+            wait = 1;
+    }
+    else
+        attr->mtime = 0;
+
+    pthread_mutex_unlock(&shard->lock);
+
+    /***** kept for a stale version too old to hand out now, wait for the
+           refresh like an open would *****/
+
+    if (wait) {
+        if (!(version = cache_get(mapfile_id, &res)))
+            return res;
+
+        attr->size = version->size;
+        attr->serial = version->serial;
+        attr->mtime = version->mtime;
+
+        /***** a load the db changed under is expired once it is handed out *****/
+
+        pthread_mutex_lock(&shard->lock);
+        cache = hash_find(shard->table, mapfile_id);
+        attr->current = cache && !cache->expired && cache->current == version;
+        pthread_mutex_unlock(&shard->lock);
+
+        cache_release(version);
+
+        return 0;
+    }
+
+    if (attr->mtime)
+        return 0;
+
+    /***** size only pass with no lock held *****/
+
+    sized.sizeonly = 1;
+    if ((res = cache_load(mapfile_id, &sized))) {
+        if (res == -ENOENT && cache_negative_ttl) {
+            pthread_mutex_lock(&shard->lock);
+            if ((cache = cache_find_add(shard, mapfile_id, &retired)))
+                cache_set_missing(cache, res);
+            cache_shard_unlock(shard, retired);
+        }
+        return res;
+    }
+
+    attr->size = sized.used;
+    attr->serial = 0;
+    attr->mtime = time(NULL);
+    attr->current = 0;
+
+    pthread_mutex_lock(&shard->lock);
+
+    if ((cache = cache_find_add(shard, mapfile_id, &retired))) {
+        if (cache->attr.mtime) {
+            *attr = cache->attr;
+            attr->current = !cache->expired && cache->current;
+        }
+        else
+            cache->attr = *attr;
+        CACHE_STORE(cache->missing, 0);
+    }
+
+    cache_shard_unlock(shard, retired);
+
+    cache_evict(shard);
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to render a new version of a mapfile and publish it
+
+ @param	mapfile_id  the id of the mapfile
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        readers keep getting the current version while the new one renders.
+        the expire function is called for the version it replaces, so it
+        must not be called on the request path
+*******************************************************************************/
+
+int cache_refresh (
+    int mapfile_id)
+{
+    cache_version *version;
+    int err = 0;
+
+    if (!(version = cache_version_new(mapfile_id, &err)))
+        return err;
+
+    if (!(version = cache_publish(version, 1, 1, &err)))
+        return err;
+
+    cache_release(version);
+
+    cache_evict(CACHE_SHARD(mapfile_id));
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to release a reference on a version
+
+ @param	version the version returned from cache_get()
+
+ @return	nothing
+*******************************************************************************/
+
+void cache_release (
+    cache_version *version)
+{
+    if (!__sync_sub_and_fetch(&version->refs, 1))
+        cache_version_free(version);
+}
+
+/*****************************************************************************//**
+  function to check if the kernel may keep its cached pages of a mapfile
+
+ @param	version the version being opened
+
+ @return	0 on the first open of a version
+ @return	non zero if the pages the kernel has are of this version
+*******************************************************************************/
+
+int cache_keep (
+    cache_version *version)
+{
+    return __sync_lock_test_and_set(&version->opened, 1);
+}
+
+/*****************************************************************************//**
+  function to get the hash of a rendered mapfile
+
+ @param	version the version
+
+ @return	the hash, the same for every version rendered the same
+
+  note:
+        the hash is kept in the version, versions never change so racing
+        callers store the same value
+*******************************************************************************/
+
+uint64_t cache_etag (
+    cache_version *version)
+{
+    uint64_t etag = __atomic_load_n(&version->etag, __ATOMIC_RELAXED);
+    size_t i;
+
+    if (etag)
+        return etag;
+
+    if (version->gather) {
+        etag = FRAG_HASH_INIT;
+        for (i = 0; i < version->gather->npieces; i++) {
+            etag = frag_hash(etag, version->gather->pieces[i].data,
+                             version->gather->pieces[i].length);
+        }
+    }
+    else
+        etag = frag_hash(FRAG_HASH_INIT, version->buf->buf, version->size);
+
+    __atomic_store_n(&version->etag, etag, __ATOMIC_RELAXED);
+
+    return etag;
+}
+
+/*****************************************************************************//**
+  function to put a version restored from a snapshot in the cache
+
+ @param	version the version with one reference held, it is given to the
+                cache even on failure
+
+ @return	0 on success
+ @return	-EEXIST if the mapfile is already cached
+ @return	a negative errno on failure
+
+  note:
+        the version is handed out at once but it is not trusted, the first
+        get queues a render and if the db renders the same bytes the
+        restored version is kept, otherwise it is replaced. call it before
+        cache_start(). versions are put in the recency lists in the order
+        they are adopted, coldest first
+*******************************************************************************/
+
+int cache_adopt (
+    cache_version *version)
+{
+    cache_shard *shard = CACHE_SHARD(version->mapfile_id);
+    cache_node_data *cache;
+    unsigned long serial;
+    hash_table *retired;
+
+    pthread_mutex_lock(&shard->lock);
+
+    if (!(cache = cache_find_add(shard, version->mapfile_id, &retired))) {
+        cache_shard_unlock(shard, retired);
+        cache_release(version);
+        return -ENOMEM;
+    }
+
+    if (cache->current || cache->packed || cache->flight || cache->missing) {
+        cache_shard_unlock(shard, retired);
+        cache_release(version);
+        return -EEXIST;
+    }
+
+    /***** expired is set before current so no reader trusts it *****/
+
+    CACHE_STORE(cache->expired_at, time(NULL));
+    CACHE_STORE(cache->expired, 1);
+    CACHE_STORE(cache->unchecked, 1);
+    CACHE_STORE(cache->current, version);
+    cache->attr.size = version->size;
+    cache->attr.serial = version->serial;
+    cache->attr.mtime = version->mtime;
+    cache_charge(cache);
+
+    cache_shard_unlock(shard, retired);
+
+    __sync_fetch_and_add(&cache_unchecked, 1);
+    __sync_fetch_and_add(&cache_counters.restored, 1);
+
+    /***** versions rendered from here on are newer than any restored *****/
+
+    while ((serial = cache_serial) < version->serial &&
+           !__sync_bool_compare_and_swap(&cache_serial, serial,
+                                         version->serial));
+
+    cache_evict(shard);
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to add the versions in a recency list to an array for
+  cache_list_current()
+*******************************************************************************/
+
+static void cache_list_add (
+    DLList *list,
+    cache_version **versions,
+    size_t *length)
+{
+    DLList_node *node;
+    cache_node_data *cache;
+
+    for (node = list->head; node; node = node->next) {
+        cache = node->data;
+
+        if (cache->current && (!cache->expired || cache->unchecked)) {
+            __sync_fetch_and_add(&cache->current->refs, 1);
+            versions[(*length)++] = cache->current;
+        }
+    }
+}
+
+/*****************************************************************************//**
+  structure for a cold cache found by cache_list_add_cold()
+*******************************************************************************/
+
+typedef struct {
+    int mapfile_id;
+    cache_packed *packed;
+} cache_list_cold;
+
+/*****************************************************************************//**
+  function to add the caches in the cold list to an array for
+  cache_list_current(), a slot is left in versions for each and filled in
+  by cache_list_unpack()
+*******************************************************************************/
+
+static size_t cache_list_add_cold (
+    DLList *list,
+    cache_version **versions,
+    size_t *length,
+    cache_list_cold *cold)
+{
+    DLList_node *node;
+    cache_node_data *cache;
+    size_t count = 0;
+
+    for (node = list->head; node; node = node->next) {
+        cache = node->data;
+
+        if (cache->packed && !cache->expired) {
+            cold[count].mapfile_id = cache->mapfile_id;
+            cold[count++].packed = cache->packed;
+            versions[(*length)++] = NULL;
+        }
+    }
+
+    return count;
+}
+
+/*****************************************************************************//**
+  function to decompress the cold caches cache_list_add_cold() found, in
+  the read section they were found in with the shard unlocked
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        a packed copy dropped when its cache was warmed or evicted is freed
+        with epoch_defer(), it is still good until the read section ends
+*******************************************************************************/
+
+static int cache_list_unpack (
+    cache_list_cold *cold,
+    size_t count,
+    cache_version **versions)
+{
+    size_t i;
+    int err = 0;
+
+    for (i = 0; i < count; i++) {
+        if (!(versions[i] = cache_unpack(cold[i].packed, cold[i].mapfile_id,
+                                         &err)))
+            return err;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to get the current versions of every cache for a snapshot
+
+ @param	versions    set to a malloc'ed array of the versions, each with a
+                    reference held
+ @param	length      set to the number of versions
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        expired versions are left out except restored ones not yet checked.
+        each shard is listed coldest first, so adopting them in order puts
+        them back in the same order. the cold tier is decompressed with the
+        shard unlocked and goes first
+*******************************************************************************/
+
+int cache_list_current (
+    cache_version ***versions,
+    size_t *length)
+{
+    cache_version **list = NULL;
+    cache_version **grown;
+    cache_list_cold *cold = NULL;
+    cache_list_cold *more;
+    size_t alloced = 0;
+    size_t cold_alloced = 0;
+    size_t count;
+    size_t ncold;
+    size_t start;
+    size_t i;
+    int res = 0;
+
+    *length = 0;
+
+    /***** the packed copies found are decompressed in this section *****/
+
+    epoch_enter();
+
+    for (i = 0; i < CACHE_SHARDS && !res; i++) {
+        pthread_mutex_lock(&CACHE[i].lock);
+
+        count = CACHE[i].cold.length + CACHE[i].lru.length +
+                CACHE[i].window.length;
+
+        if (*length + count > alloced) {
+            alloced = (*length + count) * 2;
+            if (!(grown = realloc(list, alloced * sizeof(cache_version *)))) {
+                pthread_mutex_unlock(&CACHE[i].lock);
+                res = -ENOMEM;
+                break;
+            }
+            list = grown;
+        }
+
+        if (CACHE[i].cold.length > cold_alloced) {
+            cold_alloced = CACHE[i].cold.length * 2;
+            if (!(more = realloc(cold,
+                                 cold_alloced * sizeof(cache_list_cold)))) {
+                pthread_mutex_unlock(&CACHE[i].lock);
+                res = -ENOMEM;
+                break;
+            }
+            cold = more;
+        }
+
+        /***** the window holds the newest caches, it goes last *****/
+
+        start = *length;
+        ncold = cache_list_add_cold(&CACHE[i].cold, list, length, cold);
+        cache_list_add(&CACHE[i].lru, list, length);
+        cache_list_add(&CACHE[i].window, list, length);
+
+        pthread_mutex_unlock(&CACHE[i].lock);
+
+        res = cache_list_unpack(cold, ncold, list + start);
+    }
+
+    epoch_exit();
+
+    free(cold);
+
+    if (res) {
+        while (*length) {
+            if (list[--(*length)])
+                cache_release(list[*length]);
+        }
+        free(list);
+        return res;
+    }
+
+    *versions = list;
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to get the counters of the cache
+
+ @param	stats   filled in with the counters
+
+ @return	nothing
+*******************************************************************************/
+
+void cache_get_stats (
+    cache_stats *stats)
+{
+    stats->hits = stats_counted(STATS_CACHE_HITS);
+    stats->misses = cache_counters.misses;
+    stats->expirations = cache_counters.expirations;
+    stats->loads = cache_counters.loads;
+    stats->coalesced = cache_counters.coalesced;
+    stats->evictions = cache_counters.evictions;
+    stats->stale = stats_counted(STATS_CACHE_STALE);
+    stats->negatives = stats_counted(STATS_CACHE_NEGATIVE);
+    stats->refreshes = cache_counters.refreshes;
+    stats->restored = cache_counters.restored;
+    stats->revalidated = cache_counters.revalidated;
+    stats->demotions = cache_counters.demotions;
+    stats->promotions = cache_counters.promotions;
+    stats->cold_hits = stats_counted(STATS_CACHE_COLD);
+    stats->cold_bytes = cache_counters.cold_bytes;
+    stats->timeouts = cache_counters.timeouts;
+    stats->dropped = cache_counters.dropped;
+    stats->ahead = cache_counters.ahead;
+    stats->ahead_used = cache_counters.ahead_used;
+    stats->bytes = cache_counters.bytes;
+}
+
+/*****************************************************************************//**
+  function to set the byte budget of the cache
+
+ @param	bytes   the budget, 0 for no limit
+
+ @return	nothing
+
+  note:
+        every byte alloced for a cached buffer plus the metadata is charged,
+        the coldest caches are evicted when the budget is exceeded, versions
+        pinned by an open file stay until they are released. it may be
+        changed while the cache is in use, a smaller budget evicts at once
+*******************************************************************************/
+
+void cache_set_budget (
+    size_t bytes)
+{
+    __atomic_store_n(&cache_budget, bytes, __ATOMIC_RELAXED);
+
+    cache_evict(NULL);
+}
+
+/*****************************************************************************//**
+  function to mark a cache as expired with its shard locked
+
+ @return	non zero if the cache was not expired before or is not cached
+*******************************************************************************/
+
+static int cache_expire_locked (
+    cache_shard *shard,
+    int mapfile_id)
+{
+    cache_node_data *cache;
+
+    /***** it may have been evicted while the kernel still has its size and
+           pages, they are only dropped if it is told *****/
+
+    if (!(cache = hash_find(shard->table, mapfile_id)))
+        return 1;
+
+    /***** a load that started before this may have read the old rows *****/
+
+    if (cache->flight)
+        __atomic_store_n(&cache->flight->outdated, 1, __ATOMIC_RELEASE);
+
+    /***** it may have been made since the db said it did not exist *****/
+
+    if (cache->missing) {
+        CACHE_STORE(cache->missing, 0);
+        return 1;
+    }
+
+    /***** a restored cache is already expired, now it is known to be out
+           of date it is no longer handed out while it is checked *****/
+
+    if (cache->expired && !cache->unchecked)
+        return 0;
+
+    cache_checked(cache);
+
+    CACHE_STORE(cache->expired_at, time(NULL));
+    CACHE_STORE(cache->expired, 1);
+    __sync_fetch_and_add(&cache_counters.expirations, 1);
+
+    /***** a version that may still be handed out keeps its metadata so
+           a stat agrees with what is read *****/
+
+    if (!cache_stale_ok(cache))
+        cache->attr.mtime = 0;
+
+    return 1;
+}
+
+/*****************************************************************************//**
+  function to mark a cache as expired
+
+ @param	mapfile_id  the id of the mapfile
+
+ @return	nothing
+
+  note:
+        the expire function is called for a mapfile that is not cached too,
+        the kernel may have kept it since it was evicted
+*******************************************************************************/
+
+void cache_expire (
+    int mapfile_id)
+{
+    cache_shard *shard = CACHE_SHARD(mapfile_id);
+    int first;
+
+    pthread_mutex_lock(&shard->lock);
+    first = cache_expire_locked(shard, mapfile_id);
+    pthread_mutex_unlock(&shard->lock);
+
+    /***** only tell on the first expire *****/
+
+    if (first && cache_expired)
+        cache_expired(mapfile_id);
+
+    if (first && cache_ahead_running)
+        cache_ahead(mapfile_id);
+}
+
+/*****************************************************************************//**
+  function called on the timer thread when the ttl of a cache runs out
+
+ @param	entry   the timer of the cache
+
+ @return	nothing
+
+  note:
+        a negative entry is dropped, and the cache with it if nothing else
+        is kept for the mapfile. a current version past its ttl is expired
+        as if the db had said it changed. a hot one is rendered again when
+        the timer goes off ahead of the ttl, or once it has expired. it runs
+        in the timer threads read section, nothing it calls may reach
+        epoch_defer(), what it unlinks goes to timer_defer()
+*******************************************************************************/
+
+static void cache_timer_fire (
+    timer_entry *entry)
+{
+    cache_node_data *cache = (cache_node_data *)
+                             ((char *)entry - offsetof(cache_node_data, timer));
+    int mapfile_id = cache->mapfile_id;
+    cache_shard *shard = CACHE_SHARD(mapfile_id);
+    cache_flight *flight = NULL;
+    int first = 0;
+
+    pthread_mutex_lock(&shard->lock);
+
+    /***** it may have been evicted, or given a later deadline, after the
+           timer took it off the wheel *****/
+
+    if (hash_find(shard->table, mapfile_id) != cache ||
+        time(NULL) < cache->timer.deadline) {
+        pthread_mutex_unlock(&shard->lock);
+        return;
+    }
+
+    if (cache->missing) {
+        CACHE_STORE(cache->missing, 0);
+        __sync_fetch_and_add(&cache_counters.dropped, 1);
+
+        /***** the unlink defers nothing, the cache is the one thing to
+               free and it is left to the timer thread *****/
+
+        if (!cache->current && !cache->packed && !cache->flight) {
+            cache_unlink(shard, cache);
+            timer_defer(cache_free, cache);
+        }
+    }
+    else if (cache_ttl && !cache->expired &&
+             (cache->current || cache->packed)) {
+
+        /***** ahead of the ttl, the timer is set again for the ttl *****/
+
+        if (time(NULL) < cache->due) {
+            flight = cache_ahead_locked(cache);
+            __atomic_store_n(&cache->heat, 0, __ATOMIC_RELAXED);
+            timer_add(&cache->timer, cache->due, cache_timer_fire);
+        }
+        else if ((first = cache_expire_locked(shard, mapfile_id))) {
+            __sync_fetch_and_add(&cache_counters.timeouts, 1);
+            flight = cache_ahead_locked(cache);
+        }
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+
+    if (flight)
+        cache_queue_refresh(flight, mapfile_id, 1);
+
+    if (first && cache_expired)
+        cache_expired(mapfile_id);
+}
+
+/*****************************************************************************//**
+  function to compare mapfile_ids by the shard they fall in for qsort
+*******************************************************************************/
+
+static int cache_shard_cmp (
+    const void *a,
+    const void *b)
+{
+    unsigned int sa = *(const int *)a & (CACHE_SHARDS - 1);
+    unsigned int sb = *(const int *)b & (CACHE_SHARDS - 1);
+
+    return (sa > sb) - (sa < sb);
+}
+
+/*****************************************************************************//**
+  function to mark many caches as expired
+
+ @param	ids     the ids of the mapfiles, the array is reordered
+ @param	length  the number of ids
+
+ @return	nothing
+
+  note:
+        the ids are grouped by shard so each shard is locked once for
+        the whole batch, and only long enough to flip the flags
+*******************************************************************************/
+
+void cache_expire_many (
+    int *ids,
+    size_t length)
+{
+    cache_shard *shard;
+    size_t i, j, first = 0;
+
+    qsort(ids, length, sizeof(int), cache_shard_cmp);
+
+    for (i = 0; i < length; i = j) {
+        shard = CACHE_SHARD(ids[i]);
+
+        pthread_mutex_lock(&shard->lock);
+
+        /***** the ids that expired for the first time move to the front *****/
+
+        for (j = i; j < length && CACHE_SHARD(ids[j]) == shard; j++) {
+            if (cache_expire_locked(shard, ids[j]))
+                ids[first++] = ids[j];
+        }
+
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    if (cache_expired) {
+        for (i = 0; i < first; i++)
+            cache_expired(ids[i]);
+    }
+
+    if (cache_ahead_running) {
+        for (i = 0; i < first; i++)
+            cache_ahead(ids[i]);
+    }
+}
+
+/*****************************************************************************//**
+  structure for a list of mapfile_ids
+*******************************************************************************/
+
+typedef struct {
+    int *ids;
+    size_t length;
+} cache_id_list;
+
+/*****************************************************************************//**
+  function to add a key of a shard to an id list for cache_expire_all()
+*******************************************************************************/
+
+static void *cache_collect (
+    hash_table *table,
+    int key,
+    void *data,
+    void *extra)
+{
+    cache_id_list *list = extra;
+
+    (void) table;
+    (void) data;
+
+    list->ids[list->length++] = key;
+
+    return NULL;
+}
+
+/*****************************************************************************//**
+  function to mark every cache as expired
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        for when changes may have been missed, such as after the connection
+        invalidations arrive on was lost
+*******************************************************************************/
+
+int cache_expire_all (void)
+{
+    cache_id_list list;
+    size_t i;
+    int res = 0;
+
+    for (i = 0; i < CACHE_SHARDS && !res; i++) {
+        pthread_mutex_lock(&CACHE[i].lock);
+
+        list.length = 0;
+        if ((list.ids = malloc((CACHE[i].table->length + 1) * sizeof(int))))
+            hash_iterate(CACHE[i].table, cache_collect, &list);
+        else
+            res = -ENOMEM;
+
+        pthread_mutex_unlock(&CACHE[i].lock);
+
+        if (list.ids)
+            cache_expire_many(list.ids, list.length);
+        free(list.ids);
+    }
+
+    return res;
+}
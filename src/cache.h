@@ -30,27 +30,327 @@
 #ifndef cache_h
 #define cache_h
 
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+/*****************************************************************************//**
+  structure for one rendered version of a mapfile
+
+ @param	mapfile_id  the id of the mapfile in the db
+ @param	refs        number of references held on the version, the cache holds
+                    one while it is current
+ @param	opened      non zero once the version has been opened, the first open
+                    of a new version tells the kernel to drop the old pages
+ @param	serial      number of the version, goes up each time it is rendered
+ @param	mtime       time the version was rendered
+ @param	size        length of the rendered mapfile
+ @param	buf         the rendered mapfile, or only the text between the
+                    fragments if gather is set
+ @param	gather      the rendered mapfile as a gather list of its own text and
+                    shared fragments, NULL if it is all in buf
+ @param	etag        hash of the rendered mapfile, 0 until cache_etag() is
+                    first called on the version
+ @param	snap        the snapshot buf points into, NULL if buf is alloced
+ @param	pooled      non zero if buf came from the pool of cold tier buffers,
+                    it goes back to the pool when the version is free'ed
+ @param	ahead       non zero while a version rendered ahead of its need has
+                    not been read
+
+  note:
+        a version never changes once it is published, open pins it in
+        fi->fh so reads need no lookup and no lock
+*******************************************************************************/
+
 typedef struct {
     int mapfile_id;
-    unsigned int expired;
+    unsigned int refs;
+    unsigned int opened;
+    unsigned long serial;
+    time_t mtime;
+    size_t size;
     buffer *buf;
+    struct frag_list *gather;
+    uint64_t etag;
+    struct snap_file *snap;
+    unsigned int pooled;
+    unsigned int ahead;
+} cache_version;
+
+/*****************************************************************************//**
+  structure for a rendered mapfile kept compressed in the cold tier
+
+ @param	size    length of the rendered mapfile
+ @param	length  number of compressed bytes in data
+ @param	serial  number of the version it was compressed from
+ @param	mtime   time the version was rendered
+ @param	etag    cache_etag() of the version
+ @param	data    the compressed mapfile
+
+  note:
+        a get decompresses it into a version of its own with a buffer from
+        a pool, the version is only cached again if the mapfile is asked
+        for often enough
+*******************************************************************************/
+
+typedef struct {
+    size_t size;
+    size_t length;
+    unsigned long serial;
+    time_t mtime;
+    uint64_t etag;
+    char data[];
+} cache_packed;
+
+/*****************************************************************************//**
+  structure for the metadata of a cached mapfile
+
+ @param	size    length of the rendered mapfile
+ @param	serial  number of the version the size is from, 0 if only sized
+ @param	mtime   time the mapfile was rendered or sized, 0 if not known
+ @param	current non zero if it is the metadata of a version that has not
+                expired, set by cache_getattr(). a stale version or a size
+                only pass may be replaced without the kernel being told
+*******************************************************************************/
+
+typedef struct {
+    size_t size;
+    unsigned long serial;
+    time_t mtime;
+    unsigned int current;
+} cache_attr;
+
+/*****************************************************************************//**
+  structure for a load of a mapfile in flight, everyone who misses while the
+  first one is rendering waits on it instead of reading the db again
+
+ @param	lock        lock for the rest of the members
+ @param	done        signaled when the load is finished
+ @param	refs        number of threads holding the flight, the loader is one
+ @param	finished    non zero once the load is finished
+ @param	err         the negative errno of the load if it failed
+ @param	version     the version that was loaded with a reference held
+ @param	outdated    non zero if the mapfile was expired while the load was in
+                    flight, set under the shard lock
+*******************************************************************************/
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    unsigned int refs;
+    int finished;
+    int err;
+    cache_version *version;
+    unsigned int outdated;
+} cache_flight;
+
+/*****************************************************************************//**
+  structure for the counters of the cache
+
+ @param	hits        number of gets answered with a current version
+ @param	misses      number of gets that read the db or waited for a read
+ @param	expirations number of caches expired
+ @param	loads       number of times a mapfile was read from the db
+ @param	coalesced   number of misses that waited on a load already in flight
+                    instead of reading the db again
+ @param	evictions   number of caches evicted to stay in the budget
+ @param	stale       number of times an expired version was handed out while
+                    its refresh ran in the background
+ @param	refreshes   number of refreshes run in the background
+ @param	negatives   number of gets and getattrs answered from a negative entry
+ @param	restored    number of versions restored from a snapshot
+ @param	revalidated number of restored versions the db rendered the same, they
+                    were kept
+ @param	demotions   number of versions compressed into the cold tier
+ @param	promotions  number of mapfiles taken out of the cold tier because they
+                    were asked for again
+ @param	cold_hits   number of gets answered by decompressing from the cold
+                    tier
+ @param	cold_bytes  bytes of the budget charged to the cold tier
+ @param	timeouts    number of caches expired because their ttl ran out
+ @param	dropped     number of negative entries dropped when their ttl ran out
+ @param	ahead       number of hot mapfiles rendered again before they were
+                    asked for, ahead of their ttl or right after an expire
+ @param	ahead_used  number of those renders that were read before they were
+                    replaced or evicted
+ @param	bytes       bytes charged to the budget
+*******************************************************************************/
+
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long expirations;
+    unsigned long loads;
+    unsigned long coalesced;
+    unsigned long evictions;
+    unsigned long stale;
+    unsigned long refreshes;
+    unsigned long negatives;
+    unsigned long restored;
+    unsigned long revalidated;
+    unsigned long demotions;
+    unsigned long promotions;
+    unsigned long cold_hits;
+    size_t cold_bytes;
+    unsigned long timeouts;
+    unsigned long dropped;
+    unsigned long ahead;
+    unsigned long ahead_used;
+    size_t bytes;
+} cache_stats;
+
+/*****************************************************************************//**
+  structure for a cached mapfile
+
+ @param	mapfile_id  the id of the mapfile in the db
+ @param	expired     non zero if the db has changed since the mapfile was read
+ @param	expired_at  when the cache first expired since the last render
+ @param	current     the current version of the mapfile, NULL if only sized
+ @param	attr        metadata of the last render or sizing pass, getattr is
+                    answered from this without rendering
+ @param	flight      the load in flight, NULL if none
+ @param	lru         the node of the cache in its shards recency list
+ @param	inmain      non zero if lru is in the main list, 0 if in the window
+ @param	bytes       bytes charged to the budget for the cache and its current
+                    version
+ @param	touched     hits since eviction last looked at the cache, counted
+                    with no lock up to SKETCH_MAX
+ @param	missing     when the db last said the mapfile does not exist, 0 if it
+                    has not since it was last read or expired
+ @param	unchecked   non zero while current was restored from a snapshot and
+                    has not been checked against the db, it is handed out as
+                    if stale and the first get queues the check
+ @param	packed      the mapfile compressed in the cold tier, NULL if it is
+                    not, current is NULL while it is set
+ @param	incold      non zero if lru is in the cold list
+ @param	timer       when the ttl of the current version or of the negative
+                    entry runs out, or when a hot one is refreshed ahead of
+                    it, pending only while one is set
+ @param	due         when the ttl of the current version runs out, 0 if it has
+                    none
+ @param	heat        gets since the cache was last refreshed ahead or looked
+                    at for it, counted with no lock up to the hot threshold
+
+  note:
+        a refresh renders a new version with no lock held and then only swaps
+        the current pointer, the old version is free'ed when its last
+        reference is released. expired, expired_at, current, flight,
+        missing, unchecked and packed are read with no lock by the fast
+        path, the rest only under the shard lock
+*******************************************************************************/
+
+typedef struct {
+    int mapfile_id;
+    unsigned int expired;
+    time_t expired_at;
+    cache_version *current;
+    cache_attr attr;
+    cache_flight *flight;
+    DLList_node *lru;
+    unsigned int inmain;
+    size_t bytes;
+    unsigned int touched;
+    time_t missing;
+    unsigned int unchecked;
+    cache_packed *packed;
+    unsigned int incold;
+    timer_entry timer;
+    time_t due;
+    unsigned int heat;
 } cache_node_data;
 
 /*****************************************************************************//**
-  function to compare cache data
-  
- @param	cache1  the first cache pointer to be compared
- @param	cache2   the second cache pointer to be compared
-  
- @return	less than 0 if cache1 is less than cache2
- @return	0 if cache1 is equal to cache2
- @return	greater than 0 if cache1 is greater than cache2
-        
+  structure for a shard of the cache
+
+ @param	lock        lock for the writers of the shard, readers take none
+ @param	table       hash table of the caches in the shard keyed by mapfile_id,
+                    writers change it in place and readers with no lock
+                    look again if they race a change, it is only replaced
+                    by a copy when it grows
+ @param	lru         main recency list of the caches in the shard, coldest at
+                    the head
+ @param	window      recency list new caches go in under the tinylfu policy,
+                    empty under lru
+ @param	freq        how often each mapfile in the shard has been asked for,
+                    only kept under the tinylfu policy
+ @param	cold        recency list of the caches in the cold tier, coldest at
+                    the head
+
+  note:
+        a hit takes no lock, it finds the cache in an epoch read section and
+        only bumps the touched count, so hits do not contend at all. the
+        recency lists are fixed up when eviction looks at them, a touched
+        cache gets a second chance at the tail. a cache that is unlinked, or
+        a table that is replaced, is freed with epoch_defer(). the lists own
+        the caches
+*******************************************************************************/
+
+typedef struct {
+    pthread_mutex_t lock;
+    hash_table *table;
+    DLList lru;
+    DLList window;
+    sketch freq;
+    DLList cold;
+} cache_shard;
+
+/*****************************************************************************//**
+  eviction policies
+
+  CACHE_POLICY_LRU      evict the least recently used cache
+  CACHE_POLICY_TINYLFU  new caches go in a small window, when one falls out of
+                        the window it only takes the place of the coldest main
+                        cache if it has been asked for more often, so a sweep
+                        that touches every mapfile once can not flush the hot
+                        ones
+*******************************************************************************/
+
+typedef enum {
+    CACHE_POLICY_LRU,
+    CACHE_POLICY_TINYLFU
+} cache_policy;
+
+/***** a mapfile in the cold tier goes back to the hot tier when it is asked
+       for this many times before eviction next looks at it *****/
+
+#define CACHE_COLD_PROMOTE 2
+
+/***** most idle buffers kept in the pool for decompressing into *****/
+
+#define CACHE_POOL_MAX 16
+
+/***** number of shards, must be a power of 2 *****/
+
+#define CACHE_SHARDS 64
+
+/*****************************************************************************//**
+  type of function to pass to cache_init to render a mapfile from the db
+
+ @param	mapfile_id  the id of the mapfile to render
+ @param	buf         the buffer to render the mapfile into
+
+ @return	0 on success
+ @return	a negative errno on failure
 *******************************************************************************/
 
-int (BSTree_data_cmp_func)cache_cmp (
-    cache_node_data* cache1,
-    cache_node_data* cache2);
+typedef int (*cache_load_func) (
+    int mapfile_id,
+    buffer *buf);
+
+/*****************************************************************************//**
+  type of function to pass to cache_init to be told a cache has expired
+
+ @param	mapfile_id  the id of the mapfile that expired
+
+ @return	nothing
+
+  note:
+        this is called with no lock held, it is meant for telling the kernel
+        to drop what it has cached for the mapfile
+*******************************************************************************/
+
+typedef void (*cache_expire_func) (
+    int mapfile_id);
 
 /*****************************************************************************//**
   function to delete a cache
@@ -61,7 +361,376 @@ int (BSTree_data_cmp_func)cache_cmp (
 
 *******************************************************************************/
 
-void  (BSTree_data_free_func)cache_free (
-    cache_node_data* cache);
+void cache_free (
+    void *cache);
+
+/*****************************************************************************//**
+  function to setup the cache
+
+ @param	load    function to render a mapfile from the db
+ @param	expire  function to call when a cache expires, may be NULL
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+int cache_init (
+    cache_load_func load,
+    cache_expire_func expire);
+
+/*****************************************************************************//**
+  function to set the byte budget of the cache
+
+ @param	bytes   the budget, 0 for no limit
+
+ @return	nothing
+
+  note:
+        every byte alloced for a cached buffer plus the metadata is charged,
+        the coldest caches are evicted when the budget is exceeded, versions
+        pinned by an open file stay until they are released. it may be
+        changed while the cache is in use, a smaller budget evicts at once
+*******************************************************************************/
+
+void cache_set_budget (
+    size_t bytes);
+
+/*****************************************************************************//**
+  function to set the eviction policy of the cache
+
+ @param	policy  the policy
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        must be called after cache_init() and before the cache is used
+*******************************************************************************/
+
+int cache_set_policy (
+    cache_policy policy);
+
+/*****************************************************************************//**
+  function to serve expired mapfiles while they are refreshed in the background
+
+ @param	max_stale   seconds an expired version may still be handed out, 0 to
+                    always wait for the db
+ @param	nthreads    number of threads to refresh on
+
+ @return	nothing
+
+  note:
+        must be called after cache_init() and before cache_start(). an open
+        of a mapfile expired longer than max_stale waits for the refresh
+*******************************************************************************/
+
+void cache_set_stale (
+    time_t max_stale,
+    int nthreads);
+
+/*****************************************************************************//**
+  function to keep cold mapfiles compressed instead of evicting them
+
+ @param	share   percent of the budget the cold tier may use, 0 for no cold
+                tier
+
+ @return	0 on success
+ @return	-ENOTSUP if not built with HAVE_LZ4
+ @return	-EINVAL if the share is over 100
+
+  note:
+        the coldest mapfile is compressed with lz4 when the cache is over
+        its budget, once the cold tier is over its share the coldest
+        compressed one is evicted. rendered mapfiles are repetitive text
+        and compress several times over, so many more fit in the budget.
+        the hot tier is read with no copy, a get from the cold tier
+        decompresses
+*******************************************************************************/
+
+int cache_set_cold (
+    unsigned int share);
+
+/*****************************************************************************//**
+  function to remember mapfiles the db says do not exist
+
+ @param	ttl     seconds a negative entry is kept, 0 to ask the db every time
+
+ @return	nothing
+
+  note:
+        an expire of the mapfile drops its negative entry at once
+*******************************************************************************/
+
+void cache_set_negative (
+    time_t ttl);
+
+/*****************************************************************************//**
+  function to expire rendered mapfiles after a time even if the db never
+  says they changed
+
+ @param	ttl     seconds a render is trusted, 0 to trust it till an expire
+
+ @return	nothing
+
+  note:
+        a safety net for changes no notification was sent for. the deadline
+        of each cache is kept in the timer wheel so nothing scans the caches
+        for the ones that ran out, call it before cache_start()
+*******************************************************************************/
+
+void cache_set_ttl (
+    time_t ttl);
+
+/*****************************************************************************//**
+  function to render hot mapfiles again before they are asked for
+
+ @param	ahead       seconds before the ttl runs out a hot mapfile is rendered
+                    again, 0 to only render it again once it has expired
+ @param	hits        gets since it was last refreshed ahead for a mapfile to
+                    count as hot, 0 for no refresh ahead
+ @param	nthreads    number of threads to render on
+
+ @return	nothing
+
+  note:
+        must be called after cache_init() and before cache_start(). a hot
+        mapfile is rendered again on a pool of its own when its ttl is
+        about to run out and as soon as the db says it changed, so its
+        next get is a hit. cold ones are left to expire. the renders are
+        speculative, cache_get_stats() tells how many were read
+*******************************************************************************/
+
+void cache_set_ahead (
+    time_t ahead,
+    unsigned int hits,
+    int nthreads);
+
+/*****************************************************************************//**
+  function to get how long a negative entry is kept
+
+ @return	the ttl in seconds, 0 if negative entries are off
+*******************************************************************************/
+
+time_t cache_get_negative (void);
+
+/*****************************************************************************//**
+  function to start the background threads of the cache
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        threads do not survive a fork so this is called once the filesystem
+        has daemonized, if it fails expired mapfiles are read in the
+        foreground as if cache_set_stale() was never called. the threads are
+        started with no max staleness too if versions were restored with
+        cache_adopt(), they check them against the db. the timer thread is
+        only started if there is a ttl to keep
+*******************************************************************************/
+
+int cache_start (void);
+
+/*****************************************************************************//**
+  function to free all the caches
+
+ @return	nothing
+*******************************************************************************/
+
+void cache_destroy (void);
+
+/*****************************************************************************//**
+  function to get the current version of a mapfile, reading a new one from the
+  db if not found or expired
+
+ @param	mapfile_id  the id of the mapfile
+ @param	err         set to a negative errno on failure
+
+ @return	the version with a reference held, release it with cache_release()
+ @return	NULL on failure
+
+  note:
+        a hit takes no lock, the only shared write is the reference taken on
+        the version. a miss locks only the shard the mapfile_id falls in, and
+        only while the table is changed, the db is read without any lock held.
+        only the first miss reads the db, misses while it is in flight wait
+        for its result. an expired version is returned as is within the max
+        staleness set with cache_set_stale(), the first such get queues the
+        refresh. a mapfile in the cold tier is decompressed into a version
+        that is not cached unless it is asked for again
+*******************************************************************************/
+
+cache_version *cache_get (
+    int mapfile_id,
+    int *err);
+
+/*****************************************************************************//**
+  function to get the metadata of a mapfile without rendering it
+
+ @param	mapfile_id  the id of the mapfile
+ @param	attr        filled in with the metadata
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        if the mapfile has not been rendered since it was read or expired a
+        size only pass of the load function is done, nothing is stored but
+        the length. when expired versions are served the metadata stays that
+        of the version cache_get() hands out
+        attr->current tells if it may be trusted until the mapfile expires
+*******************************************************************************/
+
+int cache_getattr (
+    int mapfile_id,
+    cache_attr *attr);
+
+/*****************************************************************************//**
+  function to render a new version of a mapfile and publish it
+
+ @param	mapfile_id  the id of the mapfile
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        readers keep getting the current version while the new one renders.
+        the expire function is called for the version it replaces, so it
+        must not be called on the request path
+*******************************************************************************/
+
+int cache_refresh (
+    int mapfile_id);
+
+/*****************************************************************************//**
+  function to release a reference on a version
+
+ @param	version the version returned from cache_get()
+
+ @return	nothing
+*******************************************************************************/
+
+void cache_release (
+    cache_version *version);
+
+/*****************************************************************************//**
+  function to check if the kernel may keep its cached pages of a mapfile
+
+ @param	version the version being opened
+
+ @return	0 on the first open of a version
+ @return	non zero if the pages the kernel has are of this version
+*******************************************************************************/
+
+int cache_keep (
+    cache_version *version);
+
+/*****************************************************************************//**
+  function to get the hash of a rendered mapfile
+
+ @param	version the version
+
+ @return	the hash, the same for every version rendered the same
+*******************************************************************************/
+
+uint64_t cache_etag (
+    cache_version *version);
+
+/*****************************************************************************//**
+  function to put a version restored from a snapshot in the cache
+
+ @param	version the version with one reference held, it is given to the
+                cache even on failure
+
+ @return	0 on success
+ @return	-EEXIST if the mapfile is already cached
+ @return	a negative errno on failure
+
+  note:
+        the version is handed out at once but it is not trusted, the first
+        get queues a render and if the db renders the same bytes the
+        restored version is kept, otherwise it is replaced. call it before
+        cache_start(). versions are put in the recency lists in the order
+        they are adopted, coldest first
+*******************************************************************************/
+
+int cache_adopt (
+    cache_version *version);
+
+/*****************************************************************************//**
+  function to get the current versions of every cache for a snapshot
+
+ @param	versions    set to a malloc'ed array of the versions, each with a
+                    reference held
+ @param	length      set to the number of versions
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        expired versions are left out except restored ones not yet checked.
+        each shard is listed coldest first, so adopting them in order puts
+        them back in the same order. the cold tier is decompressed with the
+        shard unlocked and goes first
+*******************************************************************************/
+
+int cache_list_current (
+    cache_version ***versions,
+    size_t *length);
+
+/*****************************************************************************//**
+  function to get the counters of the cache
+
+ @param	stats   filled in with the counters
+
+ @return	nothing
+*******************************************************************************/
+
+void cache_get_stats (
+    cache_stats *stats);
+
+/*****************************************************************************//**
+  function to mark a cache as expired
+
+ @param	mapfile_id  the id of the mapfile
+
+ @return	nothing
+
+  note:
+        the expire function is called for a mapfile that is not cached too,
+        the kernel may have kept it since it was evicted
+*******************************************************************************/
+
+void cache_expire (
+    int mapfile_id);
+
+/*****************************************************************************//**
+  function to mark many caches as expired
+
+ @param	ids     the ids of the mapfiles, the array is reordered
+ @param	length  the number of ids
+
+ @return	nothing
+
+  note:
+        the ids are grouped by shard so each shard is locked once for
+        the whole batch, and only long enough to flip the flags
+*******************************************************************************/
+
+void cache_expire_many (
+    int *ids,
+    size_t length);
+
+/*****************************************************************************//**
+  function to mark every cache as expired
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        for when changes may have been missed, such as after the connection
+        invalidations arrive on was lost
+*******************************************************************************/
+
+int cache_expire_all (void);
 
 #endif
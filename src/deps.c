@@ -0,0 +1,635 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "hash.h"
+#include "DLList.h"
+#include "timer.h"
+#include "sketch.h"
+#include "buffer.h"
+#include "frag.h"
+#include "cache.h"
+#include "deps.h"
+
+static pthread_mutex_t deps_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/***** for each kind of row, the set of mapfile_ids rendered from each row,
+       keyed by row_id *****/
+
+static hash_table deps_rows[DEPS_TABLES];
+
+/***** the rows of the last render of each mapfile, keyed by mapfile_id *****/
+
+static hash_table deps_current;
+
+/***** the renders in progress, two renders of the same mapfile each have
+       their own *****/
+
+static DLList deps_pending;
+static unsigned long deps_serial;
+
+/*****************************************************************************//**
+  structure for a render being recorded
+
+ @param	mapfile_id  the id of the mapfile being rendered
+ @param	used        the rows it has read so far
+ @param	node        its node in deps_pending
+*******************************************************************************/
+
+struct deps_render {
+    int mapfile_id;
+    deps_used *used;
+    DLList_node *node;
+};
+
+/***** what a set holds for each key, a set only needs the keys *****/
+
+static char deps_mark;
+
+static const char *deps_names[DEPS_TABLES] = {
+    "layer",
+    "class",
+    "symbol",
+    "legend",
+    "scalebar",
+    "web"
+};
+
+/*****************************************************************************//**
+  function to free the rows a render read
+*******************************************************************************/
+
+static void deps_used_free (
+    void *data)
+{
+    deps_used *used = data;
+
+    free(used->refs);
+    free(used);
+}
+
+/*****************************************************************************//**
+  function to free the set of mapfiles rendered from a row
+*******************************************************************************/
+
+static void deps_set_free (
+    void *data)
+{
+    hash_table *set = data;
+
+    hash_delete_all(set);
+    free(set);
+}
+
+/*****************************************************************************//**
+  function to setup the dependency index
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+int deps_init (void)
+{
+    int i;
+
+    for (i = 0; i < DEPS_TABLES; i++) {
+        memset(&deps_rows[i], 0, sizeof(hash_table));
+        deps_rows[i].free = deps_set_free;
+    }
+
+    memset(&deps_current, 0, sizeof(hash_table));
+    deps_current.free = deps_used_free;
+    memset(&deps_pending, 0, sizeof(DLList));
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to free the dependency index
+
+ @return	nothing
+*******************************************************************************/
+
+void deps_destroy (void)
+{
+    int i;
+
+    pthread_mutex_lock(&deps_lock);
+
+    for (i = 0; i < DEPS_TABLES; i++)
+        hash_delete_all(&deps_rows[i]);
+
+    hash_delete_all(&deps_current);
+
+    /***** the renders still running free their own *****/
+
+    while (deps_pending.head)
+        ((deps_render *) DLList_delete(&deps_pending,
+                                       deps_pending.head))->node = NULL;
+
+    pthread_mutex_unlock(&deps_lock);
+}
+
+/*****************************************************************************//**
+  function to start recording the rows a render of a mapfile reads
+
+ @param	mapfile_id  the id of the mapfile about to be rendered
+
+ @return	the render to pass to deps_use and deps_end
+ @return	NULL if malloc fails
+*******************************************************************************/
+
+deps_render *deps_begin (
+    int mapfile_id)
+{
+    deps_render *render;
+
+    if (!(render = calloc(1, sizeof(deps_render))))
+        return NULL;
+
+    if (!(render->used = calloc(1, sizeof(deps_used)))) {
+        free(render);
+        return NULL;
+    }
+
+    render->mapfile_id = mapfile_id;
+
+    pthread_mutex_lock(&deps_lock);
+
+    render->used->serial = ++deps_serial;
+
+    if (!(render->node = DLList_append(&deps_pending, render))) {
+        pthread_mutex_unlock(&deps_lock);
+        deps_used_free(render->used);
+        free(render);
+        return NULL;
+    }
+
+    pthread_mutex_unlock(&deps_lock);
+
+    return render;
+}
+
+/*****************************************************************************//**
+  function to record that a mapfile being rendered read a row
+
+ @param	render      the render from deps_begin, if NULL nothing is recorded
+ @param	table       the kind of row
+ @param	row_id      the primary key of the row
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        called from the render for each layer, class, symbol, legend, scalebar
+        and web row it reads, a row read more than once is kept once
+*******************************************************************************/
+
+int deps_use (
+    deps_render *render,
+    deps_table table,
+    int row_id)
+{
+    deps_used *used;
+    deps_ref *refs;
+    size_t alloced;
+
+    if (!render)
+        return 0;
+
+    used = render->used;
+
+    /***** the lock is held so deps_find sees the rows of renders in
+           progress *****/
+
+    pthread_mutex_lock(&deps_lock);
+
+    if (used->length == used->alloced) {
+        alloced = used->alloced ? used->alloced * 2 : 16;
+        if (!(refs = realloc(used->refs, alloced * sizeof(deps_ref)))) {
+            pthread_mutex_unlock(&deps_lock);
+            return -ENOMEM;
+        }
+        used->refs = refs;
+        used->alloced = alloced;
+    }
+
+    used->refs[used->length].table = table;
+    used->refs[used->length].row_id = row_id;
+    used->length++;
+
+    pthread_mutex_unlock(&deps_lock);
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to compare rows for qsort
+*******************************************************************************/
+
+static int deps_ref_cmp (
+    const void *a,
+    const void *b)
+{
+    const deps_ref *r1 = a;
+    const deps_ref *r2 = b;
+
+    if (r1->table != r2->table)
+        return (r1->table > r2->table) - (r1->table < r2->table);
+
+    return (r1->row_id > r2->row_id) - (r1->row_id < r2->row_id);
+}
+
+/*****************************************************************************//**
+  function to add or remove a mapfile from the sets of the rows it was
+  rendered from, the index must be locked
+
+ @return	0 on success
+ @return	-1 if malloc fails
+*******************************************************************************/
+
+static int deps_link (
+    deps_used *used,
+    int mapfile_id,
+    int add)
+{
+    hash_table *rows;
+    hash_table *set;
+    size_t i;
+
+    for (i = 0; i < used->length; i++) {
+        rows = &deps_rows[used->refs[i].table];
+        set = hash_find(rows, used->refs[i].row_id);
+
+        if (!add) {
+            if (!set || !hash_delete(set, mapfile_id) || set->length)
+                continue;
+
+            hash_delete(rows, used->refs[i].row_id);
+            deps_set_free(set);
+            continue;
+        }
+
+        if (!set) {
+            if (!(set = calloc(1, sizeof(hash_table))))
+                return -1;
+
+            if (hash_insert(rows, used->refs[i].row_id, set)) {
+                free(set);
+                return -1;
+            }
+        }
+
+        if (!hash_find(set, mapfile_id) &&
+            hash_insert(set, mapfile_id, &deps_mark))
+            return -1;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to finish recording the rows a render of a mapfile read
+
+ @param	render      the render from deps_begin, it is free'ed
+ @param	err         the result of the render, the rows it recorded replace
+                    those of the last render only if it is 0
+
+ @return	nothing
+
+  note:
+        the rows of a render never replace those of one that began after it
+*******************************************************************************/
+
+void deps_end (
+    deps_render *render,
+    int err)
+{
+    int mapfile_id;
+    deps_used *used;
+    deps_used *old;
+    size_t i, j;
+
+    if (!render)
+        return;
+
+    mapfile_id = render->mapfile_id;
+    used = render->used;
+
+    pthread_mutex_lock(&deps_lock);
+
+    /***** node is NULL if deps_destroy() already took it off *****/
+
+    if (!render->node)
+        err = -ESHUTDOWN;
+    else
+        DLList_delete(&deps_pending, render->node);
+
+    free(render);
+
+    if (err) {
+        pthread_mutex_unlock(&deps_lock);
+        deps_used_free(used);
+        return;
+    }
+
+    /***** sort and drop the rows read more than once *****/
+
+    qsort(used->refs, used->length, sizeof(deps_ref), deps_ref_cmp);
+
+    for (i = j = 0; i < used->length; i++) {
+        if (!j || deps_ref_cmp(&used->refs[j - 1], &used->refs[i]))
+            used->refs[j++] = used->refs[i];
+    }
+    used->length = j;
+
+    /***** most renders read the same rows as the last one *****/
+
+    old = hash_find(&deps_current, mapfile_id);
+
+    /***** a render that began later already ended, its rows are newer *****/
+
+    if (old && old->serial > used->serial) {
+        pthread_mutex_unlock(&deps_lock);
+        deps_used_free(used);
+        return;
+    }
+
+    if (old && old->length == used->length &&
+        !memcmp(old->refs, used->refs, used->length * sizeof(deps_ref))) {
+        old->serial = used->serial;
+        pthread_mutex_unlock(&deps_lock);
+        deps_used_free(used);
+        return;
+    }
+
+    if (old) {
+        hash_delete(&deps_current, mapfile_id);
+        deps_link(old, mapfile_id, 0);
+        deps_used_free(old);
+    }
+
+    /***** if it can not all be linked forget the render, the mapfile is then
+           only expired by its own id until it is rendered again *****/
+
+    if (deps_link(used, mapfile_id, 1) ||
+        hash_insert(&deps_current, mapfile_id, used)) {
+        deps_link(used, mapfile_id, 0);
+        deps_used_free(used);
+    }
+
+    pthread_mutex_unlock(&deps_lock);
+}
+
+/*****************************************************************************//**
+  structure to pass a deps_find_func through hash_iterate
+*******************************************************************************/
+
+typedef struct {
+    deps_find_func func;
+    void *extra;
+} deps_find_data;
+
+/*****************************************************************************//**
+  function to pass a key of a set on to a deps_find_func
+*******************************************************************************/
+
+static void *deps_find_one (
+    hash_table *table,
+    int key,
+    void *data,
+    void *extra)
+{
+    deps_find_data *find = extra;
+
+    (void) table;
+    (void) data;
+
+    find->func(find->extra, key);
+
+    return NULL;
+}
+
+/*****************************************************************************//**
+  function to find the renders in progress that have read a row, the index
+  must be locked
+
+ @param	table   the kind of row
+ @param	row_id  the primary key of the row
+ @param	set     the set of the row, its mapfiles are skipped, may be NULL
+ @param	func    function to pass each mapfile_id to, NULL to only count
+ @param	extra   extra pointer to pass to func
+
+ @return	the number of renders found
+*******************************************************************************/
+
+static size_t deps_find_pending (
+    deps_table table,
+    int row_id,
+    hash_table *set,
+    deps_find_func func,
+    void *extra)
+{
+    DLList_node *node;
+    deps_render *render;
+    size_t length = 0;
+    size_t i;
+
+    for (node = deps_pending.head; node; node = node->next) {
+        render = node->data;
+
+        if (set && hash_find(set, render->mapfile_id))
+            continue;
+
+        /***** not sorted until the render ends *****/
+
+        for (i = 0; i < render->used->length; i++) {
+            if (render->used->refs[i].table == (int) table &&
+                render->used->refs[i].row_id == row_id)
+                break;
+        }
+
+        if (i == render->used->length)
+            continue;
+
+        length++;
+        if (func)
+            func(extra, render->mapfile_id);
+    }
+
+    return length;
+}
+
+/*****************************************************************************//**
+  function to find the mapfiles rendered from a row
+
+ @param	table   the kind of row
+ @param	row_id  the primary key of the row
+ @param	func    function to pass each mapfile_id to, NULL to only count
+ @param	extra   extra pointer to pass to func
+
+ @return	the number of mapfiles found
+
+  note:
+        a mapfile being rendered that has read the row so far is found too
+*******************************************************************************/
+
+size_t deps_find (
+    deps_table table,
+    int row_id,
+    deps_find_func func,
+    void *extra)
+{
+    deps_find_data find = { func, extra };
+    hash_table *set;
+    size_t length = 0;
+
+    if ((unsigned int) table >= DEPS_TABLES)
+        return 0;
+
+    pthread_mutex_lock(&deps_lock);
+
+    if ((set = hash_find(&deps_rows[table], row_id))) {
+        length = set->length;
+        if (func)
+            hash_iterate(set, deps_find_one, &find);
+    }
+
+    length += deps_find_pending(table, row_id, set, func, extra);
+
+    pthread_mutex_unlock(&deps_lock);
+
+    return length;
+}
+
+/*****************************************************************************//**
+  function to add a mapfile_id to a list for deps_expire
+*******************************************************************************/
+
+static void deps_collect (
+    void *extra,
+    int mapfile_id)
+{
+    int **ids = extra;
+
+    *(*ids)++ = mapfile_id;
+}
+
+/*****************************************************************************//**
+  function to expire the cache of every mapfile rendered from a row
+
+ @param	table   the kind of row
+ @param	row_id  the primary key of the row
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        a mapfile being rendered that has read the row so far is expired too,
+        its load is marked outdated so the version it publishes is expired
+*******************************************************************************/
+
+int deps_expire (
+    deps_table table,
+    int row_id)
+{
+    deps_find_data find = { deps_collect, NULL };
+    hash_table *set;
+    int *ids = NULL;
+    int *end;
+    size_t length;
+
+    if ((unsigned int) table >= DEPS_TABLES)
+        return -EINVAL;
+
+    /***** before the renders are found, a render that starts after the
+           find must not get the old fragment *****/
+
+    frag_expire(table, row_id);
+
+    /***** copy the ids out, the cache is not expired with the index locked *****/
+
+    pthread_mutex_lock(&deps_lock);
+
+    set = hash_find(&deps_rows[table], row_id);
+    length = (set ? set->length : 0) +
+             deps_find_pending(table, row_id, set, NULL, NULL);
+
+    if (length && (ids = malloc(length * sizeof(int)))) {
+        end = ids;
+        if (set) {
+            find.extra = &end;
+            hash_iterate(set, deps_find_one, &find);
+        }
+        deps_find_pending(table, row_id, set, deps_collect, &end);
+    }
+
+    pthread_mutex_unlock(&deps_lock);
+
+    if (length && !ids)
+        return -ENOMEM;
+
+    if (ids) {
+        cache_expire_many(ids, length);
+        free(ids);
+    }
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to get the kind of row from its table name
+
+ @param	name    the name, it need not be nul terminated
+ @param	length  number of chars in name
+
+ @return	the kind of row
+ @return	-1 if the name is not known
+*******************************************************************************/
+
+int deps_table_id (
+    const char *name,
+    size_t length)
+{
+    int i;
+
+    for (i = 0; i < DEPS_TABLES; i++) {
+        if (strlen(deps_names[i]) == length &&
+            !strncmp(deps_names[i], name, length))
+            return i;
+    }
+
+    return -1;
+}
+
@@ -0,0 +1,223 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef deps_h
+#define deps_h
+
+/*****************************************************************************//**
+  the kinds of db rows a mapfile is rendered from, other than its own
+
+  DEPS_LAYER    a row of the layer table
+  DEPS_CLASS    a row of the class table
+  DEPS_SYMBOL   a row of the symbol table
+  DEPS_LEGEND   a row of the legend table
+  DEPS_SCALEBAR a row of the scalebar table
+  DEPS_WEB      a row of the web table
+*******************************************************************************/
+
+typedef enum {
+    DEPS_LAYER,
+    DEPS_CLASS,
+    DEPS_SYMBOL,
+    DEPS_LEGEND,
+    DEPS_SCALEBAR,
+    DEPS_WEB,
+    DEPS_TABLES
+} deps_table;
+
+/*****************************************************************************//**
+  structure for a row a mapfile was rendered from
+
+ @param	table   the kind of row
+ @param	row_id  the primary key of the row
+*******************************************************************************/
+
+typedef struct {
+    int table;
+    int row_id;
+} deps_ref;
+
+/*****************************************************************************//**
+  structure for the rows a mapfile was rendered from
+
+ @param	length  number of rows
+ @param	alloced number of rows refs has room for
+ @param	refs    the rows, sorted once the render is done
+ @param	serial  the order the render began in
+*******************************************************************************/
+
+typedef struct {
+    size_t length;
+    size_t alloced;
+    deps_ref *refs;
+    unsigned long serial;
+} deps_used;
+
+/*****************************************************************************//**
+  a render being recorded, returned by deps_begin and passed to deps_use and
+  deps_end, each render of a mapfile has its own
+*******************************************************************************/
+
+typedef struct deps_render deps_render;
+
+/*****************************************************************************//**
+  type of function to pass to deps_find to be given each dependent mapfile
+
+ @param	extra       the extra pointer passed to deps_find
+ @param	mapfile_id  the id of a mapfile rendered from the row
+
+ @return	nothing
+
+  note:
+        this is called with the index locked, it must not call back into it
+*******************************************************************************/
+
+typedef void (*deps_find_func) (
+    void *extra,
+    int mapfile_id);
+
+/*****************************************************************************//**
+  function to setup the dependency index
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+int deps_init (void);
+
+/*****************************************************************************//**
+  function to free the dependency index
+
+ @return	nothing
+*******************************************************************************/
+
+void deps_destroy (void);
+
+/*****************************************************************************//**
+  function to start recording the rows a render of a mapfile reads
+
+ @param	mapfile_id  the id of the mapfile about to be rendered
+
+ @return	the render to pass to deps_use and deps_end
+ @return	NULL if malloc fails
+*******************************************************************************/
+
+deps_render *deps_begin (
+    int mapfile_id);
+
+/*****************************************************************************//**
+  function to record that a mapfile being rendered read a row
+
+ @param	render      the render from deps_begin, if NULL nothing is recorded
+ @param	table       the kind of row
+ @param	row_id      the primary key of the row
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        called from the render for each layer, class, symbol, legend, scalebar
+        and web row it reads, a row read more than once is kept once
+*******************************************************************************/
+
+int deps_use (
+    deps_render *render,
+    deps_table table,
+    int row_id);
+
+/*****************************************************************************//**
+  function to finish recording the rows a render of a mapfile read
+
+ @param	render      the render from deps_begin, it is free'ed
+ @param	err         the result of the render, the rows it recorded replace
+                    those of the last render only if it is 0
+
+ @return	nothing
+
+  note:
+        the rows of a render never replace those of one that began after it
+*******************************************************************************/
+
+void deps_end (
+    deps_render *render,
+    int err);
+
+/*****************************************************************************//**
+  function to find the mapfiles rendered from a row
+
+ @param	table   the kind of row
+ @param	row_id  the primary key of the row
+ @param	func    function to pass each mapfile_id to, NULL to only count
+ @param	extra   extra pointer to pass to func
+
+ @return	the number of mapfiles found
+
+  note:
+        a mapfile being rendered that has read the row so far is found too
+*******************************************************************************/
+
+size_t deps_find (
+    deps_table table,
+    int row_id,
+    deps_find_func func,
+    void *extra);
+
+/*****************************************************************************//**
+  function to expire the cache of every mapfile rendered from a row
+
+ @param	table   the kind of row
+ @param	row_id  the primary key of the row
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        a mapfile being rendered that has read the row so far is expired too,
+        its load is marked outdated so the version it publishes is expired
+*******************************************************************************/
+
+int deps_expire (
+    deps_table table,
+    int row_id);
+
+/*****************************************************************************//**
+  function to get the kind of row from its table name
+
+ @param	name    the name, it need not be nul terminated
+ @param	length  number of chars in name
+
+ @return	the kind of row
+ @return	-1 if the name is not known
+*******************************************************************************/
+
+int deps_table_id (
+    const char *name,
+    size_t length);
+
+#endif
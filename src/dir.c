@@ -0,0 +1,518 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "epoch.h"
+#include "bloom.h"
+#include "buffer.h"
+#include "dir.h"
+#include "stats.h"
+
+
+dir_index DIR_INDEX;
+
+static dir_load_func dir_load = NULL;
+
+static pthread_t dir_thread;
+static pthread_mutex_t dir_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dir_wake = PTHREAD_COND_INITIALIZER;
+static int dir_running = 0;
+
+/*****************************************************************************//**
+  function to compare mapfile ids for qsort
+*******************************************************************************/
+
+static int dir_cmp (
+    const void *id1,
+    const void *id2)
+{
+    int i1 = *(const int *)id1;
+    int i2 = *(const int *)id2;
+
+    return (i1 > i2) - (i1 < i2);
+}
+
+/*****************************************************************************//**
+  function to free a bloom filter of the ids once no reader can see it
+*******************************************************************************/
+
+static void dir_names_free (
+    void *data)
+{
+    dir_names *names = data;
+
+    bloom_free(&names->filter);
+    free(names);
+}
+
+/*****************************************************************************//**
+  function to make a bloom filter of the ids
+
+ @param	ids     the ids
+ @param	length  the number of ids
+ @param	serial  the serial of the index when the ids were read
+
+ @return	the filter
+ @return	NULL if malloc fails
+*******************************************************************************/
+
+static dir_names *dir_names_new (
+    int *ids,
+    size_t length,
+    unsigned long serial)
+{
+    dir_names *names;
+    size_t i;
+
+    if (!(names = malloc(sizeof(dir_names))))
+        return NULL;
+
+    if (bloom_init(&names->filter, length)) {
+        free(names);
+        return NULL;
+    }
+
+    names->serial = serial;
+
+    for (i = 0; i < length; i++)
+        bloom_add(&names->filter, ids[i]);
+
+    return names;
+}
+
+/*****************************************************************************//**
+  function to setup the directory index
+
+ @param	load    function to read the mapfile ids from the db
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+int dir_init (
+    dir_load_func load)
+{
+    dir_load = load;
+
+    if (pthread_rwlock_init(&DIR_INDEX.lock, NULL))
+        return -ENOMEM;
+
+    if (pthread_mutex_init(&DIR_INDEX.refresh, NULL)) {
+        pthread_rwlock_destroy(&DIR_INDEX.lock);
+        return -ENOMEM;
+    }
+
+    DIR_INDEX.ids = NULL;
+    DIR_INDEX.length = 0;
+    DIR_INDEX.expired = 1;
+    DIR_INDEX.serial = 0;
+    DIR_INDEX.loaded = 0;
+    DIR_INDEX.max_age = 0;
+    DIR_INDEX.retry = 0;
+    DIR_INDEX.failures = 0;
+    DIR_INDEX.names = NULL;
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to free the directory index
+
+ @return	nothing
+*******************************************************************************/
+
+void dir_destroy (void)
+{
+    free(DIR_INDEX.ids);
+    DIR_INDEX.ids = NULL;
+    DIR_INDEX.length = 0;
+    if (DIR_INDEX.names)
+        dir_names_free(DIR_INDEX.names);
+    DIR_INDEX.names = NULL;
+    pthread_mutex_destroy(&DIR_INDEX.refresh);
+    pthread_rwlock_destroy(&DIR_INDEX.lock);
+}
+
+/*****************************************************************************//**
+  function to mark the directory index as expired, the next readdir reads it
+  again from the db
+
+ @return	nothing
+*******************************************************************************/
+
+void dir_expire (void)
+{
+    __sync_fetch_and_add(&DIR_INDEX.serial, 1);
+    __sync_lock_test_and_set(&DIR_INDEX.expired, 1);
+}
+
+/*****************************************************************************//**
+  function to set how long the index is good for when nothing expires it
+
+ @param	max_age seconds, 0 to keep it till dir_expire() is called
+
+ @return	nothing
+
+  note:
+        with no notifications from the db a new mapfile would never be found,
+        the index is read again once it is this old, by the thread from
+        dir_start() if it is running
+*******************************************************************************/
+
+void dir_set_max_age (
+    time_t max_age)
+{
+    DIR_INDEX.max_age = max_age;
+}
+
+/*****************************************************************************//**
+  function to check if the index must be read again before it is used
+
+  note:
+        an index that is only too old is read by the thread while it runs,
+        and none is read again till the retry time of a failed read
+*******************************************************************************/
+
+static int dir_stale (void)
+{
+    time_t now = time(NULL);
+
+    if (now < DIR_INDEX.retry)
+        return 0;
+
+    return DIR_INDEX.expired || (DIR_INDEX.max_age && !dir_running &&
+                                 now - DIR_INDEX.loaded >= DIR_INDEX.max_age);
+}
+
+/*****************************************************************************//**
+  function to read the index from the db if it is expired
+
+ @param	force   non zero to read it even if it is not expired
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+static int dir_refresh (
+    int force)
+{
+    int *ids = NULL;
+    size_t length = 0;
+    int *old;
+    dir_names *names;
+    dir_names *old_names;
+    unsigned long serial;
+    int res;
+
+    if (!force && !dir_stale())
+        return 0;
+
+    /***** only one thread reads the db, the rest wait for it *****/
+
+    pthread_mutex_lock(&DIR_INDEX.refresh);
+
+    if (!force && !dir_stale()) {
+        pthread_mutex_unlock(&DIR_INDEX.refresh);
+        return 0;
+    }
+
+    /***** an expire while the db is read leaves the index expired *****/
+
+    serial = DIR_INDEX.serial;
+    __sync_lock_test_and_set(&DIR_INDEX.expired, 0);
+
+    /***** read and sort with no lock held *****/
+
+    if ((res = dir_load(&ids, &length))) {
+        if ((1 << DIR_INDEX.failures) <= DIR_RETRY_MAX)
+            DIR_INDEX.failures++;
+        DIR_INDEX.retry = time(NULL) + (1 << (DIR_INDEX.failures - 1));
+        __sync_lock_test_and_set(&DIR_INDEX.expired, 1);
+        pthread_mutex_unlock(&DIR_INDEX.refresh);
+        return res;
+    }
+
+    DIR_INDEX.failures = 0;
+    DIR_INDEX.retry = 0;
+
+    qsort(ids, length, sizeof(int), dir_cmp);
+
+    /***** without a filter every mapfile may exist *****/
+
+    names = dir_names_new(ids, length, serial);
+
+    pthread_rwlock_wrlock(&DIR_INDEX.lock);
+
+    old = DIR_INDEX.ids;
+    DIR_INDEX.ids = ids;
+    DIR_INDEX.length = length;
+    DIR_INDEX.loaded = time(NULL);
+
+    old_names = DIR_INDEX.names;
+    __atomic_store_n(&DIR_INDEX.names, names, __ATOMIC_RELEASE);
+
+    pthread_rwlock_unlock(&DIR_INDEX.lock);
+
+    pthread_mutex_unlock(&DIR_INDEX.refresh);
+
+    free(old);
+    if (old_names)
+        epoch_defer(dir_names_free, old_names);
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to read the index again from the db now
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        lookups and listings keep using the old index while the db is read,
+        so a change to the set of mapfiles is picked up off the request path
+*******************************************************************************/
+
+int dir_reload (void)
+{
+    return dir_refresh(1);
+}
+
+/*****************************************************************************//**
+  function run on the index thread
+*******************************************************************************/
+
+static void *dir_main (
+    void *arg)
+{
+    struct timespec when;
+    time_t started = time(NULL);
+
+    (void) arg;
+
+    pthread_mutex_lock(&dir_lock);
+
+    while (dir_running) {
+
+        /***** a reload by the listener or a listing puts it off *****/
+
+        if (DIR_INDEX.failures)
+            when.tv_sec = DIR_INDEX.retry;
+        else
+            when.tv_sec = (DIR_INDEX.loaded ? DIR_INDEX.loaded : started) +
+                          DIR_INDEX.max_age;
+        when.tv_nsec = 0;
+
+        if (pthread_cond_timedwait(&dir_wake, &dir_lock, &when) != ETIMEDOUT)
+            continue;
+
+        pthread_mutex_unlock(&dir_lock);
+
+        dir_reload();
+
+        pthread_mutex_lock(&dir_lock);
+    }
+
+    pthread_mutex_unlock(&dir_lock);
+
+    return NULL;
+}
+
+/*****************************************************************************//**
+  function to start the thread that reads the index again once it is too old
+
+ @return	0 on success, or if there is no max age
+ @return	a negative errno on failure
+
+  note:
+        lookups and listings keep using the old index while the thread reads
+        it. call this once the filesystem has daemonized
+*******************************************************************************/
+
+int dir_start (void)
+{
+    int res;
+
+    if (dir_running)
+        return -EBUSY;
+
+    if (!DIR_INDEX.max_age)
+        return 0;
+
+    dir_running = 1;
+
+    if ((res = -pthread_create(&dir_thread, NULL, dir_main, NULL)))
+        dir_running = 0;
+
+    return res;
+}
+
+/*****************************************************************************//**
+  function to stop the thread that reads the index
+
+ @return	nothing
+
+  note:
+        call this before dir_destroy()
+*******************************************************************************/
+
+void dir_stop (void)
+{
+    if (!dir_running)
+        return;
+
+    pthread_mutex_lock(&dir_lock);
+    dir_running = 0;
+    pthread_cond_signal(&dir_wake);
+    pthread_mutex_unlock(&dir_lock);
+
+    pthread_join(dir_thread, NULL);
+}
+
+/*****************************************************************************//**
+  function to check if a mapfile is in the index as it is, without reading
+  it from the db
+
+ @param	mapfile_id  the id of the mapfile
+
+ @return	0 if it may be in the index, or the index can not be trusted
+ @return	-ENOENT if it is not in the index
+*******************************************************************************/
+
+int dir_check (
+    int mapfile_id)
+{
+    dir_names *names;
+    unsigned long serial;
+    int res = 0;
+
+    epoch_enter();
+
+    names = __atomic_load_n(&DIR_INDEX.names, __ATOMIC_ACQUIRE);
+    serial = __atomic_load_n(&DIR_INDEX.serial, __ATOMIC_RELAXED);
+
+    if (names && names->serial == serial &&
+        !bloom_check(&names->filter, mapfile_id))
+        res = -ENOENT;
+
+    epoch_exit();
+
+    return res;
+}
+
+/*****************************************************************************//**
+  function to check if a mapfile may exist without asking the db
+
+ @param	mapfile_id  the id of the mapfile
+
+ @return	0 if it may exist
+ @return	-ENOENT if it is not in the index
+
+  note:
+        the check is a bloom filter of the ids in the index, it takes no
+        lock. the filter is only trusted if the index has not been expired
+        since it was read, otherwise the index is read again first. if that
+        fails every mapfile may exist, and it is not tried again on a lookup
+        till the retry time
+*******************************************************************************/
+
+int dir_lookup (
+    int mapfile_id)
+{
+    int res;
+
+    dir_refresh(0);
+
+    if ((res = dir_check(mapfile_id)))
+        stats_count(STATS_DIR_REJECTS);
+
+    return res;
+}
+
+/*****************************************************************************//**
+  function to list the mapfiles from an offset
+
+ @param	off     the offset to start at, DIR_OFF_FIRST or more
+ @param	fill    function to call for each mapfile
+ @param	extra   extra pointer to pass to fill
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        the index is only read from the db when it is expired, a listing is
+        a binary search for the offset and a walk of the sorted ids
+*******************************************************************************/
+
+int dir_readdir (
+    off_t off,
+    dir_fill_func fill,
+    void *extra)
+{
+    size_t lo;
+    size_t hi;
+    size_t mid;
+    off_t first;
+    int res;
+
+    if ((res = dir_refresh(0)))
+        return res;
+
+    pthread_rwlock_rdlock(&DIR_INDEX.lock);
+
+    /***** find the first id at or past the offset *****/
+
+    first = off < DIR_OFF_FIRST ? 0 : off - DIR_OFF_FIRST;
+
+    for (lo = 0, hi = DIR_INDEX.length; lo < hi;) {
+        mid = lo + (hi - lo) / 2;
+        if (DIR_INDEX.ids[mid] < first)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    /***** fill till the reply is full *****/
+
+    for (; lo < DIR_INDEX.length; lo++) {
+        if (fill(extra, DIR_INDEX.ids[lo],
+                 (off_t) DIR_INDEX.ids[lo] + DIR_OFF_FIRST + 1))
+            break;
+    }
+
+    pthread_rwlock_unlock(&DIR_INDEX.lock);
+
+    return 0;
+}
+
@@ -0,0 +1,254 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef dir_h
+#define dir_h
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <time.h>
+
+/*****************************************************************************//**
+  structure for a bloom filter of the mapfile ids in the index
+
+ @param	serial  the serial of the index when the ids were read
+ @param	filter  the filter
+*******************************************************************************/
+
+typedef struct {
+    unsigned long serial;
+    bloom filter;
+} dir_names;
+
+/*****************************************************************************//**
+  structure for the sorted index of the mapfiles in the mount
+
+ @param	lock    reader writer lock for the index
+ @param	ids     the mapfile ids in order
+ @param	length  number of ids in the index
+ @param	expired non zero if the index must be read again from the db
+ @param	serial  goes up each time the index is expired
+ @param	loaded  when the index was last read from the db
+ @param	max_age seconds the index is good for, 0 till it is expired
+ @param	retry   when a read that failed may be tried again
+ @param	failures number of reads that failed in a row
+ @param	refresh lock so only one thread reads the index from the db
+ @param	names   bloom filter of the ids, read with no lock in an epoch read
+                section, NULL if it could not be made
+*******************************************************************************/
+
+typedef struct {
+    pthread_rwlock_t lock;
+    int *ids;
+    size_t length;
+    unsigned int expired;
+    unsigned long serial;
+    time_t loaded;
+    time_t max_age;
+    time_t retry;
+    unsigned int failures;
+    pthread_mutex_t refresh;
+    dir_names *names;
+} dir_index;
+
+/***** readdir offsets, 0 is . 1 is .. and a mapfile is its id plus this so an
+       offset stays good even if the index is read again between calls *****/
+
+#define DIR_OFF_FIRST 2
+
+/***** seconds to wait before reading the index again after a read failed,
+       doubling from 1 up to this *****/
+
+#define DIR_RETRY_MAX 64
+
+/*****************************************************************************//**
+  type of function to pass to dir_load to read the mapfile ids from the db
+
+ @param	ids     set to a malloc'ed array of the ids, in any order
+ @param	length  set to the number of ids
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+typedef int (*dir_load_func) (
+    int **ids,
+    size_t *length);
+
+/*****************************************************************************//**
+  type of function to pass to dir_readdir for each entry
+
+ @param	extra       the extra pointer passed to dir_readdir
+ @param	mapfile_id  the id of the mapfile
+ @param	next        the offset of the next entry
+
+ @return	0 to continue
+ @return	non zero to stop, the reply is full
+*******************************************************************************/
+
+typedef int (*dir_fill_func) (
+    void *extra,
+    int mapfile_id,
+    off_t next);
+
+/*****************************************************************************//**
+  function to setup the directory index
+
+ @param	load    function to read the mapfile ids from the db
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+int dir_init (
+    dir_load_func load);
+
+/*****************************************************************************//**
+  function to free the directory index
+
+ @return	nothing
+*******************************************************************************/
+
+void dir_destroy (void);
+
+/*****************************************************************************//**
+  function to mark the directory index as expired, the next readdir reads it
+  again from the db
+
+ @return	nothing
+*******************************************************************************/
+
+void dir_expire (void);
+
+/*****************************************************************************//**
+  function to set how long the index is good for when nothing expires it
+
+ @param	max_age seconds, 0 to keep it till dir_expire() is called
+
+ @return	nothing
+
+  note:
+        with no notifications from the db a new mapfile would never be found,
+        the index is read again once it is this old, by the thread from
+        dir_start() if it is running
+*******************************************************************************/
+
+void dir_set_max_age (
+    time_t max_age);
+
+/*****************************************************************************//**
+  function to start the thread that reads the index again once it is too old
+
+ @return	0 on success, or if there is no max age
+ @return	a negative errno on failure
+
+  note:
+        lookups and listings keep using the old index while the thread reads
+        it. call this once the filesystem has daemonized
+*******************************************************************************/
+
+int dir_start (void);
+
+/*****************************************************************************//**
+  function to stop the thread that reads the index
+
+ @return	nothing
+
+  note:
+        call this before dir_destroy()
+*******************************************************************************/
+
+void dir_stop (void);
+
+/*****************************************************************************//**
+  function to read the index again from the db now
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        lookups and listings keep using the old index while the db is read,
+        so a change to the set of mapfiles is picked up off the request path
+*******************************************************************************/
+
+int dir_reload (void);
+
+/*****************************************************************************//**
+  function to check if a mapfile is in the index as it is, without reading
+  it from the db
+
+ @param	mapfile_id  the id of the mapfile
+
+ @return	0 if it may be in the index, or the index can not be trusted
+ @return	-ENOENT if it is not in the index
+*******************************************************************************/
+
+int dir_check (
+    int mapfile_id);
+
+/*****************************************************************************//**
+  function to check if a mapfile may exist without asking the db
+
+ @param	mapfile_id  the id of the mapfile
+
+ @return	0 if it may exist
+ @return	-ENOENT if it is not in the index
+
+  note:
+        the check is a bloom filter of the ids in the index, it takes no
+        lock. the filter is only trusted if the index has not been expired
+        since it was read, otherwise the index is read again first. if that
+        fails every mapfile may exist, and it is not tried again on a lookup
+        till the retry time
+*******************************************************************************/
+
+int dir_lookup (
+    int mapfile_id);
+
+/*****************************************************************************//**
+  function to list the mapfiles from an offset
+
+ @param	off     the offset to start at, DIR_OFF_FIRST or more
+ @param	fill    function to call for each mapfile
+ @param	extra   extra pointer to pass to fill
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        the index is only read from the db when it is expired, a listing is
+        a binary search for the offset and a walk of the sorted ids
+*******************************************************************************/
+
+int dir_readdir (
+    off_t off,
+    dir_fill_func fill,
+    void *extra);
+
+#endif
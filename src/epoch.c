@@ -0,0 +1,396 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifdef __linux__
+#include <linux/membarrier.h>
+#endif
+
+#include "epoch.h"
+
+/*****************************************************************************//**
+  structure for the slot of a reader thread
+
+ @param	active      the epoch the thread entered in, 0 outside a section
+ @param	nest        depth of nested sections
+ @param	registered  non zero once the slot is in the list
+ @param	prev        previous slot in the list
+ @param	next        next slot in the list
+
+  note:
+        the slot is thread local storage so registering can not fail, it is
+        unlinked by a key destructor when the thread exits
+*******************************************************************************/
+
+typedef struct epoch_thread_tab {
+    unsigned long active;
+    unsigned int nest;
+    int registered;
+    struct epoch_thread_tab *prev;
+    struct epoch_thread_tab *next;
+} epoch_thread;
+
+/*****************************************************************************//**
+  structure for something waiting to be freed
+
+ @param	epoch   the global epoch when it was unlinked
+ @param	func    function to free it with
+ @param	data    what was unlinked
+ @param	next    the next one, deferred later
+*******************************************************************************/
+
+typedef struct epoch_limbo_tab {
+    unsigned long epoch;
+    epoch_free_func func;
+    void *data;
+    struct epoch_limbo_tab *next;
+} epoch_limbo;
+
+static pthread_mutex_t epoch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t epoch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t epoch_key;
+
+/***** only changed under epoch_lock, readers load it with no lock *****/
+
+static unsigned long epoch_global = 1;
+
+static epoch_thread *epoch_threads = NULL;
+
+static epoch_limbo *epoch_head = NULL;
+static epoch_limbo *epoch_tail = NULL;
+
+static int epoch_membarrier = 0;
+
+static __thread epoch_thread epoch_self = {0};
+
+/*****************************************************************************//**
+  function called when a thread that read exits
+*******************************************************************************/
+
+static void epoch_thread_exit (
+    void *data)
+{
+    epoch_thread *self = data;
+
+    pthread_mutex_lock(&epoch_lock);
+
+    if (self->prev)
+        self->prev->next = self->next;
+    else
+        epoch_threads = self->next;
+    if (self->next)
+        self->next->prev = self->prev;
+
+    pthread_mutex_unlock(&epoch_lock);
+
+    self->registered = 0;
+}
+
+static void epoch_key_init (void)
+{
+    pthread_key_create(&epoch_key, epoch_thread_exit);
+}
+
+/*****************************************************************************//**
+  function to add the slot of the calling thread to the list
+*******************************************************************************/
+
+static void epoch_register (
+    epoch_thread *self)
+{
+    pthread_once(&epoch_once, epoch_key_init);
+
+    pthread_mutex_lock(&epoch_lock);
+
+    self->prev = NULL;
+    self->next = epoch_threads;
+    if (epoch_threads)
+        epoch_threads->prev = self;
+    epoch_threads = self;
+
+    pthread_mutex_unlock(&epoch_lock);
+
+    self->registered = 1;
+    pthread_setspecific(epoch_key, self);
+}
+
+/*****************************************************************************//**
+  function to setup epoch reclamation
+
+ @return	nothing
+
+  note:
+        uses membarrier() when the kernel has it so epoch_enter() needs no
+        fence, else epoch_enter() issues one
+*******************************************************************************/
+
+void epoch_init (void)
+{
+#if defined(__linux__) && defined(SYS_membarrier)
+    long cmds = syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0);
+
+    if (cmds > 0 && (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED) &&
+        !syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0))
+        epoch_membarrier = 1;
+#endif
+}
+
+/*****************************************************************************//**
+  function to enter a read side section
+
+ @return	nothing
+*******************************************************************************/
+
+void epoch_enter (void)
+{
+    epoch_thread *self = &epoch_self;
+
+    if (self->nest++)
+        return;
+
+    if (!self->registered)
+        epoch_register(self);
+
+    __atomic_store_n(&self->active,
+                     __atomic_load_n(&epoch_global, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+
+    /***** the store must be seen before anything the section loads, with
+           membarrier() the writer pays for that instead of the reader *****/
+
+    if (epoch_membarrier)
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    else
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*****************************************************************************//**
+  function to leave a read side section
+
+ @return	nothing
+*******************************************************************************/
+
+void epoch_exit (void)
+{
+    epoch_thread *self = &epoch_self;
+
+    if (--self->nest)
+        return;
+
+    __atomic_store_n(&self->active, 0, __ATOMIC_RELEASE);
+}
+
+/*****************************************************************************//**
+  function to move the global epoch on if every reader is in it
+
+ @return	non zero if the epoch moved on
+
+  note:
+        must be called with epoch_lock held
+*******************************************************************************/
+
+static int epoch_advance (void)
+{
+    epoch_thread *t;
+    unsigned long active;
+
+#if defined(__linux__) && defined(SYS_membarrier)
+    if (epoch_membarrier)
+        syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+    else
+#endif
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (t = epoch_threads; t; t = t->next) {
+        active = __atomic_load_n(&t->active, __ATOMIC_ACQUIRE);
+        if (active && active != epoch_global)
+            return 0;
+    }
+
+    __atomic_store_n(&epoch_global, epoch_global + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+/*****************************************************************************//**
+  function to take what no reader can see anymore off the limbo list
+
+ @return	the list of what can be freed
+
+  note:
+        must be called with epoch_lock held. something unlinked in epoch e
+        can only be seen by readers that entered in e or before, once the
+        epoch has moved on twice they have all left
+*******************************************************************************/
+
+static epoch_limbo *epoch_take (void)
+{
+    epoch_limbo *ready = epoch_head;
+    epoch_limbo *last = NULL;
+    epoch_limbo *l;
+
+    for (l = epoch_head; l && l->epoch + 2 <= epoch_global; l = l->next)
+        last = l;
+
+    if (!last)
+        return NULL;
+
+    epoch_head = last->next;
+    if (!epoch_head)
+        epoch_tail = NULL;
+    last->next = NULL;
+
+    return ready;
+}
+
+/*****************************************************************************//**
+  function to move the epoch on as far as the readers allow, at most far
+  enough to free the oldest thing waiting, and take what can be freed
+
+ @return	the list of what can be freed
+
+  note:
+        must be called with epoch_lock held
+*******************************************************************************/
+
+static epoch_limbo *epoch_collect (void)
+{
+    int tries;
+
+    for (tries = 0; epoch_head && tries < 2 &&
+                    epoch_head->epoch + 2 > epoch_global; tries++) {
+        if (!epoch_advance())
+            break;
+    }
+
+    return epoch_take();
+}
+
+/*****************************************************************************//**
+  function to free a list taken off the limbo list
+*******************************************************************************/
+
+static void epoch_free (
+    epoch_limbo *l)
+{
+    epoch_limbo *next;
+
+    for (; l; l = next) {
+        next = l->next;
+        l->func(l->data);
+        free(l);
+    }
+}
+
+/*****************************************************************************//**
+  function to free something once no reader can still see it
+
+ @param	func    function to free it with
+ @param	data    what was unlinked, no new reader may be able to find it
+
+ @return	nothing
+
+  note:
+        must not be called in a read side section. func is called from a
+        later epoch_defer() or epoch_barrier(), on whatever thread that is
+*******************************************************************************/
+
+void epoch_defer (
+    epoch_free_func func,
+    void *data)
+{
+    epoch_limbo *l;
+    epoch_limbo *ready;
+
+    /***** out of memory, wait out the readers here instead *****/
+
+    if (!(l = malloc(sizeof(epoch_limbo)))) {
+        epoch_barrier();
+        func(data);
+        return;
+    }
+
+    l->func = func;
+    l->data = data;
+    l->next = NULL;
+
+    pthread_mutex_lock(&epoch_lock);
+
+    l->epoch = epoch_global;
+    if (epoch_tail)
+        epoch_tail->next = l;
+    else
+        epoch_head = l;
+    epoch_tail = l;
+
+    ready = epoch_collect();
+
+    pthread_mutex_unlock(&epoch_lock);
+
+    epoch_free(ready);
+}
+
+/*****************************************************************************//**
+  function to wait for every reader and free everything deferred
+
+ @return	nothing
+
+  note:
+        must not be called in a read side section
+*******************************************************************************/
+
+void epoch_barrier (void)
+{
+    epoch_limbo *ready;
+    unsigned long target;
+
+    pthread_mutex_lock(&epoch_lock);
+
+    target = epoch_global + 2;
+
+    while (epoch_global < target) {
+        if (!epoch_advance()) {
+            pthread_mutex_unlock(&epoch_lock);
+            sched_yield();
+            pthread_mutex_lock(&epoch_lock);
+        }
+    }
+
+    ready = epoch_take();
+
+    pthread_mutex_unlock(&epoch_lock);
+
+    epoch_free(ready);
+}
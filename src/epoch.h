@@ -0,0 +1,107 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+#ifndef epoch_h
+#define epoch_h
+
+/*****************************************************************************//**
+  type of function to pass to epoch_defer() to free what a reader may still see
+
+ @param	data    what was unlinked
+
+ @return	nothing
+*******************************************************************************/
+
+typedef void (*epoch_free_func) (
+    void *data);
+
+/*****************************************************************************//**
+  function to setup epoch reclamation
+
+ @return	nothing
+
+  note:
+        uses membarrier() when the kernel has it so epoch_enter() needs no
+        fence, else epoch_enter() issues one
+*******************************************************************************/
+
+void epoch_init (void);
+
+/*****************************************************************************//**
+  function to enter a read side section
+
+ @return	nothing
+
+  note:
+        anything reachable from a pointer loaded in the section stays valid
+        until epoch_exit(), sections may nest. no lock is taken and nothing
+        shared is written, the thread only stores the epoch it is in to a
+        slot of its own
+*******************************************************************************/
+
+void epoch_enter (void);
+
+/*****************************************************************************//**
+  function to leave a read side section
+
+ @return	nothing
+*******************************************************************************/
+
+void epoch_exit (void);
+
+/*****************************************************************************//**
+  function to free something once no reader can still see it
+
+ @param	func    function to free it with
+ @param	data    what was unlinked, no new reader may be able to find it
+
+ @return	nothing
+
+  note:
+        must not be called in a read side section. func is called from a
+        later epoch_defer() or epoch_barrier(), on whatever thread that is
+*******************************************************************************/
+
+void epoch_defer (
+    epoch_free_func func,
+    void *data);
+
+/*****************************************************************************//**
+  function to wait for every reader and free everything deferred
+
+ @return	nothing
+
+  note:
+        must not be called in a read side section
+*******************************************************************************/
+
+void epoch_barrier (void);
+
+#endif
@@ -0,0 +1,709 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "hash.h"
+#include "buffer.h"
+#include "deps.h"
+#include "frag.h"
+
+static pthread_mutex_t frag_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/***** for each kind of row, the clean fragment of each row keyed by row_id.
+       the tables hold no reference, a fragment leaves its table when the
+       last gather list holding it is free'ed *****/
+
+static hash_table frag_tables[DEPS_TABLES];
+
+/***** the distinct rendered blocks keyed by the low bits of their content
+       hash, blocks whose keys collide are chained *****/
+
+static hash_table frag_blobs;
+
+/***** goes up on each expire, a fragment rendered across one is not kept *****/
+
+static unsigned long frag_serial = 0;
+
+/***** a fragment older than this is rendered again, 0 is no limit *****/
+
+static unsigned int frag_max_age = 0;
+
+static frag_stats frag_counters = {0};
+
+/*****************************************************************************//**
+  function to setup the fragment cache
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+int frag_init (void)
+{
+    int i;
+
+    for (i = 0; i < DEPS_TABLES; i++)
+        memset(&frag_tables[i], 0, sizeof(hash_table));
+
+    memset(&frag_blobs, 0, sizeof(hash_table));
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to free the fragment cache
+
+ @return	nothing
+
+  note:
+        the gather lists must be free'ed first
+*******************************************************************************/
+
+void frag_destroy (void)
+{
+    int i;
+
+    pthread_mutex_lock(&frag_lock);
+
+    for (i = 0; i < DEPS_TABLES; i++)
+        hash_delete_all(&frag_tables[i]);
+
+    hash_delete_all(&frag_blobs);
+
+    pthread_mutex_unlock(&frag_lock);
+}
+
+/*****************************************************************************//**
+  function to hash bytes, 64 bit fnv-1a
+
+ @param	h       FRAG_HASH_INIT, or the hash of the bytes before these
+ @param	data    the bytes
+ @param	length  number of bytes in data
+
+ @return	the hash
+*******************************************************************************/
+
+uint64_t frag_hash (
+    uint64_t h,
+    const char *data,
+    size_t length)
+{
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        h ^= (unsigned char) data[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+#define FRAG_BLOB_KEY(h) ((int)((h) ^ ((h) >> 32)))
+
+/*****************************************************************************//**
+  function to get the stored copy of a block, storing it if it is the first
+
+ @param	data    the rendered block
+ @param	length  number of bytes in data
+
+ @return	the blob with a reference held
+ @return	NULL if malloc fails
+*******************************************************************************/
+
+static frag_blob *frag_blob_get (
+    const char *data,
+    size_t length)
+{
+    uint64_t hash = frag_hash(FRAG_HASH_INIT, data, length);
+    int key = FRAG_BLOB_KEY(hash);
+    frag_blob *head;
+    frag_blob *blob;
+
+    /***** copy it before locking, it is thrown away if it is a duplicate *****/
+
+    if (!(blob = malloc(sizeof(frag_blob) + length + 1)))
+        return NULL;
+
+    blob->hash = hash;
+    blob->refs = 1;
+    blob->length = length;
+    memcpy(blob->data, data, length);
+    blob->data[length] = '\0';
+
+    pthread_mutex_lock(&frag_lock);
+
+    frag_counters.bytes += length;
+
+    for (head = hash_find(&frag_blobs, key); head; head = head->next) {
+        if (head->hash == hash && head->length == length &&
+            !memcmp(head->data, data, length)) {
+            head->refs++;
+            pthread_mutex_unlock(&frag_lock);
+            free(blob);
+            return head;
+        }
+    }
+
+    /***** a new key starts a chain, a colliding one goes in after the head
+           so the table need not change *****/
+
+    blob->next = NULL;
+    blob->hashed = 1;
+
+    if ((head = hash_find(&frag_blobs, key))) {
+        blob->next = head->next;
+        head->next = blob;
+    }
+    else if (hash_insert(&frag_blobs, key, blob))
+        blob->hashed = 0;
+
+    frag_counters.blobs++;
+    frag_counters.stored += length;
+
+    pthread_mutex_unlock(&frag_lock);
+
+    return blob;
+}
+
+/*****************************************************************************//**
+  function to release a reference on a blob, the fragment lock must be held
+*******************************************************************************/
+
+static void frag_blob_release (
+    frag_blob *blob)
+{
+    int key = FRAG_BLOB_KEY(blob->hash);
+    frag_blob *head;
+
+    frag_counters.bytes -= blob->length;
+
+    if (--blob->refs)
+        return;
+
+    /***** unlink it from its chain, putting the next in the table in place
+           of a head can not need more slots than the head had *****/
+
+    if (blob->hashed && (head = hash_find(&frag_blobs, key)) == blob) {
+        hash_delete(&frag_blobs, key);
+        if (blob->next)
+            hash_insert(&frag_blobs, key, blob->next);
+    }
+    else if (blob->hashed) {
+        while (head->next != blob)
+            head = head->next;
+        head->next = blob->next;
+    }
+
+    frag_counters.blobs--;
+    frag_counters.stored -= blob->length;
+
+    free(blob);
+}
+
+/*****************************************************************************//**
+  function to release a reference on a fragment
+*******************************************************************************/
+
+static void frag_release (
+    frag *f)
+{
+    pthread_mutex_lock(&frag_lock);
+
+    if (--f->refs) {
+        pthread_mutex_unlock(&frag_lock);
+        return;
+    }
+
+    if (f->hashed)
+        hash_delete(&frag_tables[f->table], f->row_id);
+
+    frag_counters.count--;
+    frag_blob_release(f->blob);
+
+    pthread_mutex_unlock(&frag_lock);
+
+    free(f);
+}
+
+/*****************************************************************************//**
+  function to get the clean fragment of a row, rendering it if there is none
+
+ @param	table   the kind of row
+ @param	row_id  the primary key of the row
+ @param	indent  the indent to render at
+ @param	render  function to render the block
+ @param	err     set to a negative errno on failure
+
+ @return	the fragment with a reference held
+ @return	NULL on failure
+*******************************************************************************/
+
+static frag *frag_get (
+    int table,
+    int row_id,
+    int indent,
+    frag_render_func render,
+    int *err)
+{
+    frag *f;
+    frag *found;
+    buffer buf = {0};
+    unsigned long serial;
+    int res;
+
+    pthread_mutex_lock(&frag_lock);
+
+    if ((f = hash_find(&frag_tables[table], row_id)) && frag_max_age &&
+        time(NULL) - f->rendered >= frag_max_age) {
+        hash_delete(&frag_tables[table], row_id);
+        f->hashed = 0;
+        f = NULL;
+    }
+
+    if (f) {
+        f->refs++;
+        frag_counters.reuses++;
+        pthread_mutex_unlock(&frag_lock);
+        return f;
+    }
+
+    serial = frag_serial;
+
+    pthread_mutex_unlock(&frag_lock);
+
+    /***** render it with no lock held, then keep only its stored copy *****/
+
+    if (!(f = calloc(1, sizeof(frag)))) {
+        *err = -ENOMEM;
+        return NULL;
+    }
+
+    f->table = table;
+    f->row_id = row_id;
+    f->refs = 1;
+    f->rendered = time(NULL);
+    buf.indent = indent;
+
+    if ((res = render(&buf, table, row_id))) {
+        buffer_free(&buf);
+        free(f);
+        *err = res;
+        return NULL;
+    }
+
+    f->blob = frag_blob_get(buf.buf, buf.used);
+    buffer_free(&buf);
+
+    if (!f->blob) {
+        free(f);
+        *err = -ENOMEM;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&frag_lock);
+
+    frag_counters.renders++;
+
+    /***** someone else rendered it at the same time *****/
+
+    if ((found = hash_find(&frag_tables[table], row_id))) {
+        found->refs++;
+        frag_blob_release(f->blob);
+        pthread_mutex_unlock(&frag_lock);
+        free(f);
+        return found;
+    }
+
+    /***** a row that changed while it rendered may have been read before
+           the change, use it this once but do not keep it *****/
+
+    if (serial == frag_serial && !hash_insert(&frag_tables[table], row_id, f))
+        f->hashed = 1;
+
+    frag_counters.count++;
+
+    pthread_mutex_unlock(&frag_lock);
+
+    return f;
+}
+
+/*****************************************************************************//**
+  function to add a piece to a gather list
+*******************************************************************************/
+
+static int frag_list_piece (
+    frag_list *list,
+    frag *f,
+    size_t length)
+{
+    frag_piece *pieces;
+    size_t alloced;
+
+    if (list->npieces == list->alloced) {
+        alloced = list->alloced ? list->alloced * 2 : 16;
+        if (!(pieces = realloc(list->pieces, alloced * sizeof(frag_piece))))
+            return -ENOMEM;
+        list->pieces = pieces;
+        list->alloced = alloced;
+    }
+
+    pieces = list->pieces + list->npieces++;
+    pieces->off = list->length;
+    pieces->length = length;
+    pieces->data = f ? f->blob->data : NULL;
+    pieces->frag = f;
+
+    list->length += length;
+
+    /***** the own text is charged with the buffer it is in *****/
+
+    if (f)
+        list->bytes += length;
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to add a block to a mapfile being rendered
+
+ @param	buf         the buffer the mapfile is being rendered into
+ @param	mapfile_id  the id of the mapfile
+ @param	table       the kind of row the block is rendered from
+ @param	row_id      the primary key of the row
+ @param	render      function to render the block if it is not cached
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        the block is only rendered if no clean fragment of the row is held.
+        if buf has a gather list the fragment is added to it as a piece,
+        otherwise it is copied into buf. the row is recorded to buf->deps
+*******************************************************************************/
+
+int frag_add (
+    buffer *buf,
+    int mapfile_id,
+    int table,
+    int row_id,
+    frag_render_func render)
+{
+    frag_list *list = buf->gather;
+    frag *f;
+    int res;
+
+    (void) mapfile_id;
+
+    if ((unsigned int) table >= DEPS_TABLES)
+        return -EINVAL;
+
+    if ((res = deps_use(buf->deps, table, row_id)))
+        return res;
+
+    if (!(f = frag_get(table, row_id, buf->indent, render, &res)))
+        return res;
+
+    if (!list || !f->blob->length) {
+        buffer_write(buf, f->blob->data, f->blob->length);
+        frag_release(f);
+        return 0;
+    }
+
+    /***** the text rendered since the last piece goes in first *****/
+
+    if (buf->used > list->run &&
+        (res = frag_list_piece(list, NULL, buf->used - list->run))) {
+        frag_release(f);
+        return res;
+    }
+    list->run = buf->used;
+
+    if ((res = frag_list_piece(list, f, f->blob->length))) {
+        frag_release(f);
+        return res;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to mark the fragment of a row dirty
+
+ @param	table   the kind of row
+ @param	row_id  the primary key of the row
+
+ @return	nothing
+
+  note:
+        gather lists holding the fragment keep it, the next render of the row
+        gets a new one
+*******************************************************************************/
+
+void frag_expire (
+    int table,
+    int row_id)
+{
+    frag *f;
+
+    if ((unsigned int) table >= DEPS_TABLES)
+        return;
+
+    pthread_mutex_lock(&frag_lock);
+
+    frag_serial++;
+
+    if ((f = hash_delete(&frag_tables[table], row_id)))
+        f->hashed = 0;
+
+    pthread_mutex_unlock(&frag_lock);
+}
+
+/*****************************************************************************//**
+  function to take a fragment out of its table, for hash_iterate
+*******************************************************************************/
+
+static void *frag_unhash (
+    hash_table *table,
+    int key,
+    void *data,
+    void *extra)
+{
+    frag *f = data;
+
+    f->hashed = 0;
+
+    return NULL;
+}
+
+/*****************************************************************************//**
+  function to mark every fragment dirty
+
+ @return	nothing
+
+  note:
+        for when changes may have been missed, gather lists holding fragments
+        keep them
+*******************************************************************************/
+
+void frag_expire_all (void)
+{
+    int i;
+
+    pthread_mutex_lock(&frag_lock);
+
+    frag_serial++;
+
+    for (i = 0; i < DEPS_TABLES; i++) {
+        hash_iterate(&frag_tables[i], frag_unhash, NULL);
+        hash_delete_all(&frag_tables[i]);
+    }
+
+    pthread_mutex_unlock(&frag_lock);
+}
+
+/*****************************************************************************//**
+  function to set how long a fragment is reused
+
+ @param	seconds a fragment rendered this long ago is rendered again, 0 keeps
+                it till its row is expired
+
+ @return	nothing
+*******************************************************************************/
+
+void frag_set_max_age (
+    unsigned int seconds)
+{
+    pthread_mutex_lock(&frag_lock);
+    frag_max_age = seconds;
+    pthread_mutex_unlock(&frag_lock);
+}
+
+/*****************************************************************************//**
+  function to make a gather list for a render
+
+ @return	the list
+ @return	NULL if malloc fails
+*******************************************************************************/
+
+frag_list *frag_list_new (void)
+{
+    return calloc(1, sizeof(frag_list));
+}
+
+/*****************************************************************************//**
+  function to finish a gather list once the render is done
+
+ @param	list    the list
+ @param	buf     the buffer the mapfile was rendered into
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        buf must not be changed after this, the pieces point into it
+*******************************************************************************/
+
+int frag_list_finish (
+    frag_list *list,
+    buffer *buf)
+{
+    size_t i, cursor = 0;
+    int res;
+
+    if (buf->used > list->run &&
+        (res = frag_list_piece(list, NULL, buf->used - list->run)))
+        return res;
+    list->run = buf->used;
+
+    /***** the own text pieces are in order in buf, now it can not move *****/
+
+    for (i = 0; i < list->npieces; i++) {
+        if (list->pieces[i].frag)
+            continue;
+        list->pieces[i].data = buf->buf + cursor;
+        cursor += list->pieces[i].length;
+    }
+
+    list->bytes += list->alloced * sizeof(frag_piece);
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to free a gather list and release its fragments
+
+ @param	list    the list
+
+ @return	nothing
+*******************************************************************************/
+
+void frag_list_free (
+    frag_list *list)
+{
+    size_t i;
+
+    for (i = 0; i < list->npieces; i++) {
+        if (list->pieces[i].frag)
+            frag_release(list->pieces[i].frag);
+    }
+
+    free(list->pieces);
+    free(list);
+}
+
+/*****************************************************************************//**
+  function to find the piece of a gather list an offset falls in
+
+ @param	list    the list
+ @param	off     the offset in the file, less than the length of the list
+
+ @return	the index of the piece
+*******************************************************************************/
+
+size_t frag_list_find (
+    frag_list *list,
+    size_t off)
+{
+    size_t lo = 0;
+    size_t hi = list->npieces;
+    size_t mid;
+
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (list->pieces[mid].off <= off)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/*****************************************************************************//**
+  function to copy bytes out of a gather list
+
+ @param	list    the list
+ @param	dest    where to copy to
+ @param	size    most bytes to copy
+ @param	off     offset in the file to copy from
+
+ @return	the number of bytes copied
+*******************************************************************************/
+
+size_t frag_list_copy (
+    frag_list *list,
+    char *dest,
+    size_t size,
+    off_t off)
+{
+    frag_piece *piece;
+    size_t i, skip, n, done = 0;
+
+    if (off < 0 || (size_t) off >= list->length)
+        return 0;
+
+    if (size > list->length - off)
+        size = list->length - off;
+
+    for (i = frag_list_find(list, off); done < size; i++) {
+        piece = list->pieces + i;
+        skip = off + done - piece->off;
+        n = piece->length - skip;
+        if (n > size - done)
+            n = size - done;
+
+        memcpy(dest + done, piece->data + skip, n);
+        done += n;
+    }
+
+    return done;
+}
+
+/*****************************************************************************//**
+  function to get the counters of the fragment cache
+
+ @param	stats   filled in with the counters
+
+ @return	nothing
+*******************************************************************************/
+
+void frag_get_stats (
+    frag_stats *stats)
+{
+    pthread_mutex_lock(&frag_lock);
+    *stats = frag_counters;
+    pthread_mutex_unlock(&frag_lock);
+}
+
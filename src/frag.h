@@ -0,0 +1,347 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef frag_h
+#define frag_h
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*****************************************************************************//**
+  structure for the stored copy of a rendered block, identical blocks
+  rendered from different rows share one
+
+ @param	hash    hash of the content
+ @param	refs    number of fragments holding the blob
+ @param	hashed  non zero if the blob is in the content table
+ @param	next    next blob whose hash has the same key in the content table
+ @param	length  number of bytes in data
+ @param	data    the block, nul terminated
+*******************************************************************************/
+
+typedef struct frag_blob {
+    uint64_t hash;
+    unsigned int refs;
+    unsigned int hashed;
+    struct frag_blob *next;
+    size_t length;
+    char data[];
+} frag_blob;
+
+/*****************************************************************************//**
+  structure for a rendered block of a mapfile, a LAYER, CLASS or SYMBOL block
+  rendered from one row and shared by every mapfile that uses the row
+
+ @param	table   the kind of row the block is rendered from
+ @param	row_id  the primary key of the row
+ @param	refs    number of gather lists holding the fragment
+ @param	hashed  non zero while the fragment is the one new renders get
+ @param	rendered time the fragment was rendered
+ @param	blob    the rendered block
+
+  note:
+        a fragment never changes once rendered, when its row changes it is
+        taken out of the table and the next render gets a new one
+*******************************************************************************/
+
+typedef struct {
+    int table;
+    int row_id;
+    unsigned int refs;
+    unsigned int hashed;
+    time_t rendered;
+    frag_blob *blob;
+} frag;
+
+/*****************************************************************************//**
+  structure for a piece of a gather list
+
+ @param	off     offset of the piece in the file
+ @param	length  number of bytes in the piece
+ @param	data    the bytes
+ @param	frag    the fragment data points into, NULL if it points into the
+                text the mapfile rendered itself
+*******************************************************************************/
+
+typedef struct {
+    size_t off;
+    size_t length;
+    const char *data;
+    frag *frag;
+} frag_piece;
+
+/*****************************************************************************//**
+  structure for a mapfile assembled from its own text and shared fragments
+
+ @param	length  number of bytes in the file
+ @param	bytes   bytes of the fragments, counted in full, and of pieces, the
+                own text is not counted, it is in the buffer
+ @param	npieces number of pieces
+ @param	alloced number of pieces pieces has room for
+ @param	pieces  the pieces in file order
+ @param	run     start of the text rendered since the last piece
+*******************************************************************************/
+
+typedef struct frag_list {
+    size_t length;
+    size_t bytes;
+    size_t npieces;
+    size_t alloced;
+    frag_piece *pieces;
+    size_t run;
+} frag_list;
+
+/*****************************************************************************//**
+  structure for the counters of the fragment cache
+
+ @param	renders number of fragments rendered from the db
+ @param	reuses  number of times a rendered fragment was used again
+ @param	count   number of fragments held
+ @param	blobs   number of distinct blocks stored for them
+ @param	bytes   bytes of the fragments held, as if none were shared
+ @param	stored  bytes of the distinct blocks, the dedup ratio is
+                bytes / stored
+*******************************************************************************/
+
+typedef struct {
+    unsigned long renders;
+    unsigned long reuses;
+    unsigned long count;
+    unsigned long blobs;
+    size_t bytes;
+    size_t stored;
+} frag_stats;
+
+/*****************************************************************************//**
+  type of function to pass to frag_add to render a block from its row
+
+ @param	buf     the buffer to render into, indented as the caller was
+ @param	table   the kind of row
+ @param	row_id  the primary key of the row
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+typedef int (*frag_render_func) (
+    buffer *buf,
+    int table,
+    int row_id);
+
+/*****************************************************************************//**
+  function to setup the fragment cache
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+int frag_init (void);
+
+/*****************************************************************************//**
+  function to free the fragment cache
+
+ @return	nothing
+
+  note:
+        the gather lists must be free'ed first
+*******************************************************************************/
+
+void frag_destroy (void);
+
+/*****************************************************************************//**
+  function to add a block to a mapfile being rendered
+
+ @param	buf         the buffer the mapfile is being rendered into
+ @param	mapfile_id  the id of the mapfile
+ @param	table       the kind of row the block is rendered from
+ @param	row_id      the primary key of the row
+ @param	render      function to render the block if it is not cached
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        the block is only rendered if no clean fragment of the row is held.
+        if buf has a gather list the fragment is added to it as a piece,
+        otherwise it is copied into buf. the row is recorded to buf->deps
+*******************************************************************************/
+
+int frag_add (
+    buffer *buf,
+    int mapfile_id,
+    int table,
+    int row_id,
+    frag_render_func render);
+
+/*****************************************************************************//**
+  function to mark the fragment of a row dirty
+
+ @param	table   the kind of row
+ @param	row_id  the primary key of the row
+
+ @return	nothing
+
+  note:
+        gather lists holding the fragment keep it, the next render of the row
+        gets a new one
+*******************************************************************************/
+
+void frag_expire (
+    int table,
+    int row_id);
+
+/*****************************************************************************//**
+  function to mark every fragment dirty
+
+ @return	nothing
+
+  note:
+        for when changes may have been missed, gather lists holding fragments
+        keep them
+*******************************************************************************/
+
+void frag_expire_all (void);
+
+/*****************************************************************************//**
+  function to set how long a fragment is reused
+
+ @param	seconds a fragment rendered this long ago is rendered again, 0 keeps
+                it till its row is expired
+
+ @return	nothing
+
+  note:
+        set with the row max age, a fragment kept longer than its row would
+        be rendered again from the row for nothing
+*******************************************************************************/
+
+void frag_set_max_age (
+    unsigned int seconds);
+
+/*****************************************************************************//**
+  function to make a gather list for a render
+
+ @return	the list
+ @return	NULL if malloc fails
+*******************************************************************************/
+
+frag_list *frag_list_new (void);
+
+/*****************************************************************************//**
+  function to finish a gather list once the render is done
+
+ @param	list    the list
+ @param	buf     the buffer the mapfile was rendered into
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        buf must not be changed after this, the pieces point into it
+*******************************************************************************/
+
+int frag_list_finish (
+    frag_list *list,
+    buffer *buf);
+
+/*****************************************************************************//**
+  function to free a gather list and release its fragments
+
+ @param	list    the list
+
+ @return	nothing
+*******************************************************************************/
+
+void frag_list_free (
+    frag_list *list);
+
+/*****************************************************************************//**
+  function to find the piece of a gather list an offset falls in
+
+ @param	list    the list
+ @param	off     the offset in the file, less than the length of the list
+
+ @return	the index of the piece
+*******************************************************************************/
+
+size_t frag_list_find (
+    frag_list *list,
+    size_t off);
+
+/*****************************************************************************//**
+  function to copy bytes out of a gather list
+
+ @param	list    the list
+ @param	dest    where to copy to
+ @param	size    most bytes to copy
+ @param	off     offset in the file to copy from
+
+ @return	the number of bytes copied
+*******************************************************************************/
+
+size_t frag_list_copy (
+    frag_list *list,
+    char *dest,
+    size_t size,
+    off_t off);
+
+/***** seed of frag_hash() *****/
+
+#define FRAG_HASH_INIT 0xcbf29ce484222325ULL
+
+/*****************************************************************************//**
+  function to hash bytes, 64 bit fnv-1a
+
+ @param	h       FRAG_HASH_INIT, or the hash of the bytes before these
+ @param	data    the bytes
+ @param	length  number of bytes in data
+
+ @return	the hash
+
+  note:
+        bytes hashed in pieces hash the same as in one go
+*******************************************************************************/
+
+uint64_t frag_hash (
+    uint64_t h,
+    const char *data,
+    size_t length);
+
+/*****************************************************************************//**
+  function to get the counters of the fragment cache
+
+ @param	stats   filled in with the counters
+
+ @return	nothing
+*******************************************************************************/
+
+void frag_get_stats (
+    frag_stats *stats);
+
+#endif
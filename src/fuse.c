@@ -1,28 +1,89 @@
+
+
 /*
 
-  gcc -Wall mapfileFS.c `pkg-config fuse --cflags --libs` -o mapfileFS
+  gcc -Wall -pthread mapfileFS.c `pkg-config fuse --cflags --libs` -o mapfileFS
 */
 
-#define FUSE_USE_VERSION 26
+#define FUSE_USE_VERSION 29
 
 #include <fuse.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <stddef.h>
 
-static const char *mapfileFS_str = "mapfileFS World!\n";
+#include "hash.h"
+#include "DLList.h"
+#include "timer.h"
+#include "sketch.h"
+#include "buffer.h"
+#include "frag.h"
+#include "snap.h"
+#include "cache.h"
+#include "bloom.h"
+#include "dir.h"
+#include "deps.h"
+#include "rows.h"
+#include "listen.h"
+#include "pressure.h"
+#include "stats.h"
+#include "map.h"
+#include "mapfileFS.h"
+
+/*******************************************************************************
+ function to get the mapfile id from a file name, names are <mapfile_id>.map
 
+ returns the mapfile id or -1 if the name is not a mapfile
+*******************************************************************************/
+
+int mapfileFS_name_id(const char *name)
+{
+	char *end;
+	long id;
+
+	if (*name < '0' || *name > '9')
+		return -1;
+
+	id = strtol(name, &end, 10);
+	if (strcmp(end, MAPFILEFS_EXT) != 0 || id < 0 || id > 0x7fffffff)
+		return -1;
+
+	return id;
+}
+
+/*******************************************************************************
+ function to get the mapfile id from a path, paths are /<mapfile_id>.map
+
+ returns the mapfile id or -1 if the path is not a mapfile
+*******************************************************************************/
+
+static int mapfileFS_path_id(const char *path)
+{
+	if (*path != '/')
+		return -1;
+
+	return mapfileFS_name_id(path + 1);
+}
 
 /*******************************************************************************
  This function returns metadata concerning a file specified by path in a special
  stat structure. It has to be declared static, as all functions passed in the
  fuse_operations structure to fuse_main(), to work properly. 
+
+ the size and mtime come from the cache metadata, a stat never renders the
+ mapfile
 *******************************************************************************/
 
 static int mapfileFS_getattr(const char *path, struct stat *stbuf)
 {
 	int res = 0;
+	int id;
+	cache_attr attr;
+	unsigned long start = stats_now();
 
 	memset(stbuf, 0, sizeof(struct stat));
 
@@ -34,70 +95,306 @@ static int mapfileFS_getattr(const char *path, struct stat *stbuf)
 
     /***** is it a file *****/
 
-	} else if (strcmp(path, mapfileFS_path) == 0) {
+	} else if (strcmp(path, "/" MAPFILEFS_STATS) == 0) {
 		stbuf->st_mode = S_IFREG | 0444;
 		stbuf->st_nlink = 1;
-		stbuf->st_size = strlen(mapfileFS_str); //fixme
+
+    /***** is it a file, a name not in the index never gets to the db *****/
+
+	} else if ((id = mapfileFS_path_id(path)) >= 0) {
+		if (!(res = dir_lookup(id)) && !(res = cache_getattr(id, &attr))) {
+			stbuf->st_mode = S_IFREG | 0444;
+			stbuf->st_nlink = 1;
+			stbuf->st_size = attr.size;
+			stbuf->st_mtime = attr.mtime;
+			stbuf->st_ctime = attr.mtime;
+		}
 	} else
 		res = -ENOENT;
 
+	stats_observe(STATS_GETATTR, start);
+
 	return res;
 }
 
 /*******************************************************************************
- Next very important function is used to read directory contents. Because our
- implementation is very simple, we will be intrested only in path, buf and
- filler arguments passed to it. Path is the path to the directory from which we
- will have to read our contents, buf will hold them, and filler is a
- fuse_fill_dir_t function which we will use to add contents to directory.
- Offset and fi are not important now. 
+ structure to pass the fuse filler through dir_readdir()
+*******************************************************************************/
+
+typedef struct {
+	void *buf;
+	fuse_fill_dir_t filler;
+} mapfileFS_dirbuf;
+
+static int mapfileFS_readdir_fill(void *extra, int mapfile_id, off_t next)
+{
+	mapfileFS_dirbuf *db = extra;
+	char name[32];
+
+	snprintf(name, sizeof(name), "%d" MAPFILEFS_EXT, mapfile_id);
+
+	return db->filler(db->buf, name, NULL, next);
+}
+
+/*******************************************************************************
+ Next very important function is used to read directory contents. Path is the
+ path to the directory from which we will have to read our contents, buf will
+ hold them, and filler is a fuse_fill_dir_t function which we will use to add
+ contents to directory.
+
+ every entry is given its offset so a big directory is listed a reply at a
+ time, each call starts where the last one stopped in the sorted index
 *******************************************************************************/
 
 static int mapfileFS_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 			 off_t offset, struct fuse_file_info *fi)
 {
-	(void) offset;
+	mapfileFS_dirbuf db = { buf, filler };
+	unsigned long start = stats_now();
+	int res = 0;
 	(void) fi;
 
 	if (strcmp(path, "/") != 0)
 		return -ENOENT;
 
-	filler(buf, ".", NULL, 0);
-	filler(buf, "..", NULL, 0);
-	//filler(buf, mapfileFS_path + 1, NULL, 0);
+	if (!(offset < 1 && filler(buf, ".", NULL, 1)) &&
+	    !(offset < DIR_OFF_FIRST && filler(buf, "..", NULL, DIR_OFF_FIRST)))
+		res = dir_readdir(offset, mapfileFS_readdir_fill, &db);
 
-	return 0;
+	stats_observe(STATS_READDIR, start);
+
+	return res;
 }
 
+/*******************************************************************************
+ open pins the current version in fi->fh, reads are served from it with no
+ lookup and no lock, and it stays valid until release even if a refresh
+ publishes a new version meanwhile. keep_cache is set unless this is the
+ first open of the version, so unchanged mapfiles are read from the kernels
+ page cache
+*******************************************************************************/
+
 static int mapfileFS_open(const char *path, struct fuse_file_info *fi)
 {
-	if (strcmp(path, mapfileFS_path) != 0)
-		return -ENOENT;
+	int id = -1;
+	int res = 0;
+	cache_version *version = NULL;
+	unsigned long start = stats_now();
+
+	if (strcmp(path, "/" MAPFILEFS_STATS) != 0 &&
+	    ((id = mapfileFS_path_id(path)) < 0 || dir_lookup(id)))
+		res = -ENOENT;
+	else if ((fi->flags & 3) != O_RDONLY)
+		res = -EACCES;
+
+    /***** the stats file has no size, direct_io makes the kernel read it
+	   until eof *****/
+
+	else if (id < 0) {
+		if ((version = mapfileFS_stats(&res)))
+			fi->direct_io = 1;
+	} else if ((version = cache_get(id, &res)))
+		fi->keep_cache = cache_keep(version);
+
+	if (version)
+		fi->fh = (uintptr_t) version;
+
+	stats_observe(STATS_OPEN, start);
+
+	return res;
+}
+
+static int mapfileFS_release(const char *path, struct fuse_file_info *fi)
+{
+	unsigned long start = stats_now();
+	(void) path;
+
+	cache_release((cache_version *)(uintptr_t) fi->fh);
 
-	if ((fi->flags & 3) != O_RDONLY)
-		return -EACCES;
+	stats_observe(STATS_RELEASE, start);
 
 	return 0;
 }
 
+/*******************************************************************************
+ function to make a version holding the counters for an open of the stats
+ file, it is not in the cache and each open gets its own snapshot
+
+ returns the version or NULL with err set
+*******************************************************************************/
+
+cache_version *mapfileFS_stats(int *err)
+{
+	cache_version *version;
+
+	if (!(version = calloc(1, sizeof(cache_version))) ||
+	    !(version->buf = calloc(1, sizeof(buffer)))) {
+		free(version);
+		*err = -ENOMEM;
+		return NULL;
+	}
+
+	version->mapfile_id = -1;
+	version->refs = 1;
+
+	stats_print(version->buf);
+	version->size = version->buf->used;
+
+	return version;
+}
 
 static int mapfileFS_read(const char *path, char *buf, size_t size, off_t offset,
 		      struct fuse_file_info *fi)
 {
 	size_t len;
-	(void) fi;
-	if(strcmp(path, mapfileFS_path) != 0)
-		return -ENOENT;
+	cache_version *version = (cache_version *)(uintptr_t) fi->fh;
+	unsigned long start = stats_now();
+	(void) path;
+
+	if (version->gather)
+		size = frag_list_copy(version->gather, buf, size, offset);
+	else {
+		len = version->size;
+		if (offset < len) {
+			if (offset + size > len)
+				size = len - offset;
+			memcpy(buf, version->buf->buf + offset, size);
+		} else
+			size = 0;
+	}
+
+	stats_observe(STATS_READ, start);
+
+	return size;
+}
+
+/*******************************************************************************
+ function to make a bufvec for a read of a pinned version, one buf per piece
+ the read covers if the version is a gather list
+
+ returns the bufvec to free when the reply is sent or NULL if malloc fails
+*******************************************************************************/
+
+struct fuse_bufvec *mapfileFS_bufvec(cache_version *version, size_t size,
+				     off_t offset)
+{
+	size_t len = version->size;
+	size_t i, first, count = 1;
+	frag_list *list = version->gather;
+	struct fuse_bufvec *bv;
 
-	len = strlen(mapfileFS_str);
 	if (offset < len) {
 		if (offset + size > len)
 			size = len - offset;
-		memcpy(buf, mapfileFS_str + offset, size);
 	} else
 		size = 0;
 
-	return size;
+	if (list && size) {
+		first = frag_list_find(list, offset);
+		count = frag_list_find(list, offset + size - 1) - first + 1;
+	}
+
+	if (!(bv = malloc(sizeof(struct fuse_bufvec) +
+			  (count - 1) * sizeof(struct fuse_buf))))
+		return NULL;
+
+	*bv = FUSE_BUFVEC_INIT(size);
+
+	if (list && size) {
+
+		/***** the first and last pieces may be cut *****/
+
+		bv->count = count;
+		for (i = 0; i < count; i++) {
+			bv->buf[i] = bv->buf[0];
+			bv->buf[i].mem = (char *) list->pieces[first + i].data;
+			bv->buf[i].size = list->pieces[first + i].length;
+		}
+		bv->buf[0].mem = (char *) bv->buf[0].mem +
+			(offset - list->pieces[first].off);
+		bv->buf[0].size -= offset - list->pieces[first].off;
+		bv->buf[count - 1].size -= list->pieces[first + count - 1].off +
+			list->pieces[first + count - 1].length - (offset + size);
+	} else if (size)
+		bv->buf[0].mem = version->buf->buf + offset;
+
+	return bv;
+}
+
+/*******************************************************************************
+ read_buf hands fuse a bufvec pointing into the pinned version instead of
+ copying, one buf per fragment the read covers if the version is a gather
+ list. fuse sends the reply before it frees the bufvec, and the pin from open
+ outlives every reply on the file handle
+*******************************************************************************/
+
+static int mapfileFS_read_buf(const char *path, struct fuse_bufvec **bufp,
+			  size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	struct fuse_bufvec *bv;
+	cache_version *version = (cache_version *)(uintptr_t) fi->fh;
+	unsigned long start = stats_now();
+	(void) path;
+
+	bv = mapfileFS_bufvec(version, size, offset);
+
+	stats_observe(STATS_READ, start);
+
+	if (!bv)
+		return -ENOMEM;
+
+	*bufp = bv;
+
+	return 0;
+}
+
+/*******************************************************************************
+ function to render a mapfile for the cache
+*******************************************************************************/
+
+int mapfileFS_load(int mapfile_id, buffer *buf)
+{
+	int res;
+	deps_render *render;
+	unsigned long start = stats_now();
+
+	/***** do_map() records each layer, class, symbol, legend and scalebar
+	       row it reads so a change to one expires only the mapfiles
+	       using it *****/
+
+	if (!(render = deps_begin(mapfile_id)))
+		return -ENOMEM;
+
+	buf->deps = render;
+	res = do_map(buf, mapfile_id);
+	buf->deps = NULL;
+
+	deps_end(render, res);
+
+	stats_observe(STATS_RENDER, start);
+
+	return res;
+}
+
+/*******************************************************************************
+ function called once fuse_main() has daemonized, threads started before the
+ fork would be lost
+*******************************************************************************/
+
+static void *mapfileFS_init(struct fuse_conn_info *conn)
+{
+	(void) conn;
+
+	mapfileFS_start();
+
+	return NULL;
+}
+
+static void mapfileFS_destroy(void *private_data)
+{
+	(void) private_data;
+
+	mapfileFS_stop();
 }
 
 static struct fuse_operations mapfileFS_oper = {
@@ -105,9 +402,385 @@ static struct fuse_operations mapfileFS_oper = {
 	.readdir	= mapfileFS_readdir,
 	.open		= mapfileFS_open,
 	.read		= mapfileFS_read,
+	.read_buf	= mapfileFS_read_buf,
+	.release	= mapfileFS_release,
+	.init		= mapfileFS_init,
+	.destroy	= mapfileFS_destroy,
+};
+
+/*******************************************************************************
+ our own options, the rest are passed on to fuse
+
+	--lowlevel			run the low level front end
+	-o cache_size=SIZE	byte budget of the cache, K M or G may follow, 0 is no limit
+	-o cache_policy=P	eviction policy, lru or tinylfu, tinylfu keeps the hot
+						mapfiles when a crawler sweeps them all once
+	-o stale_max=SECONDS	an expired mapfile is still served for this long
+						while it is refreshed in the background, 0 is off
+	-o refresh_threads=N	number of background refresh threads, default 2
+	-o listen=SOURCE	expire mapfiles as the db notifies they changed,
+						fifo:PATH or pg:CONNINFO
+	-o debounce=MS		a burst of notifications is expired once it has been
+						quiet this long, default 50
+	-o negative_ttl=SECONDS	a mapfile the db says does not exist is not
+						asked for again for this long, and the kernel
+						keeps the negative entry as long, default 5, 0 is
+						off. with no listen the index of mapfile names is
+						read again this often
+	-o ttl=SECONDS		a rendered mapfile is expired this long after it
+						was read even if the db never says it changed,
+						and the rows and fragments it is rendered from
+						are read again once this old, default 0 is off
+	-o hot_hits=N		a mapfile read this many times since it was last
+						rendered ahead is hot, it is rendered again before
+						its ttl runs out and as soon as it is expired so
+						it is never read as a miss, default 0 is off
+	-o refresh_ahead=SECONDS	how long before the ttl a hot mapfile is rendered
+						again, default 5
+	-o ahead_threads=N	number of threads rendering hot mapfiles ahead,
+						default 1
+	-o snapshot=PATH	restore the cache from this file at start and write
+						it back periodically and at unmount, so a restart
+						does not send every first hit to the db
+	-o snapshot_interval=SECONDS	seconds between snapshots, default 300
+	-o row_cache_size=SIZE	byte budget of the db rows the mapfiles are rendered
+						from, a mapfile evicted or expired is rendered
+						again from these without a query for the rows
+						that did not change, default 64M, 0 is no limit
+	-o cold_share=PERCENT	keep the coldest mapfiles lz4 compressed in up to
+						this share of cache_size instead of evicting them,
+						default 0 is off, needs a build with HAVE_LZ4
+	-o cache_max=SIZE	let the budget of the cache float up to this by the
+						memory pressure of the cgroup, it starts at
+						cache_size and is shrunk and the freed memory
+						handed back to the os when tasks stall on memory
+						or the cgroup nears memory.max
+	-o cache_min=SIZE	the floating budget is never shrunk below this,
+						default cache_max / 16
+	-o cgroup=PATH		the cgroup v2 directory to watch, default the one
+						the filesystem runs in
+*******************************************************************************/
+
+typedef struct {
+	int lowlevel;
+	char *cache_size;
+	char *cache_policy;
+	unsigned int stale_max;
+	int refresh_threads;
+	char *listen;
+	unsigned int debounce;
+	unsigned int negative_ttl;
+	unsigned int ttl;
+	unsigned int hot_hits;
+	unsigned int refresh_ahead;
+	int ahead_threads;
+	char *snapshot;
+	unsigned int snapshot_interval;
+	unsigned int cold_share;
+	char *row_cache_size;
+	char *cache_max;
+	char *cache_min;
+	char *cgroup;
+	size_t budget;
+	size_t budget_max;
+	size_t budget_min;
+} mapfileFS_config;
+
+static mapfileFS_config mapfileFS_conf;
+
+#define MAPFILEFS_OPT(t, p, v) { t, offsetof(mapfileFS_config, p), v }
+
+static struct fuse_opt mapfileFS_opts[] = {
+	MAPFILEFS_OPT("--lowlevel", lowlevel, 1),
+	MAPFILEFS_OPT("cache_size=%s", cache_size, 0),
+	MAPFILEFS_OPT("cache_policy=%s", cache_policy, 0),
+	MAPFILEFS_OPT("stale_max=%u", stale_max, 0),
+	MAPFILEFS_OPT("refresh_threads=%d", refresh_threads, 0),
+	MAPFILEFS_OPT("listen=%s", listen, 0),
+	MAPFILEFS_OPT("debounce=%u", debounce, 0),
+	MAPFILEFS_OPT("negative_ttl=%u", negative_ttl, 0),
+	MAPFILEFS_OPT("ttl=%u", ttl, 0),
+	MAPFILEFS_OPT("hot_hits=%u", hot_hits, 0),
+	MAPFILEFS_OPT("refresh_ahead=%u", refresh_ahead, 0),
+	MAPFILEFS_OPT("ahead_threads=%d", ahead_threads, 0),
+	MAPFILEFS_OPT("snapshot=%s", snapshot, 0),
+	MAPFILEFS_OPT("snapshot_interval=%u", snapshot_interval, 0),
+	MAPFILEFS_OPT("cold_share=%u", cold_share, 0),
+	MAPFILEFS_OPT("row_cache_size=%s", row_cache_size, 0),
+	MAPFILEFS_OPT("cache_max=%s", cache_max, 0),
+	MAPFILEFS_OPT("cache_min=%s", cache_min, 0),
+	MAPFILEFS_OPT("cgroup=%s", cgroup, 0),
+	FUSE_OPT_END
 };
 
+/*******************************************************************************
+ function to parse a size with an optional K M or G suffix
+
+ returns 0 on success or -1 if the size is not valid
+*******************************************************************************/
+
+static int mapfileFS_parse_size(const char *str, size_t *bytes)
+{
+	char *end;
+	unsigned long long size;
+
+	if (*str < '0' || *str > '9')
+		return -1;
+
+	size = strtoull(str, &end, 10);
+
+	switch (*end) {
+		case 'g': case 'G':
+			size *= 1024;
+			/* fall through */
+		case 'm': case 'M':
+			size *= 1024;
+			/* fall through */
+		case 'k': case 'K':
+			size *= 1024;
+			end++;
+			/* fall through */
+		case '\0':
+			break;
+		default:
+			return -1;
+	}
+
+	if (*end)
+		return -1;
+
+	*bytes = size;
+
+	return 0;
+}
+
+/*******************************************************************************
+ function to start the background threads, called from the init of either
+ front end, by then the filesystem has daemonized and threads started before
+ the fork would be lost
+*******************************************************************************/
+
+void mapfileFS_start(void)
+{
+	int res;
+
+	if ((res = cache_start()))
+		fprintf(stderr, "mapfileFS: cache_start: %s\n", strerror(-res));
+
+	if (mapfileFS_conf.snapshot &&
+	    (res = snap_start(mapfileFS_conf.snapshot,
+			      mapfileFS_conf.snapshot_interval)))
+		fprintf(stderr, "mapfileFS: snapshot %s: %s\n",
+			mapfileFS_conf.snapshot, strerror(-res));
+
+	if (mapfileFS_conf.listen &&
+	    (res = listen_start(mapfileFS_conf.listen, mapfileFS_conf.debounce)))
+		fprintf(stderr, "mapfileFS: listen %s: %s\n", mapfileFS_conf.listen,
+			strerror(-res));
+
+	if ((res = dir_start()))
+		fprintf(stderr, "mapfileFS: dir_start: %s\n", strerror(-res));
+
+	/***** with no pressure to read the budget stays at cache_size *****/
+
+	if (mapfileFS_conf.budget_max &&
+	    (res = pressure_start(mapfileFS_conf.cgroup, mapfileFS_conf.budget_min,
+				  mapfileFS_conf.budget_max, mapfileFS_conf.budget)))
+		fprintf(stderr, "mapfileFS: memory pressure: %s\n", strerror(-res));
+}
+
+/*******************************************************************************
+ function to stop the background threads and free the cache, called from the
+ destroy of either front end
+*******************************************************************************/
+
+void mapfileFS_stop(void)
+{
+	pressure_stop();
+	listen_stop();
+	snap_stop();
+	dir_stop();
+	cache_destroy();
+	dir_destroy();
+	frag_destroy();
+	rows_destroy();
+	deps_destroy();
+}
+
+/*******************************************************************************
+ fuse_main() runs the multithreaded loop unless -s is given, every callback
+ above may run at the same time on different threads, the cache does its own
+ locking per shard so opens and reads of different mapfiles do not contend
+
+ --lowlevel runs the low level front end in fuse_ll.c instead, that one is
+ handed inode numbers so it never has to parse a path
+*******************************************************************************/
+
 int main(int argc, char *argv[])
 {
-	return fuse_main(argc, argv, &mapfileFS_oper, NULL);
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	mapfileFS_config *conf = &mapfileFS_conf;
+	size_t budget = 0;
+	size_t row_budget = 64 << 20;
+	unsigned int max_age;
+	cache_policy policy = CACHE_POLICY_LRU;
+	char opt[64];
+	int res;
+
+	/***** strip our own options before fuse sees them *****/
+
+	memset(conf, 0, sizeof(*conf));
+	conf->refresh_threads = 2;
+	conf->debounce = 50;
+	conf->negative_ttl = 5;
+	conf->refresh_ahead = 5;
+	conf->ahead_threads = 1;
+	conf->snapshot_interval = 300;
+	if (fuse_opt_parse(&args, conf, mapfileFS_opts, NULL) == -1)
+		return 1;
+
+	/***** the high level front end answers lookups from getattr, fuse
+	       replies to an ENOENT with a negative entry this long *****/
+
+	if (!conf->lowlevel && conf->negative_ttl) {
+		snprintf(opt, sizeof(opt), "-onegative_timeout=%u", conf->negative_ttl);
+		if (fuse_opt_add_arg(&args, opt) == -1)
+			return 1;
+	}
+
+	if (conf->cache_size && mapfileFS_parse_size(conf->cache_size, &budget)) {
+		fprintf(stderr, "mapfileFS: bad cache_size: %s\n", conf->cache_size);
+		return 1;
+	}
+
+	if (conf->row_cache_size &&
+	    mapfileFS_parse_size(conf->row_cache_size, &row_budget)) {
+		fprintf(stderr, "mapfileFS: bad row_cache_size: %s\n",
+			conf->row_cache_size);
+		return 1;
+	}
+
+	if (conf->cache_max &&
+	    (mapfileFS_parse_size(conf->cache_max, &conf->budget_max) ||
+	     !conf->budget_max)) {
+		fprintf(stderr, "mapfileFS: bad cache_max: %s\n", conf->cache_max);
+		return 1;
+	}
+
+	conf->budget_min = conf->budget_max / 16;
+
+	if (conf->cache_min &&
+	    (mapfileFS_parse_size(conf->cache_min, &conf->budget_min) ||
+	     !conf->budget_min || conf->budget_min > conf->budget_max)) {
+		fprintf(stderr, "mapfileFS: bad cache_min: %s\n", conf->cache_min);
+		return 1;
+	}
+
+	if (conf->budget_max && !conf->budget_min)
+		conf->budget_min = 1;
+
+	conf->budget = budget;
+
+	if (conf->cache_policy) {
+		if (strcmp(conf->cache_policy, "tinylfu") == 0)
+			policy = CACHE_POLICY_TINYLFU;
+		else if (strcmp(conf->cache_policy, "lru") != 0) {
+			fprintf(stderr, "mapfileFS: bad cache_policy: %s\n", conf->cache_policy);
+			return 1;
+		}
+	}
+
+	if (conf->refresh_threads < 1) {
+		fprintf(stderr, "mapfileFS: bad refresh_threads: %d\n", conf->refresh_threads);
+		return 1;
+	}
+
+	if (conf->ahead_threads < 1) {
+		fprintf(stderr, "mapfileFS: bad ahead_threads: %d\n", conf->ahead_threads);
+		return 1;
+	}
+
+	if ((res = cache_init(mapfileFS_load,
+			      conf->lowlevel ? mapfileFS_ll_expire : NULL))) {
+		fprintf(stderr, "mapfileFS: cache_init: %s\n", strerror(-res));
+		return 1;
+	}
+
+	if ((res = cache_set_policy(policy))) {
+		fprintf(stderr, "mapfileFS: cache_set_policy: %s\n", strerror(-res));
+		return 1;
+	}
+
+	if ((res = cache_set_cold(conf->cold_share))) {
+		fprintf(stderr, "mapfileFS: cold_share: %s\n", strerror(-res));
+		return 1;
+	}
+
+	cache_set_budget(budget);
+	cache_set_stale(conf->stale_max, conf->refresh_threads);
+	cache_set_negative(conf->negative_ttl);
+	cache_set_ttl(conf->ttl);
+	cache_set_ahead(conf->refresh_ahead, conf->hot_hits, conf->ahead_threads);
+
+	/***** the restored versions are handed out from the first hit and
+	       checked against the db behind it, a missing snapshot is only a
+	       cold start *****/
+
+	if (conf->snapshot && (res = snap_load(conf->snapshot)) && res != -ENOENT)
+		fprintf(stderr, "mapfileFS: snapshot %s: %s\n", conf->snapshot,
+			strerror(-res));
+
+	if ((res = deps_init())) {
+		fprintf(stderr, "mapfileFS: deps_init: %s\n", strerror(-res));
+		return 1;
+	}
+
+	if ((res = frag_init())) {
+		fprintf(stderr, "mapfileFS: frag_init: %s\n", strerror(-res));
+		return 1;
+	}
+
+	if ((res = rows_init())) {
+		fprintf(stderr, "mapfileFS: rows_init: %s\n", strerror(-res));
+		return 1;
+	}
+
+	rows_set_budget(row_budget);
+
+	/***** a ttl expiry must not render from the same rows or fragments
+	       again, with no notifications and no ttl they are only shared by
+	       the renders of about the same time *****/
+
+	max_age = conf->ttl ? conf->ttl : (conf->listen ? 0 : 1);
+	rows_set_max_age(max_age);
+	frag_set_max_age(max_age);
+
+	if ((res = dir_init(do_list))) {
+		fprintf(stderr, "mapfileFS: dir_init: %s\n", strerror(-res));
+		return 1;
+	}
+
+	/***** with no notifications nothing tells us a mapfile was added, it is
+	       found once the index is this old, dir_start() reads it again off
+	       the request path *****/
+
+	if (!conf->listen)
+		dir_set_max_age(conf->negative_ttl ? conf->negative_ttl : 1);
+
+	if (conf->lowlevel)
+		res = mapfileFS_ll_main(args.argc, args.argv);
+	else
+		res = fuse_main(args.argc, args.argv, &mapfileFS_oper, NULL);
+
+	fuse_opt_free_args(&args);
+	free(conf->cache_size);
+	free(conf->cache_policy);
+	free(conf->listen);
+	free(conf->snapshot);
+	free(conf->row_cache_size);
+	free(conf->cache_max);
+	free(conf->cache_min);
+	free(conf->cgroup);
+
+	return res;
 }
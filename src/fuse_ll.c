@@ -0,0 +1,421 @@
+
+
+/*
+  low level front end, the kernel hands us inode numbers and the inode of a
+  mapfile is its mapfile_id plus MAPFILEFS_INO_BASE, so a request goes
+  straight from the inode to the cache without parsing a path
+*/
+
+#define FUSE_USE_VERSION 29
+
+#include <fuse_lowlevel.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "hash.h"
+#include "DLList.h"
+#include "timer.h"
+#include "sketch.h"
+#include "buffer.h"
+#include "cache.h"
+#include "bloom.h"
+#include "dir.h"
+#include "stats.h"
+#include "mapfileFS.h"
+
+/***** attr and entry timeout for a mapfile that has not expired, we tell the
+       kernel when one expires so it can hold on to them for a long time *****/
+
+#define MAPFILEFS_TIMEOUT 86400.0
+
+/***** attr and entry timeout for a stale version or a size only pass, it may
+       be replaced without the kernel being told *****/
+
+#define MAPFILEFS_STALE_TIMEOUT 1.0
+
+static struct fuse_chan *mapfileFS_ll_ch = NULL;
+
+/*******************************************************************************
+ function to fill in the stat of an inode, from the cache metadata so the
+ mapfile is never rendered for a stat
+
+ returns 0 on success or a negative errno
+*******************************************************************************/
+
+static int mapfileFS_ll_stat(fuse_ino_t ino, struct stat *stbuf,
+			 double *timeout)
+{
+	int res = 0;
+	cache_attr attr;
+
+	memset(stbuf, 0, sizeof(struct stat));
+	stbuf->st_ino = ino;
+	*timeout = MAPFILEFS_TIMEOUT;
+
+    /***** is it the dir? *****/
+
+	if (ino == FUSE_ROOT_ID) {
+		stbuf->st_mode = S_IFDIR | 0755;
+		stbuf->st_nlink = 2;
+
+    /***** is it a file *****/
+
+    /***** is it the stats file, it changes all the time *****/
+
+	} else if (ino == MAPFILEFS_STATS_INO) {
+		stbuf->st_mode = S_IFREG | 0444;
+		stbuf->st_nlink = 1;
+		*timeout = 0;
+
+	} else if (ino >= MAPFILEFS_INO_BASE) {
+		if ((res = cache_getattr(MAPFILEFS_ID(ino), &attr)))
+			return res;
+
+		stbuf->st_mode = S_IFREG | 0444;
+		stbuf->st_nlink = 1;
+		stbuf->st_size = attr.size;
+		stbuf->st_mtime = attr.mtime;
+		stbuf->st_ctime = attr.mtime;
+		if (!attr.current)
+			*timeout = MAPFILEFS_STALE_TIMEOUT;
+	} else
+		res = -ENOENT;
+
+	return res;
+}
+
+static void mapfileFS_ll_getattr(fuse_req_t req, fuse_ino_t ino,
+			     struct fuse_file_info *fi)
+{
+	struct stat stbuf;
+	double timeout;
+	int res;
+	unsigned long start = stats_now();
+	(void) fi;
+
+	if ((res = mapfileFS_ll_stat(ino, &stbuf, &timeout)))
+		fuse_reply_err(req, -res);
+	else
+		fuse_reply_attr(req, &stbuf, timeout);
+
+	stats_observe(STATS_GETATTR, start);
+}
+
+/*******************************************************************************
+ function to reply that a name does not exist, with a negative entry the
+ kernel keeps for the negative ttl so it does not ask again
+*******************************************************************************/
+
+static void mapfileFS_ll_noent(fuse_req_t req)
+{
+	struct fuse_entry_param e;
+
+	if (!cache_get_negative()) {
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+
+	memset(&e, 0, sizeof(e));
+	e.ino = 0;
+	e.entry_timeout = cache_get_negative();
+	fuse_reply_entry(req, &e);
+}
+
+/*******************************************************************************
+ lookup is the only place a name is parsed, after this the kernel uses the
+ inode we give it. a name not in the index never gets to the db
+*******************************************************************************/
+
+static void mapfileFS_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	struct fuse_entry_param e;
+	int id = -1;
+	int res;
+	unsigned long start = stats_now();
+
+	memset(&e, 0, sizeof(e));
+
+	if (parent != FUSE_ROOT_ID)
+		fuse_reply_err(req, ENOENT);
+	else if (strcmp(name, MAPFILEFS_STATS) != 0 &&
+		 ((id = mapfileFS_name_id(name)) < 0 || dir_lookup(id)))
+		mapfileFS_ll_noent(req);
+	else {
+		e.ino = id < 0 ? MAPFILEFS_STATS_INO : MAPFILEFS_INO(id);
+
+		if ((res = mapfileFS_ll_stat(e.ino, &e.attr, &e.attr_timeout))) {
+			if (res == -ENOENT)
+				mapfileFS_ll_noent(req);
+			else
+				fuse_reply_err(req, -res);
+		} else {
+			e.entry_timeout = e.attr_timeout;
+			fuse_reply_entry(req, &e);
+		}
+	}
+
+	stats_observe(STATS_LOOKUP, start);
+}
+
+/*******************************************************************************
+ function to add an entry to a readdir reply buffer, the buffer is alloced to
+ the size the kernel asked for
+
+ returns non zero if the entry did not fit
+*******************************************************************************/
+
+static int mapfileFS_ll_dirbuf_add(fuse_req_t req, buffer *b, const char *name,
+			       fuse_ino_t ino, mode_t mode, off_t next)
+{
+	struct stat stbuf;
+	size_t need;
+
+	memset(&stbuf, 0, sizeof(stbuf));
+	stbuf.st_ino = ino;
+	stbuf.st_mode = mode;
+
+	need = fuse_add_direntry(req, b->buf + b->used, b->alloced - b->used,
+				 name, &stbuf, next);
+	if (need > b->alloced - b->used)
+		return 1;
+
+	b->used += need;
+
+	return 0;
+}
+
+/*******************************************************************************
+ structure to pass the reply through dir_readdir()
+*******************************************************************************/
+
+typedef struct {
+	fuse_req_t req;
+	buffer b;
+} mapfileFS_ll_dirbuf;
+
+static int mapfileFS_ll_readdir_fill(void *extra, int mapfile_id, off_t next)
+{
+	mapfileFS_ll_dirbuf *db = extra;
+	char name[32];
+
+	snprintf(name, sizeof(name), "%d" MAPFILEFS_EXT, mapfile_id);
+
+	return mapfileFS_ll_dirbuf_add(db->req, &db->b, name,
+				       MAPFILEFS_INO(mapfile_id), S_IFREG, next);
+}
+
+/*******************************************************************************
+ readdir fills one reply at a time from the sorted index, off is where the
+ last reply stopped
+*******************************************************************************/
+
+static void mapfileFS_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+			     off_t off, struct fuse_file_info *fi)
+{
+	mapfileFS_ll_dirbuf db;
+	int res = 0;
+	unsigned long start = stats_now();
+	(void) fi;
+
+	if (ino != FUSE_ROOT_ID) {
+		fuse_reply_err(req, ENOTDIR);
+		return;
+	}
+
+	memset(&db, 0, sizeof(db));
+	db.req = req;
+	if (!(db.b.buf = malloc(size))) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	db.b.alloced = size;
+
+	if (!(off < 1 && mapfileFS_ll_dirbuf_add(req, &db.b, ".", FUSE_ROOT_ID,
+						  S_IFDIR, 1)) &&
+	    !(off < DIR_OFF_FIRST && mapfileFS_ll_dirbuf_add(req, &db.b, "..",
+						  FUSE_ROOT_ID, S_IFDIR, DIR_OFF_FIRST)))
+		res = dir_readdir(off, mapfileFS_ll_readdir_fill, &db);
+
+	if (res)
+		fuse_reply_err(req, -res);
+	else
+		fuse_reply_buf(req, db.b.buf, db.b.used);
+
+	free(db.b.buf);
+
+	stats_observe(STATS_READDIR, start);
+}
+
+/*******************************************************************************
+ open pins the current version in fi->fh, reads are served from it with no
+ lookup and no lock, and it stays valid until release even if a refresh
+ publishes a new version meanwhile. keep_cache is set unless this is the
+ first open of the version, so unchanged mapfiles are read from the kernels
+ page cache
+*******************************************************************************/
+
+static void mapfileFS_ll_open(fuse_req_t req, fuse_ino_t ino,
+			  struct fuse_file_info *fi)
+{
+	int res = 0;
+	cache_version *version;
+	unsigned long start = stats_now();
+
+	if (ino < MAPFILEFS_INO_BASE)
+		fuse_reply_err(req, EISDIR);
+	else if ((fi->flags & 3) != O_RDONLY)
+		fuse_reply_err(req, EACCES);
+
+    /***** the stats file has no size, direct_io makes the kernel read it
+	   until eof *****/
+
+	else if (ino == MAPFILEFS_STATS_INO ?
+		 !(version = mapfileFS_stats(&res)) :
+		 !(version = cache_get(MAPFILEFS_ID(ino), &res)))
+		fuse_reply_err(req, -res);
+	else {
+		fi->fh = (uintptr_t) version;
+		if (ino == MAPFILEFS_STATS_INO)
+			fi->direct_io = 1;
+		else
+			fi->keep_cache = cache_keep(version);
+		if (fuse_reply_open(req, fi) == -ENOENT)
+			cache_release(version);
+	}
+
+	stats_observe(STATS_OPEN, start);
+}
+
+static void mapfileFS_ll_release(fuse_req_t req, fuse_ino_t ino,
+			     struct fuse_file_info *fi)
+{
+	unsigned long start = stats_now();
+	(void) ino;
+
+	cache_release((cache_version *)(uintptr_t) fi->fh);
+	fuse_reply_err(req, 0);
+
+	stats_observe(STATS_RELEASE, start);
+}
+
+/*******************************************************************************
+ read replies with a bufvec pointing into the pinned version, fuse_reply_data()
+ writes or splices it to the kernel before returning so nothing is copied
+*******************************************************************************/
+
+static void mapfileFS_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size,
+			  off_t off, struct fuse_file_info *fi)
+{
+	struct fuse_bufvec *bv;
+	cache_version *version = (cache_version *)(uintptr_t) fi->fh;
+	unsigned long start = stats_now();
+	(void) ino;
+
+	if (!(bv = mapfileFS_bufvec(version, size, off)))
+		fuse_reply_err(req, ENOMEM);
+	else {
+		fuse_reply_data(req, bv, FUSE_BUF_SPLICE_MOVE);
+		free(bv);
+	}
+
+	stats_observe(STATS_READ, start);
+}
+
+/*******************************************************************************
+ function to tell the kernel a mapfile expired, only that inode's attributes
+ and pages and its dentry are dropped, everything else stays cached
+*******************************************************************************/
+
+void mapfileFS_ll_expire(int mapfile_id)
+{
+	char name[32];
+	int len;
+
+	if (!mapfileFS_ll_ch)
+		return;
+
+	fuse_lowlevel_notify_inval_inode(mapfileFS_ll_ch, MAPFILEFS_INO(mapfile_id), 0, 0);
+
+	len = snprintf(name, sizeof(name), "%d" MAPFILEFS_EXT, mapfile_id);
+	fuse_lowlevel_notify_inval_entry(mapfileFS_ll_ch, FUSE_ROOT_ID, name, len);
+}
+
+/*******************************************************************************
+ function called on the first request, by then the filesystem has daemonized
+*******************************************************************************/
+
+static void mapfileFS_ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+	(void) userdata;
+	(void) conn;
+
+	mapfileFS_start();
+}
+
+static void mapfileFS_ll_destroy(void *userdata)
+{
+	(void) userdata;
+
+	mapfileFS_stop();
+}
+
+static struct fuse_lowlevel_ops mapfileFS_ll_oper = {
+	.lookup		= mapfileFS_ll_lookup,
+	.getattr	= mapfileFS_ll_getattr,
+	.readdir	= mapfileFS_ll_readdir,
+	.open		= mapfileFS_ll_open,
+	.read		= mapfileFS_ll_read,
+	.release	= mapfileFS_ll_release,
+	.init		= mapfileFS_ll_init,
+	.destroy	= mapfileFS_ll_destroy,
+};
+
+/*******************************************************************************
+ function to run the low level front end, the cache must already be setup
+*******************************************************************************/
+
+int mapfileFS_ll_main(int argc, char *argv[])
+{
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	struct fuse_chan *ch;
+	struct fuse_session *se;
+	char *mountpoint;
+	int multithreaded;
+	int foreground;
+	int err = -1;
+
+	if (fuse_parse_cmdline(&args, &mountpoint, &multithreaded, &foreground) == -1)
+		return 1;
+
+	if ((ch = fuse_mount(mountpoint, &args)) != NULL) {
+		se = fuse_lowlevel_new(&args, &mapfileFS_ll_oper,
+				       sizeof(mapfileFS_ll_oper), NULL);
+		if (se != NULL) {
+			if (fuse_set_signal_handlers(se) != -1) {
+				fuse_session_add_chan(se, ch);
+				mapfileFS_ll_ch = ch;
+				fuse_daemonize(foreground);
+
+				if (multithreaded)
+					err = fuse_session_loop_mt(se);
+				else
+					err = fuse_session_loop(se);
+
+				mapfileFS_ll_ch = NULL;
+				fuse_remove_signal_handlers(se);
+				fuse_session_remove_chan(ch);
+			}
+			fuse_session_destroy(se);
+		}
+		fuse_unmount(mountpoint, ch);
+	}
+	free(mountpoint);
+	fuse_opt_free_args(&args);
+
+	return err ? 1 : 0;
+}
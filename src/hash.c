@@ -0,0 +1,456 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hash.h"
+
+#define HASH_INITIAL 16
+
+/***** grow when more than 7/8 full *****/
+
+#define HASH_FULL(t) ((t)->length + 1 > (((t)->mask + 1) >> 3) * 7)
+
+/*******************************************************************************
+  function to get the home slot of a key, fibonacci hashing so the high bits
+  of the product are used and sequential keys are spread out
+*******************************************************************************/
+
+static inline size_t hash_home (
+    hash_table *table,
+    int key)
+{
+    return (size_t)(((uint64_t)(unsigned int)key * 0x9E3779B97F4A7C15ULL)
+                    >> table->shift);
+}
+
+/*******************************************************************************
+  functions to mark the start and end of a change for hash_find_lockless()
+*******************************************************************************/
+
+static inline void hash_change_begin (
+    hash_table *table)
+{
+    __atomic_store_n(&table->seq, table->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void hash_change_end (
+    hash_table *table)
+{
+    __atomic_store_n(&table->seq, table->seq + 1, __ATOMIC_RELEASE);
+}
+
+/*******************************************************************************
+  function to fill in a slot, each member is stored whole so a lockless
+  reader never sees half of one
+*******************************************************************************/
+
+static inline void hash_slot_store (
+    hash_slot *slot,
+    int key,
+    unsigned int psl,
+    void *data)
+{
+    __atomic_store_n(&slot->key, key, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->psl, psl, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->data, data, __ATOMIC_RELAXED);
+}
+
+/*******************************************************************************
+  function to find the data of a key in a hash table
+
+  args:
+        table the table to find the key in
+        key   the key to look for
+
+  returns:
+        the data of the key
+        NULL if the key is not found
+*******************************************************************************/
+
+void *hash_find (
+    hash_table *table,
+    int key)
+{
+    hash_slot *slot;
+    size_t i;
+    unsigned int psl;
+
+    if (!table->slots)
+        return NULL;
+
+    /***** robin hood, stop as soon as we are further than the key could be *****/
+
+    for (i = hash_home(table, key), psl = 1 ;; i = (i + 1) & table->mask, psl++) {
+        slot = table->slots + i;
+
+        if (slot->psl < psl)
+            return NULL;
+
+        if (slot->key == key)
+            return slot->data;
+    }
+}
+
+/*******************************************************************************
+  function to find the data of a key in a hash table while it may be changed
+
+  args:
+        table the table to find the key in
+        key   the key to look for
+
+  returns:
+        the data of the key
+        NULL if the key is not found
+
+  note:
+        a delete shifts keys back a slot, a probe that races one may miss
+        the key it is after, seq tells it to look again. the probe always
+        ends, every psl it reads is one that was stored
+*******************************************************************************/
+
+void *hash_find_lockless (
+    hash_table *table,
+    int key)
+{
+    hash_slot *slot;
+    size_t i;
+    unsigned int psl;
+    unsigned int seq;
+    void *result;
+
+    if (!table->slots)
+        return NULL;
+
+    do {
+        while ((seq = __atomic_load_n(&table->seq, __ATOMIC_ACQUIRE)) & 1);
+
+        result = NULL;
+
+        for (i = hash_home(table, key), psl = 1 ;;
+             i = (i + 1) & table->mask, psl++) {
+            slot = table->slots + i;
+
+            if (__atomic_load_n(&slot->psl, __ATOMIC_RELAXED) < psl)
+                break;
+
+            if (__atomic_load_n(&slot->key, __ATOMIC_RELAXED) == key) {
+                result = __atomic_load_n(&slot->data, __ATOMIC_RELAXED);
+                break;
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    } while (__atomic_load_n(&table->seq, __ATOMIC_RELAXED) != seq);
+
+    return result;
+}
+
+/*******************************************************************************
+  function to place a key in the slots, the table must have room
+*******************************************************************************/
+
+static void hash_place (
+    hash_table *table,
+    int key,
+    void *data)
+{
+    hash_slot cur;
+    hash_slot tmp;
+    hash_slot *slot;
+    size_t i;
+
+    cur.key = key;
+    cur.psl = 1;
+    cur.data = data;
+
+    for (i = hash_home(table, key) ;; i = (i + 1) & table->mask, cur.psl++) {
+        slot = table->slots + i;
+
+        /***** empty slot *****/
+
+        if (!slot->psl) {
+            hash_slot_store(slot, cur.key, cur.psl, cur.data);
+            break;
+        }
+
+        /***** take from the rich, swap with a key closer to home *****/
+
+        if (slot->psl < cur.psl) {
+            tmp = *slot;
+            hash_slot_store(slot, cur.key, cur.psl, cur.data);
+            cur = tmp;
+        }
+    }
+
+    table->length++;
+}
+
+/*******************************************************************************
+  function to double the number of slots in a hash table
+
+  returns:
+        0 on success
+        -1 if malloc fails
+*******************************************************************************/
+
+static int hash_grow (
+    hash_table *table)
+{
+    hash_slot *old = table->slots;
+    size_t oldsize = old ? table->mask + 1 : 0;
+    size_t size = old ? oldsize * 2 : HASH_INITIAL;
+    unsigned int bits;
+    size_t i;
+
+    if (!(table->slots = calloc(size, sizeof(hash_slot)))) {
+        table->slots = old;
+        return -1;
+    }
+
+    for (bits = 0; ((size_t)1 << bits) < size; bits++);
+
+    table->mask = size - 1;
+    table->shift = 64 - bits;
+    table->length = 0;
+
+    for (i = 0; i < oldsize; i++) {
+        if (old[i].psl)
+            hash_place(table, old[i].key, old[i].data);
+    }
+
+    free(old);
+
+    return 0;
+}
+
+/*******************************************************************************
+  function to check if a key can be added to a hash table without it growing
+
+  args:
+        table the table
+
+  returns:
+        non zero if hash_insert() will not realloc the slots
+*******************************************************************************/
+
+int hash_room (
+    hash_table *table)
+{
+    return table->slots && !HASH_FULL(table);
+}
+
+/*******************************************************************************
+  function to add a key to a hash table
+
+  args:
+        table the table to add the key to
+        key   the key, it must not already be in the table
+        data  the data the key is to hold
+
+  returns:
+        0 on success
+        -1 if malloc fails
+*******************************************************************************/
+
+int hash_insert (
+    hash_table *table,
+    int key,
+    void *data)
+{
+    if (!hash_room(table) && hash_grow(table))
+        return -1;
+
+    hash_change_begin(table);
+    hash_place(table, key, data);
+    hash_change_end(table);
+
+    return 0;
+}
+
+/*******************************************************************************
+  function to delete a key from a hash table
+
+  args:
+        table the table to delete the key from
+        key   the key to delete
+
+  returns:
+        the data the key held
+        NULL if the key is not found
+*******************************************************************************/
+
+void *hash_delete (
+    hash_table *table,
+    int key)
+{
+    hash_slot *slot;
+    hash_slot *next;
+    size_t i;
+    unsigned int psl;
+    void *result;
+
+    if (!table->slots)
+        return NULL;
+
+    for (i = hash_home(table, key), psl = 1 ;; i = (i + 1) & table->mask, psl++) {
+        slot = table->slots + i;
+
+        if (slot->psl < psl)
+            return NULL;
+
+        if (slot->key == key)
+            break;
+    }
+
+    result = slot->data;
+
+    hash_change_begin(table);
+
+    /***** shift the following keys back so there is no tombstone *****/
+
+    for (;;) {
+        next = table->slots + ((i + 1) & table->mask);
+
+        if (next->psl <= 1)
+            break;
+
+        hash_slot_store(slot, next->key, next->psl - 1, next->data);
+        slot = next;
+        i = (i + 1) & table->mask;
+    }
+
+    hash_slot_store(slot, slot->key, 0, NULL);
+    table->length--;
+
+    hash_change_end(table);
+
+    return result;
+}
+
+/*******************************************************************************
+  function to copy a hash table, the data is not copied
+
+  args:
+        dest  the table to copy to, it must be empty
+        src   the table to copy
+
+  returns:
+        0 on success
+        -1 if malloc fails
+*******************************************************************************/
+
+int hash_copy (
+    hash_table *dest,
+    hash_table *src)
+{
+    *dest = *src;
+
+    if (!src->slots)
+        return 0;
+
+    if (!(dest->slots = malloc((src->mask + 1) * sizeof(hash_slot)))) {
+        dest->slots = NULL;
+        dest->length = 0;
+        return -1;
+    }
+
+    memcpy(dest->slots, src->slots, (src->mask + 1) * sizeof(hash_slot));
+
+    return 0;
+}
+
+/*******************************************************************************
+  function to iterate the keys of a hash table
+
+  args:
+        table the table
+        func  the function to pass each key to for processing
+        extra extra data to pass to/from the proccessing function
+
+  returns:
+        the non null returned from the proccessing function that stops the
+        iteration
+        NULL if the end of the table was reached
+*******************************************************************************/
+
+void *hash_iterate (
+    hash_table *table,
+    hash_iterate_func func,
+    void *extra)
+{
+    size_t i;
+    void *result;
+
+    if (!table->slots)
+        return NULL;
+
+    for (i = 0; i <= table->mask; i++) {
+        if (table->slots[i].psl &&
+            (result = func(table, table->slots[i].key, table->slots[i].data, extra)))
+            return result;
+    }
+
+    return NULL;
+}
+
+/*******************************************************************************
+  function to delete all the keys in a hash table and free the slots
+
+  args:
+        table the table to delete all the keys in
+
+  returns:
+        nothing
+*******************************************************************************/
+
+void hash_delete_all (
+    hash_table *table)
+{
+    size_t i;
+
+    if (table->slots && table->free) {
+        for (i = 0; i <= table->mask; i++) {
+            if (table->slots[i].psl)
+                table->free(table->slots[i].data);
+        }
+    }
+
+    free(table->slots);
+    table->slots = NULL;
+    table->length = 0;
+    table->mask = 0;
+    table->shift = 0;
+}
+
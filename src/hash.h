@@ -0,0 +1,233 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef hash_h
+#define hash_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*****************************************************************************//**
+  structure for a slot in an integer keyed hash table
+
+ @param	key     the key the slot holds
+ @param	psl     distance from the slot the key hashes to plus 1, 0 if empty
+ @param	data    the data the slot holds
+*******************************************************************************/
+
+typedef struct {
+    int key;
+    unsigned int psl;
+    void *data;
+} hash_slot;
+
+/*****************************************************************************//**
+  type of a function to pass to the delete functions to free the data
+
+ @param	data  pointer to the data to be free'ed
+
+ @return	nothing
+*******************************************************************************/
+
+typedef void (*hash_data_free_func) (
+    void *data);
+
+/*****************************************************************************//**
+  structure for an open addressing robin hood hash table with integer keys
+
+ @param	length  the number of keys in the table
+ @param	mask    number of slots minus 1, the number of slots is a power of 2
+ @param	shift   amount to shift the hash down to get a slot
+ @param	slots   the slots
+ @param	free    function to free the data contained in the slots
+ @param	seq     count of changes, bumped before and after each insert or
+                delete so it is odd while one is in progress
+
+  note:
+        a lookup is a multiply, a shift and a short linear probe, there is no
+        indirect call and no pointer chasing and keys that arrive in order
+        spread out the same as random ones
+*******************************************************************************/
+
+typedef struct {
+    size_t length;
+    size_t mask;
+    unsigned int shift;
+    hash_slot *slots;
+    hash_data_free_func free;
+    unsigned int seq;
+} hash_table;
+
+/*****************************************************************************//**
+  type of function to be passed to the iterate function
+
+ @param	table the table being iterated
+ @param	key   the key of the current slot
+ @param	data  the data the current slot holds
+ @param	extra the extra pointer passed to the iterate function
+
+ @return	null to continue the iterate loop
+          non null that stops the iterate loop and is returned by the iterate
+          function
+
+  note:
+        the table must not be changed by this function
+*******************************************************************************/
+
+typedef void *(*hash_iterate_func) (
+    hash_table *table,
+    int key,
+    void *data,
+    void *extra);
+
+/*****************************************************************************//**
+  function to find the data of a key in a hash table
+
+ @param	table the table to find the key in
+ @param	key   the key to look for
+
+ @return	the data of the key
+ @return	NULL if the key is not found
+*******************************************************************************/
+
+void *hash_find (
+    hash_table *table,
+    int key);
+
+/*****************************************************************************//**
+  function to find the data of a key in a hash table while it may be changed
+
+ @param	table the table to find the key in
+ @param	key   the key to look for
+
+ @return	the data of the key
+ @return	NULL if the key is not found
+
+  note:
+        the lookup is tried again if an insert or delete raced it, so it
+        takes no lock and writes nothing. the table must not grow while it
+        is read like this, see hash_room()
+*******************************************************************************/
+
+void *hash_find_lockless (
+    hash_table *table,
+    int key);
+
+/*****************************************************************************//**
+  function to check if a key can be added to a hash table without it growing
+
+ @param	table the table
+
+ @return	non zero if hash_insert() will not realloc the slots
+
+  note:
+        a table read with hash_find_lockless() is only inserted into while
+        there is room, otherwise the key goes in a copy that replaces it
+*******************************************************************************/
+
+int hash_room (
+    hash_table *table);
+
+/*****************************************************************************//**
+  function to add a key to a hash table
+
+ @param	table the table to add the key to
+ @param	key   the key, it must not already be in the table
+ @param	data  the data the key is to hold
+
+ @return	0 on success
+ @return	-1 if malloc fails
+*******************************************************************************/
+
+int hash_insert (
+    hash_table *table,
+    int key,
+    void *data);
+
+/*****************************************************************************//**
+  function to delete a key from a hash table
+
+ @param	table the table to delete the key from
+ @param	key   the key to delete
+
+ @return	the data the key held
+ @return	NULL if the key is not found
+*******************************************************************************/
+
+void *hash_delete (
+    hash_table *table,
+    int key);
+
+/*****************************************************************************//**
+  function to copy a hash table, the data is not copied
+
+ @param	dest  the table to copy to, it must be empty
+ @param	src   the table to copy
+
+ @return	0 on success
+ @return	-1 if malloc fails
+
+  note:
+        dest gets the free function of src, clear it if the data belongs to
+        src
+*******************************************************************************/
+
+int hash_copy (
+    hash_table *dest,
+    hash_table *src);
+
+/*****************************************************************************//**
+  function to iterate the keys of a hash table
+
+ @param	table the table
+ @param	func  the function to pass each key to for processing
+ @param	extra extra data to pass to/from the proccessing function
+
+ @return	the non null returned from the proccessing function that stops the
+          iteration
+          NULL if the end of the table was reached
+*******************************************************************************/
+
+void *hash_iterate (
+    hash_table *table,
+    hash_iterate_func func,
+    void *extra);
+
+/*****************************************************************************//**
+  function to delete all the keys in a hash table and free the slots
+
+ @param	table the table to delete all the keys in
+
+ @return	nothing
+*******************************************************************************/
+
+void hash_delete_all (
+    hash_table *table);
+
+#endif
@@ -0,0 +1,700 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_LIBPQ
+#include <libpq-fe.h>
+#endif
+
+#include "hash.h"
+#include "DLList.h"
+#include "timer.h"
+#include "sketch.h"
+#include "buffer.h"
+#include "frag.h"
+#include "cache.h"
+#include "bloom.h"
+#include "dir.h"
+#include "deps.h"
+#include "rows.h"
+#include "listen.h"
+
+/***** milliseconds between attempts to get a lost source back *****/
+
+#define LISTEN_RETRY_MS 1000
+
+/***** bytes of a fifo read at a time *****/
+
+#define LISTEN_LINE_MAX 4096
+
+typedef struct listen_source listen_source;
+
+/*****************************************************************************//**
+  type of function to open a source and set its fd
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+typedef int (*listen_open_func) (
+    listen_source *src);
+
+/*****************************************************************************//**
+  type of function to read what is ready on a source without blocking
+
+ @return	0 on success
+ @return	a negative errno if the source was lost
+*******************************************************************************/
+
+typedef int (*listen_read_func) (
+    listen_source *src);
+
+/*****************************************************************************//**
+  type of function to close a source and set its fd to -1
+*******************************************************************************/
+
+typedef void (*listen_close_func) (
+    listen_source *src);
+
+/*****************************************************************************//**
+  structure for a source of notifications
+
+ @param	fd      the fd to poll, -1 while the source is lost
+ @param	target  the path or conninfo of the source
+ @param	open    function to open the source
+ @param	read    function to read the source
+ @param	close   function to close the source
+ @param	conn    the db connection of a pg source
+ @param	line    the digits a fifo read ended in, finished by the next read
+ @param	used    number of bytes in line
+*******************************************************************************/
+
+struct listen_source {
+    int fd;
+    char *target;
+    listen_open_func open;
+    listen_read_func read;
+    listen_close_func close;
+    void *conn;
+    char line[LISTEN_LINE_MAX];
+    size_t used;
+};
+
+static listen_source listen_src = { .fd = -1 };
+
+static listen_stats listen_counters = {0};
+
+static pthread_t listen_thread;
+static int listen_running = 0;
+static int listen_wake[2] = { -1, -1 };
+static unsigned long listen_debounce = 0;
+
+/***** the burst being held, only touched by the listener thread *****/
+
+static hash_table listen_pending = {0};
+static int listen_overflow = 0;
+static int listen_dir = 0;
+static unsigned long listen_first = 0;
+static unsigned long listen_last = 0;
+
+/*****************************************************************************//**
+  function to get a monotonic time in microseconds
+*******************************************************************************/
+
+static unsigned long listen_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/*****************************************************************************//**
+  function to add a mapfile_id to the burst being held
+*******************************************************************************/
+
+static void listen_add (
+    int mapfile_id)
+{
+    __sync_fetch_and_add(&listen_counters.ids, 1);
+
+    if (!listen_pending.length && !listen_overflow)
+        listen_first = listen_now();
+
+    if (hash_find(&listen_pending, mapfile_id))
+        return;
+
+    /***** if the burst can not be held expire everything at the flush *****/
+
+    if (hash_insert(&listen_pending, mapfile_id, &listen_pending))
+        listen_overflow = 1;
+}
+
+/*****************************************************************************//**
+  function to add a mapfile rendered from a changed row to the burst
+*******************************************************************************/
+
+static void listen_add_dep (
+    void *extra,
+    int mapfile_id)
+{
+    (void) extra;
+
+    listen_add(mapfile_id);
+}
+
+/*****************************************************************************//**
+  function to handle one token of a payload, either a mapfile_id, a
+  mapfile added or deleted as dir:mapfile_id or a changed row as
+  table:row_id
+*******************************************************************************/
+
+static void listen_token (
+    const char *token,
+    size_t length)
+{
+    const char *colon = memchr(token, ':', length);
+    const char *digits = colon ? colon + 1 : token;
+    size_t i, ndigits = length - (digits - token);
+    long id = 0;
+    int table = -1;
+    int dir;
+
+    dir = colon && (size_t)(colon - token) == strlen(LISTEN_DIR) &&
+          !memcmp(token, LISTEN_DIR, colon - token);
+
+    if (colon && !dir && (table = deps_table_id(token, colon - token)) < 0)
+        return;
+
+    if (!ndigits || ndigits > 10)
+        return;
+
+    for (i = 0; i < ndigits; i++) {
+        if (digits[i] < '0' || digits[i] > '9')
+            return;
+        id = id * 10 + digits[i] - '0';
+    }
+
+    if (id > 0x7fffffff)
+        return;
+
+    /***** the index is only read again for a mapfile added or deleted, a
+           plain id it does not have was added by an older trigger *****/
+
+    if (!colon || dir) {
+        listen_add(id);
+        rows_expire(ROWS_MAPFILE, id);
+        if (dir || dir_check(id))
+            listen_dir = 1;
+    }
+    else {
+        __sync_fetch_and_add(&listen_counters.rows, 1);
+        frag_expire(table, id);
+        rows_expire(table, id);
+        deps_find(table, id, listen_add_dep, NULL);
+    }
+}
+
+#define LISTEN_TOKEN_CHAR(c) (((c) >= '0' && (c) <= '9') || \
+                              ((c) >= 'a' && (c) <= 'z') || (c) == ':')
+
+/*****************************************************************************//**
+  function to parse the tokens out of a payload
+
+ @param	payload the payload, tokens are separated by anything that is not a
+                lower case letter, a digit or a :
+ @param	length  the number of bytes in payload
+ @param	partial non zero if the payload may end part way through a token
+
+ @return	the number of bytes of an unfinished token left at the start of
+          payload when partial is set, 0 otherwise
+*******************************************************************************/
+
+static size_t listen_parse (
+    char *payload,
+    size_t length,
+    int partial)
+{
+    size_t i, start = 0;
+
+    for (i = 0; i < length; i++) {
+        if (LISTEN_TOKEN_CHAR(payload[i]))
+            continue;
+
+        if (i > start)
+            listen_token(payload + start, i - start);
+
+        start = i + 1;
+    }
+
+    if (start >= length)
+        return 0;
+
+    /***** the rest of the token is in the next read *****/
+
+    if (partial) {
+        memmove(payload, payload + start, length - start);
+        return length - start;
+    }
+
+    listen_token(payload + start, length - start);
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to open a fifo source
+*******************************************************************************/
+
+static int listen_fifo_open (
+    listen_source *src)
+{
+    if (mkfifo(src->target, 0600) && errno != EEXIST)
+        return -errno;
+
+    /***** read write so the fifo does not read eof each time the last
+           writer closes it *****/
+
+    if ((src->fd = open(src->target, O_RDWR | O_NONBLOCK)) < 0)
+        return -errno;
+
+    src->used = 0;
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to read a fifo source, each line is one notification
+*******************************************************************************/
+
+static int listen_fifo_read (
+    listen_source *src)
+{
+    ssize_t got;
+    size_t i;
+
+    for (;;) {
+        got = read(src->fd, src->line + src->used,
+                   sizeof(src->line) - src->used);
+
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN ? 0 : -errno;
+        }
+
+        if (!got)
+            return 0;
+
+        for (i = src->used; i < src->used + got; i++) {
+            if (src->line[i] == '\n')
+                __sync_fetch_and_add(&listen_counters.events, 1);
+        }
+
+        src->used = listen_parse(src->line, src->used + got, 1);
+
+        /***** a token that fills the buffer is nothing we know *****/
+
+        if (src->used == sizeof(src->line))
+            src->used = 0;
+    }
+}
+
+/*****************************************************************************//**
+  function to close a fifo source
+*******************************************************************************/
+
+static void listen_fifo_close (
+    listen_source *src)
+{
+    close(src->fd);
+    src->fd = -1;
+}
+
+#ifdef HAVE_LIBPQ
+
+/*****************************************************************************//**
+  function to open a pg source and LISTEN on the channel
+*******************************************************************************/
+
+static int listen_pg_open (
+    listen_source *src)
+{
+    PGconn *conn;
+    PGresult *res;
+
+    if (!(conn = PQconnectdb(src->target)))
+        return -ENOMEM;
+
+    if (PQstatus(conn) != CONNECTION_OK) {
+        fprintf(stderr, "mapfileFS: listen: %s", PQerrorMessage(conn));
+        PQfinish(conn);
+        return -ECONNREFUSED;
+    }
+
+    res = PQexec(conn, "LISTEN " LISTEN_CHANNEL);
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        fprintf(stderr, "mapfileFS: listen: %s", PQerrorMessage(conn));
+        PQclear(res);
+        PQfinish(conn);
+        return -EIO;
+    }
+    PQclear(res);
+
+    if (PQsetnonblocking(conn, 1)) {
+        PQfinish(conn);
+        return -EIO;
+    }
+
+    src->conn = conn;
+    src->fd = PQsocket(conn);
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to read the notifications waiting on a pg source
+*******************************************************************************/
+
+static int listen_pg_read (
+    listen_source *src)
+{
+    PGconn *conn = src->conn;
+    PGnotify *notify;
+
+    if (!PQconsumeInput(conn) || PQstatus(conn) != CONNECTION_OK)
+        return -EIO;
+
+    while ((notify = PQnotifies(conn))) {
+        __sync_fetch_and_add(&listen_counters.events, 1);
+        listen_parse(notify->extra, strlen(notify->extra), 0);
+        PQfreemem(notify);
+    }
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to close a pg source
+*******************************************************************************/
+
+static void listen_pg_close (
+    listen_source *src)
+{
+    PQfinish(src->conn);
+    src->conn = NULL;
+    src->fd = -1;
+}
+
+#endif
+
+/*****************************************************************************//**
+  function to add a held key to an id list for the flush
+*******************************************************************************/
+
+static void *listen_collect (
+    hash_table *table,
+    int key,
+    void *data,
+    void *extra)
+{
+    int **ids = extra;
+
+    (void) table;
+    (void) data;
+
+    *(*ids)++ = key;
+
+    return NULL;
+}
+
+/*****************************************************************************//**
+  function to expire the burst being held
+*******************************************************************************/
+
+static void listen_flush (void)
+{
+    int *ids = NULL;
+    int *end;
+    size_t length = listen_pending.length;
+    unsigned long took;
+
+    if (!length && !listen_overflow)
+        return;
+
+    /***** read on the listener thread, lookups use the old index till it
+           is read, if it can not be then they read it themselves *****/
+
+    if (listen_dir && dir_reload())
+        dir_expire();
+    listen_dir = 0;
+
+    if (!listen_overflow && !(ids = malloc(length * sizeof(int))))
+        listen_overflow = 1;
+
+    if (listen_overflow)
+        cache_expire_all();
+    else {
+        end = ids;
+        hash_iterate(&listen_pending, listen_collect, &end);
+        cache_expire_many(ids, length);
+    }
+
+    took = listen_now() - listen_first;
+
+    __sync_fetch_and_add(&listen_counters.flushes, 1);
+    __sync_fetch_and_add(&listen_counters.expired, length);
+    __sync_fetch_and_add(&listen_counters.latency_sum, took);
+    if (took > listen_counters.latency_max)
+        listen_counters.latency_max = took;
+
+    free(ids);
+    hash_delete_all(&listen_pending);
+    listen_overflow = 0;
+}
+
+/*****************************************************************************//**
+  function run by the listener thread
+*******************************************************************************/
+
+static void *listen_main (
+    void *arg)
+{
+    struct pollfd fds[2];
+    unsigned long now, due;
+    int timeout;
+
+    (void) arg;
+
+    fds[0].fd = listen_wake[0];
+    fds[0].events = POLLIN;
+    fds[1].events = POLLIN;
+
+    for (;;) {
+
+        /***** sleep until a notification, the end of the debounce or the
+               next try to get the source back *****/
+
+        now = listen_now();
+
+        if (listen_pending.length || listen_overflow) {
+            due = listen_last + listen_debounce;
+            if (due > listen_first + listen_debounce * LISTEN_MAX_HOLD)
+                due = listen_first + listen_debounce * LISTEN_MAX_HOLD;
+            timeout = due > now ? (int)((due - now + 999) / 1000) : 0;
+        }
+        else
+            timeout = -1;
+
+        if (listen_src.fd < 0 && (timeout < 0 || timeout > LISTEN_RETRY_MS))
+            timeout = LISTEN_RETRY_MS;
+
+        fds[1].fd = listen_src.fd;
+        fds[1].revents = 0;
+
+        if (poll(fds, listen_src.fd < 0 ? 1 : 2, timeout) < 0 &&
+            errno != EINTR)
+            break;
+
+        if (fds[0].revents)
+            break;
+
+        if (fds[1].revents) {
+            if (listen_src.read(&listen_src)) {
+                fprintf(stderr, "mapfileFS: listen: lost %s\n",
+                        listen_src.target);
+                listen_src.close(&listen_src);
+            }
+            listen_last = listen_now();
+        }
+
+        /***** changes made while the source was lost were never seen, that
+               includes mapfiles added, with no max age the index would
+               never have them *****/
+
+        if (listen_src.fd < 0 && !listen_src.open(&listen_src)) {
+            __sync_fetch_and_add(&listen_counters.reconnects, 1);
+            rows_expire_all();
+            frag_expire_all();
+            if (!listen_pending.length)
+                listen_first = listen_now();
+            listen_overflow = 1;
+            listen_dir = 1;
+        }
+
+        now = listen_now();
+
+        if ((listen_pending.length || listen_overflow) &&
+            (now >= listen_last + listen_debounce ||
+             now >= listen_first + listen_debounce * LISTEN_MAX_HOLD))
+            listen_flush();
+    }
+
+    listen_flush();
+
+    return NULL;
+}
+
+/*****************************************************************************//**
+  function to start the thread that expires caches on change notifications
+
+ @param	source      where the notifications come from
+                    fifo:PATH   a fifo to write payloads to, one per line,
+                                created if missing, a stand in for the db
+                    pg:CONNINFO a postgresql LISTEN on LISTEN_CHANNEL, only
+                                if built with HAVE_LIBPQ
+ @param	debounce_ms milliseconds a burst must be quiet before it is flushed
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        call this once the filesystem has daemonized. every mapfile_id in a
+        burst is expired once however many times it was notified, and the
+        whole burst is expired with one write lock per shard
+*******************************************************************************/
+
+int listen_start (
+    const char *source,
+    unsigned int debounce_ms)
+{
+    int res;
+
+    if (listen_running)
+        return -EBUSY;
+
+    if (strncmp(source, "fifo:", 5) == 0) {
+        listen_src.open = listen_fifo_open;
+        listen_src.read = listen_fifo_read;
+        listen_src.close = listen_fifo_close;
+        source += 5;
+    }
+#ifdef HAVE_LIBPQ
+    else if (strncmp(source, "pg:", 3) == 0) {
+        listen_src.open = listen_pg_open;
+        listen_src.read = listen_pg_read;
+        listen_src.close = listen_pg_close;
+        source += 3;
+    }
+#endif
+    else
+        return -EINVAL;
+
+    if (!(listen_src.target = strdup(source)))
+        return -ENOMEM;
+
+    listen_debounce = debounce_ms * 1000UL;
+
+    if ((res = listen_src.open(&listen_src)))
+        goto fail;
+
+    if (pipe(listen_wake)) {
+        res = -errno;
+        listen_src.close(&listen_src);
+        goto fail;
+    }
+
+    if ((res = -pthread_create(&listen_thread, NULL, listen_main, NULL))) {
+        close(listen_wake[0]);
+        close(listen_wake[1]);
+        listen_src.close(&listen_src);
+        goto fail;
+    }
+
+    listen_running = 1;
+
+    return 0;
+
+fail:
+    free(listen_src.target);
+    listen_src.target = NULL;
+
+    return res;
+}
+
+/*****************************************************************************//**
+  function to stop the listener, a burst still held is flushed first
+
+ @return	nothing
+*******************************************************************************/
+
+void listen_stop (void)
+{
+    if (!listen_running)
+        return;
+
+    listen_running = 0;
+
+    if (write(listen_wake[1], "", 1) != 1)
+        pthread_cancel(listen_thread);
+    pthread_join(listen_thread, NULL);
+
+    close(listen_wake[0]);
+    close(listen_wake[1]);
+
+    if (listen_src.fd >= 0)
+        listen_src.close(&listen_src);
+
+    free(listen_src.target);
+    listen_src.target = NULL;
+}
+
+/*****************************************************************************//**
+  function to get the counters of the listener
+
+ @param	stats   filled in with the counters
+
+ @return	nothing
+*******************************************************************************/
+
+void listen_get_stats (
+    listen_stats *stats)
+{
+    stats->events = listen_counters.events;
+    stats->ids = listen_counters.ids;
+    stats->rows = listen_counters.rows;
+    stats->flushes = listen_counters.flushes;
+    stats->expired = listen_counters.expired;
+    stats->latency_sum = listen_counters.latency_sum;
+    stats->latency_max = listen_counters.latency_max;
+    stats->reconnects = listen_counters.reconnects;
+}
+
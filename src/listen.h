@@ -0,0 +1,124 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef listen_h
+#define listen_h
+
+/***** the channel the db triggers notify on, the payload is one or more
+       mapfile_ids or changed rows as table:row_id, for example
+       perform pg_notify('mapfilefs', NEW.mapfile_id::text);
+       perform pg_notify('mapfilefs', 'symbol:' || NEW.symbol_id);
+       a changed row expires every mapfile rendered from it, see deps.h *****/
+
+#define LISTEN_CHANNEL "mapfilefs"
+
+/***** a mapfile added or deleted is sent as dir:mapfile_id, for example
+       perform pg_notify('mapfilefs', 'dir:' || OLD.mapfile_id);
+       the directory index is read again once per flush that had one. a
+       plain mapfile_id the index does not have counts as one too *****/
+
+#define LISTEN_DIR "dir"
+
+/***** a burst is flushed once it has been quiet for the debounce or has been
+       held this many debounces, whichever comes first *****/
+
+#define LISTEN_MAX_HOLD 10
+
+/*****************************************************************************//**
+  structure for the counters of the listener
+
+ @param	events      number of notifications received
+ @param	ids         number of mapfile_ids received or found from changed
+                    rows, before duplicates in a burst are dropped
+ @param	rows        number of changed rows received
+ @param	flushes     number of bursts flushed to the cache
+ @param	expired     number of mapfile_ids expired, after duplicates in a
+                    burst are dropped
+ @param	latency_sum sum over the flushes of the microseconds from the first
+                    notification of the burst to the cache being expired
+ @param	latency_max the most microseconds any flush took by that measure
+ @param	reconnects  number of times the source was lost and every cache was
+                    expired and the index read again in case changes were
+                    missed
+*******************************************************************************/
+
+typedef struct {
+    unsigned long events;
+    unsigned long ids;
+    unsigned long rows;
+    unsigned long flushes;
+    unsigned long expired;
+    unsigned long latency_sum;
+    unsigned long latency_max;
+    unsigned long reconnects;
+} listen_stats;
+
+/*****************************************************************************//**
+  function to start the thread that expires caches on change notifications
+
+ @param	source      where the notifications come from
+                    fifo:PATH   a fifo to write payloads to, one per line,
+                                created if missing, a stand in for the db
+                    pg:CONNINFO a postgresql LISTEN on LISTEN_CHANNEL, only
+                                if built with HAVE_LIBPQ
+ @param	debounce_ms milliseconds a burst must be quiet before it is flushed
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        call this once the filesystem has daemonized. every mapfile_id in a
+        burst is expired once however many times it was notified, and the
+        whole burst is expired with one write lock per shard
+*******************************************************************************/
+
+int listen_start (
+    const char *source,
+    unsigned int debounce_ms);
+
+/*****************************************************************************//**
+  function to stop the listener, a burst still held is flushed first
+
+ @return	nothing
+*******************************************************************************/
+
+void listen_stop (void);
+
+/*****************************************************************************//**
+  function to get the counters of the listener
+
+ @param	stats   filled in with the counters
+
+ @return	nothing
+*******************************************************************************/
+
+void listen_get_stats (
+    listen_stats *stats);
+
+#endif
@@ -2,8 +2,22 @@
 
 
 
-int do_map(buffer *buf) {
+int do_map(buffer *buf, int mapfile_id) {
 
+    time each query with stats_now() and stats_observe(STATS_DB_FETCH, start)
+
+    get data with rows_get(ROWS_MAPFILE, mapfile_id, fetch_map, &err) and
+    rows_release() it at the end, the do_layer, do_class, do_symbol, do_legend,
+    do_scalebar and do_web renders get their row with rows_get() of their
+    DEPS_ table the same way. a row still cached is not queried again
+
+    FIXME fetch_map(buf, table, row_id)
+        select * from mapfile where mapfile_id = row_id
+        select layer_id from layer where mapfile_id = row_id order by ord
+        select symbol_id from symbol where mapfile_id = row_id
+        buffer_write() the row struct and the id arrays into buf
+    FIXME fetch_layer, the layer row and its class_ids, and one fetch for
+        each of the other tables
 
     buffer_printf(buf, "MAP\n" );
     buf->indent++;
@@ -28,7 +42,15 @@ CONFIG [key] [value]
     //dbuffer_printf(buf, "INTERLACE %s\n", indent, data.interlace );
 
 do layer
+    for each layer row
+        frag_add(buf, mapfile_id, DEPS_LAYER, layer_id, do_layer);
+        buf->indent++;
+        for each class row of the layer
+            frag_add(buf, mapfile_id, DEPS_CLASS, class_id, do_class);
+        buf->indent--;
+        buffer_printf(buf, "END\n" );
 do legend
+    frag_add(buf, mapfile_id, DEPS_LEGEND, legend_id, do_legend);
     buffer_printf(buf, "MAXSIZE %s\n", indent, data.maxsize );
     buffer_printf(buf, "NAME %s\n", indent, data.name );
 
@@ -40,6 +62,7 @@ do reference
     buffer_printf(buf, "SCALEDENOM %s\n", indent, data.scaledenom );
 
 do scalebar
+    frag_add(buf, mapfile_id, DEPS_SCALEBAR, scalebar_id, do_scalebar);
 
     buffer_printf(buf, "SHAPEPATH %s\n", indent, data.shapepath );
     buffer_printf(buf, "SIZE %s\n", indent, data.size );  // fixme array
@@ -47,12 +70,15 @@ do scalebar
     buffer_printf(buf, "SYMBOLSET %s\n", indent, data.debug );
 
 do symbol
+    for each symbol row
+        frag_add(buf, mapfile_id, DEPS_SYMBOL, symbol_id, do_symbol);
 
     buffer_printf(buf, "TEMPLATEPATTERN %s\n", indent, data.debug );
     //dbuffer_printf(buf, "TRANSPARENT %s\n", indent, data.debug );
     buffer_printf(buf, "UNITS %s\n", indent, data.units );
 
 do web
+    frag_add(buf, mapfile_id, DEPS_WEB, web_id, do_web);
 
     buf->indent--;
     buffer_printf(buf, "END\n" );
@@ -62,3 +88,21 @@ do web
 
 
 
+
+
+/*******************************************************************************
+ function to list the mapfile ids in the db for the directory index
+
+ FIXME select mapfile_id from mapfile
+*******************************************************************************/
+
+int do_list(int **ids, size_t *length) {
+    unsigned long start = stats_now();
+
+    *ids = NULL;
+    *length = 0;
+
+    stats_observe(STATS_DB_FETCH, start);
+
+    return 0;
+}
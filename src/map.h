@@ -0,0 +1,61 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef map_h
+#define map_h
+
+/*****************************************************************************//**
+  function to render a mapfile from the db
+
+ @param	buf         the buffer to render the mapfile into
+ @param	mapfile_id  the id of the mapfile in the db
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+int do_map (
+    buffer *buf,
+    int mapfile_id);
+
+/*****************************************************************************//**
+  function to list the mapfile ids in the db
+
+ @param	ids     set to a malloc'ed array of the ids
+ @param	length  set to the number of ids
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+int do_list (
+    int **ids,
+    size_t *length);
+
+#endif
@@ -0,0 +1,156 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef mapfileFS_h
+#define mapfileFS_h
+
+/***** extension of the mapfiles in the mount *****/
+
+#define MAPFILEFS_EXT ".map"
+
+/***** inode of a mapfile is its mapfile_id plus this, 1 is the root *****/
+
+#define MAPFILEFS_INO_BASE 2
+
+#define MAPFILEFS_INO(id) ((fuse_ino_t)(id) + MAPFILEFS_INO_BASE)
+#define MAPFILEFS_ID(ino) ((int)((ino) - MAPFILEFS_INO_BASE))
+
+/***** name of the file with the counters, its inode is past every mapfile *****/
+
+#define MAPFILEFS_STATS ".stats"
+#define MAPFILEFS_STATS_INO ((fuse_ino_t) 0x100000000ULL)
+
+/*****************************************************************************//**
+  function to get the mapfile id from a file name, names are <mapfile_id>.map
+
+ @param	name    the file name with no leading /
+
+ @return	the mapfile id
+ @return	-1 if the name is not a mapfile
+*******************************************************************************/
+
+int mapfileFS_name_id (
+    const char *name);
+
+/*****************************************************************************//**
+  function to render a mapfile for the cache
+
+ @param	mapfile_id  the id of the mapfile to render
+ @param	buf         the buffer to render the mapfile into
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+int mapfileFS_load (
+    int mapfile_id,
+    buffer *buf);
+
+/*****************************************************************************//**
+  function to make a version holding the counters for an open of the stats
+  file
+
+ @param	err     set to a negative errno on failure
+
+ @return	the version, cache_release() it on release
+ @return	NULL on failure
+
+  note:
+        the version is not in the cache, each open gets its own snapshot
+*******************************************************************************/
+
+cache_version *mapfileFS_stats (
+    int *err);
+
+/*****************************************************************************//**
+  function to make a bufvec for a read of a pinned version
+
+ @param	version the version pinned in fi->fh
+ @param	size    most bytes to read
+ @param	offset  offset in the file to read from
+
+ @return	the bufvec, free it once the reply is sent
+ @return	NULL if malloc fails
+
+  note:
+        the bufs point into the version and its fragments, one per piece of a
+        gather list the read covers, nothing is copied
+*******************************************************************************/
+
+struct fuse_bufvec *mapfileFS_bufvec (
+    cache_version *version,
+    size_t size,
+    off_t offset);
+
+/*****************************************************************************//**
+  function to start the background threads once the filesystem has daemonized
+
+ @return	nothing
+
+  note:
+        a thread that fails to start is reported and the filesystem runs
+        without it
+*******************************************************************************/
+
+void mapfileFS_start (void);
+
+/*****************************************************************************//**
+  function to stop the background threads and free the cache
+
+ @return	nothing
+*******************************************************************************/
+
+void mapfileFS_stop (void);
+
+/*****************************************************************************//**
+  function to run the low level fuse front end
+
+ @param	argc    the argument count with the front end option removed
+ @param	argv    the arguments with the front end option removed
+
+ @return	the exit status for main()
+*******************************************************************************/
+
+int mapfileFS_ll_main (
+    int argc,
+    char *argv[]);
+
+/*****************************************************************************//**
+  function to tell the kernel to drop the attributes, dentry and pages it holds
+  for a mapfile, passed to cache_init() when the low level front end is used
+
+ @param	mapfile_id  the id of the mapfile that expired
+
+ @return	nothing
+*******************************************************************************/
+
+void mapfileFS_ll_expire (
+    int mapfile_id);
+
+#endif
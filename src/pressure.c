@@ -0,0 +1,496 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "hash.h"
+#include "DLList.h"
+#include "epoch.h"
+#include "timer.h"
+#include "sketch.h"
+#include "buffer.h"
+#include "cache.h"
+#include "pressure.h"
+
+static pthread_t pressure_thread;
+static pthread_mutex_t pressure_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pressure_wake = PTHREAD_COND_INITIALIZER;
+static int pressure_running = 0;
+
+/***** memory.current and memory.max are NULL with no cgroup v2 *****/
+
+static char *pressure_file = NULL;
+static char *pressure_current = NULL;
+static char *pressure_max = NULL;
+
+static size_t pressure_min = 0;
+static size_t pressure_ceiling = 0;
+
+static pressure_stats pressure_counters = {0};
+
+/*****************************************************************************//**
+  function to read a small file of the cgroup or proc fs
+
+ @param	path    the file
+ @param	buf     the buffer to read into, it is nul terminated
+ @param	size    size of the buffer
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+static int pressure_read (
+    const char *path,
+    char *buf,
+    size_t size)
+{
+    ssize_t length;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return -errno;
+
+    length = read(fd, buf, size - 1);
+    close(fd);
+
+    if (length < 0)
+        return -errno;
+
+    buf[length] = '\0';
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to read how long tasks have stalled on memory
+
+ @param	total   set to the microseconds some task stalled since boot
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        the total of the some line is read rather than its averages, the
+        averages lag by seconds and the difference of two totals is exact
+        for the interval
+*******************************************************************************/
+
+static int pressure_stalled (
+    unsigned long long *total)
+{
+    char buf[256];
+    char *p;
+    int res;
+
+    if ((res = pressure_read(pressure_file, buf, sizeof(buf))))
+        return res;
+
+    if (strncmp(buf, "some ", 5) || !(p = strstr(buf, "total=")))
+        return -EINVAL;
+
+    *total = strtoull(p + 6, NULL, 10);
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to read a byte count of the cgroup
+
+ @param	path    the file, NULL if there is none
+ @param	bytes   set to the count, 0 if there is no file or it says max
+
+ @return	nothing
+*******************************************************************************/
+
+static void pressure_bytes (
+    const char *path,
+    size_t *bytes)
+{
+    char buf[64];
+
+    *bytes = 0;
+
+    if (path && !pressure_read(path, buf, sizeof(buf)) &&
+        buf[0] >= '0' && buf[0] <= '9')
+        *bytes = strtoull(buf, NULL, 10);
+}
+
+/*****************************************************************************//**
+  function to make the path of a file in a cgroup
+
+ @param	cgroup  the cgroup directory
+ @param	name    the file
+
+ @return	the path, free it with free()
+ @return	NULL if malloc fails
+*******************************************************************************/
+
+static char *pressure_path (
+    const char *cgroup,
+    const char *name)
+{
+    char *path;
+
+    if ((path = malloc(strlen(cgroup) + strlen(name) + 2)))
+        sprintf(path, "%s/%s", cgroup, name);
+
+    return path;
+}
+
+/*****************************************************************************//**
+  function to find the cgroup v2 directory this process is in
+
+ @param	dir     the buffer to write the directory to
+ @param	size    size of the buffer
+
+ @return	0 on success
+ @return	-ENOENT if the process is not in a cgroup v2 with memory.pressure
+*******************************************************************************/
+
+static int pressure_find (
+    char *dir,
+    size_t size)
+{
+    static const char *mounts[] = {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"};
+    char buf[1024];
+    char *line;
+    char *end;
+    char *path;
+    size_t i;
+
+    if (pressure_read("/proc/self/cgroup", buf, sizeof(buf)))
+        return -ENOENT;
+
+    /***** the v2 hierarchy is the line with id 0 and no controllers *****/
+
+    for (line = buf; line; line = end) {
+        if ((end = strchr(line, '\n')))
+            *end++ = '\0';
+
+        if (strncmp(line, "0::", 3))
+            continue;
+
+        for (i = 0; i < sizeof(mounts) / sizeof(mounts[0]); i++) {
+            snprintf(dir, size, "%s%s", mounts[i], line + 3);
+
+            if (!(path = pressure_path(dir, "memory.pressure")))
+                return -ENOENT;
+
+            if (!access(path, R_OK)) {
+                free(path);
+                return 0;
+            }
+
+            free(path);
+        }
+    }
+
+    return -ENOENT;
+}
+
+/*****************************************************************************//**
+  function to set a new budget and hand what was freed back to the os
+
+ @param	budget  the budget
+
+ @return	nothing
+
+  note:
+        the evicted caches are only free'ed once no reader can see them, the
+        readers are waited out first so the trim finds them free
+*******************************************************************************/
+
+static void pressure_shrink (
+    size_t budget)
+{
+    cache_set_budget(budget);
+
+    pressure_counters.budget = budget;
+    pressure_counters.shrinks++;
+
+    epoch_barrier();
+
+#ifdef __GLIBC__
+
+    /***** every arena is trimmed, not only the main one *****/
+
+    malloc_trim(0);
+    pressure_counters.trims++;
+#endif
+}
+
+/*****************************************************************************//**
+  function to size the budget by the pressure over the last interval
+
+ @param	stall   per mille of the interval tasks stalled on memory
+
+ @return	nothing
+
+  note:
+        the budget is cut by a share of itself at once, more if the cgroup
+        is over its limit by more than that, and grown back a step at a
+        time, so a burst of pressure is answered in one interval and the
+        cache does not grow straight back into it
+*******************************************************************************/
+
+static void pressure_adjust (
+    unsigned int stall)
+{
+    size_t budget = pressure_counters.budget;
+    size_t current;
+    size_t limit;
+    size_t cut;
+    size_t step;
+
+    pressure_bytes(pressure_current, &current);
+    pressure_bytes(pressure_max, &limit);
+
+    pressure_counters.stall = stall;
+    pressure_counters.current = current;
+    pressure_counters.limit = limit;
+
+    if (stall > PRESSURE_STALL_HIGH ||
+        (limit && current > limit / 100 * PRESSURE_HIGH)) {
+        cut = budget / PRESSURE_SHRINK_SHARE;
+
+        if (limit && current > limit / 100 * PRESSURE_LOW &&
+            current - limit / 100 * PRESSURE_LOW > cut)
+            cut = current - limit / 100 * PRESSURE_LOW;
+
+        if (budget > pressure_min)
+            pressure_shrink(budget > pressure_min + cut ? budget - cut :
+                                                          pressure_min);
+    }
+
+    else if (stall < PRESSURE_STALL_LOW && budget < pressure_ceiling &&
+             (!limit || current < limit / 100 * PRESSURE_LOW)) {
+        step = (pressure_ceiling - pressure_min) / PRESSURE_GROW_SHARE + 1;
+        budget = pressure_ceiling - budget > step ? budget + step :
+                                                    pressure_ceiling;
+
+        cache_set_budget(budget);
+
+        pressure_counters.budget = budget;
+        pressure_counters.grows++;
+    }
+}
+
+/*****************************************************************************//**
+  function run on the pressure thread
+*******************************************************************************/
+
+static void *pressure_main (
+    void *arg)
+{
+    struct timespec when;
+    struct timespec now;
+    struct timespec last;
+    unsigned long long total;
+    unsigned long long last_total = 0;
+    unsigned long long elapsed;
+
+    (void) arg;
+
+    clock_gettime(CLOCK_MONOTONIC, &last);
+    pressure_stalled(&last_total);
+
+    pthread_mutex_lock(&pressure_lock);
+
+    while (pressure_running) {
+        clock_gettime(CLOCK_REALTIME, &when);
+        when.tv_sec += PRESSURE_INTERVAL;
+
+        while (pressure_running &&
+               pthread_cond_timedwait(&pressure_wake, &pressure_lock,
+                                      &when) != ETIMEDOUT);
+
+        if (!pressure_running)
+            break;
+
+        pthread_mutex_unlock(&pressure_lock);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = (now.tv_sec - last.tv_sec) * 1000000ULL +
+                  (now.tv_nsec - last.tv_nsec) / 1000;
+        last = now;
+
+        if (!pressure_stalled(&total) && elapsed) {
+            pressure_adjust((total - last_total) * 1000 / elapsed);
+            last_total = total;
+        }
+
+        pthread_mutex_lock(&pressure_lock);
+    }
+
+    pthread_mutex_unlock(&pressure_lock);
+
+    return NULL;
+}
+
+/*****************************************************************************//**
+  function to free the paths of the files watched
+*******************************************************************************/
+
+static void pressure_free (void)
+{
+    free(pressure_file);
+    free(pressure_current);
+    free(pressure_max);
+    pressure_file = NULL;
+    pressure_current = NULL;
+    pressure_max = NULL;
+}
+
+/*****************************************************************************//**
+  function to start the thread that sizes the cache budget by memory pressure
+
+ @param	cgroup  the cgroup v2 directory to watch, NULL for the one this
+                process is in
+ @param	min     the budget is never shrunk below this, not 0 as a budget of
+                0 is no limit
+ @param	max     the budget is never grown above this
+ @param	budget  the budget to start from, it is clamped to min and max
+
+ @return	0 on success
+ @return	-ENOENT if there is no memory.pressure to read
+ @return	a negative errno on failure
+
+  note:
+        call this once the filesystem has daemonized. the cgroups
+        memory.pressure and memory.current are read each PRESSURE_INTERVAL,
+        with no cgroup v2 the pressure of the whole system is used
+*******************************************************************************/
+
+int pressure_start (
+    const char *cgroup,
+    size_t min,
+    size_t max,
+    size_t budget)
+{
+    unsigned long long total;
+    char dir[512];
+    int res;
+
+    if (pressure_running)
+        return -EBUSY;
+
+    if (!min || min > max)
+        return -EINVAL;
+
+    if (!cgroup && !pressure_find(dir, sizeof(dir)))
+        cgroup = dir;
+
+    /***** with no cgroup only the pressure of the whole system is known *****/
+
+    if (cgroup) {
+        if (!(pressure_file = pressure_path(cgroup, "memory.pressure")) ||
+            !(pressure_current = pressure_path(cgroup, "memory.current")) ||
+            !(pressure_max = pressure_path(cgroup, "memory.max"))) {
+            pressure_free();
+            return -ENOMEM;
+        }
+    }
+    else if (!(pressure_file = strdup("/proc/pressure/memory")))
+        return -ENOMEM;
+
+    if ((res = pressure_stalled(&total))) {
+        pressure_free();
+        return res;
+    }
+
+    if (!budget || budget > max)
+        budget = max;
+    if (budget < min)
+        budget = min;
+
+    pressure_min = min;
+    pressure_ceiling = max;
+    pressure_counters.budget = budget;
+    cache_set_budget(budget);
+
+    pressure_running = 1;
+
+    if ((res = -pthread_create(&pressure_thread, NULL, pressure_main, NULL))) {
+        pressure_running = 0;
+        pressure_free();
+    }
+
+    return res;
+}
+
+/*****************************************************************************//**
+  function to stop the memory pressure monitor
+
+ @return	nothing
+
+  note:
+        the budget is left where it was
+*******************************************************************************/
+
+void pressure_stop (void)
+{
+    if (!pressure_running)
+        return;
+
+    pthread_mutex_lock(&pressure_lock);
+    pressure_running = 0;
+    pthread_cond_signal(&pressure_wake);
+    pthread_mutex_unlock(&pressure_lock);
+
+    pthread_join(pressure_thread, NULL);
+
+    pressure_free();
+}
+
+/*****************************************************************************//**
+  function to get the stats of the memory pressure monitor
+
+ @param	stats   filled in with the stats
+
+ @return	nothing
+*******************************************************************************/
+
+void pressure_get_stats (
+    pressure_stats *stats)
+{
+    *stats = pressure_counters;
+}
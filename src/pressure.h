@@ -0,0 +1,129 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+
+#ifndef pressure_h
+#define pressure_h
+
+#include <stddef.h>
+
+/***** seconds between looks at the cgroup *****/
+
+#define PRESSURE_INTERVAL 1
+
+/***** the budget is shrunk when tasks in the cgroup stalled on memory for
+       more than this per mille of the interval, or the cgroup uses more
+       than PRESSURE_HIGH percent of its limit. it is only grown back while
+       they stalled for less than PRESSURE_STALL_LOW per mille and the
+       cgroup is under PRESSURE_LOW percent *****/
+
+#define PRESSURE_STALL_HIGH 50
+#define PRESSURE_STALL_LOW 5
+#define PRESSURE_HIGH 90
+#define PRESSURE_LOW 80
+
+/***** the budget grows back by this share of max - min each quiet
+       interval, and shrinks by at least this share of itself *****/
+
+#define PRESSURE_GROW_SHARE 16
+#define PRESSURE_SHRINK_SHARE 4
+
+/*****************************************************************************//**
+  structure for the stats of the memory pressure monitor
+
+ @param	shrinks     number of times the budget was shrunk
+ @param	grows       number of times the budget was grown
+ @param	trims       number of times free memory was handed back to the os
+ @param	budget      the budget of the cache now
+ @param	stall       per mille of the last interval tasks in the cgroup
+                    stalled on memory
+ @param	current     bytes the cgroup used at the last look, 0 if not known
+ @param	limit       the memory limit of the cgroup, 0 if it has none
+*******************************************************************************/
+
+typedef struct {
+    unsigned long shrinks;
+    unsigned long grows;
+    unsigned long trims;
+    size_t budget;
+    unsigned int stall;
+    size_t current;
+    size_t limit;
+} pressure_stats;
+
+/*****************************************************************************//**
+  function to start the thread that sizes the cache budget by memory pressure
+
+ @param	cgroup  the cgroup v2 directory to watch, NULL for the one this
+                process is in
+ @param	min     the budget is never shrunk below this, not 0 as a budget of
+                0 is no limit
+ @param	max     the budget is never grown above this
+ @param	budget  the budget to start from, it is clamped to min and max
+
+ @return	0 on success
+ @return	-ENOENT if there is no memory.pressure to read
+ @return	a negative errno on failure
+
+  note:
+        call this once the filesystem has daemonized. the cgroups
+        memory.pressure and memory.current are read each PRESSURE_INTERVAL,
+        with no cgroup v2 the pressure of the whole system is used
+*******************************************************************************/
+
+int pressure_start (
+    const char *cgroup,
+    size_t min,
+    size_t max,
+    size_t budget);
+
+/*****************************************************************************//**
+  function to stop the memory pressure monitor
+
+ @return	nothing
+
+  note:
+        the budget is left where it was
+*******************************************************************************/
+
+void pressure_stop (void);
+
+/*****************************************************************************//**
+  function to get the stats of the memory pressure monitor
+
+ @param	stats   filled in with the stats
+
+ @return	nothing
+*******************************************************************************/
+
+void pressure_get_stats (
+    pressure_stats *stats);
+
+#endif
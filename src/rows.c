@@ -0,0 +1,400 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "hash.h"
+#include "DLList.h"
+#include "buffer.h"
+#include "deps.h"
+#include "rows.h"
+
+static pthread_mutex_t rows_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/***** for each kind of row, the cached rows keyed by row_id *****/
+
+static hash_table rows_tables[ROWS_TABLES];
+
+/***** every cached row, coldest at the head *****/
+
+static DLList rows_lru;
+
+static size_t rows_budget = 0;
+
+/***** a row older than this is fetched again, 0 is no limit *****/
+
+static unsigned int rows_max_age = 0;
+
+/***** goes up on each expire, a row fetched across one is not kept *****/
+
+static unsigned long rows_serial = 0;
+
+static rows_stats rows_counters = {0};
+
+/***** bytes charged for a row *****/
+
+#define ROWS_BYTES(r) (sizeof(rows_row) + (r)->length + sizeof(DLList_node) + \
+                       sizeof(hash_slot))
+
+/*****************************************************************************//**
+  function to setup the row cache
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+int rows_init (void)
+{
+    int i;
+
+    for (i = 0; i < ROWS_TABLES; i++)
+        memset(&rows_tables[i], 0, sizeof(hash_table));
+
+    memset(&rows_lru, 0, sizeof(DLList));
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to take a row out of the cache and drop the reference it held
+
+ @param	row     the row, the cache locked
+*******************************************************************************/
+
+static void rows_unlink (
+    rows_row *row)
+{
+    hash_delete(&rows_tables[row->table], row->row_id);
+    DLList_delete(&rows_lru, row->lru);
+    row->hashed = 0;
+
+    rows_counters.count--;
+    rows_counters.bytes -= ROWS_BYTES(row);
+
+    if (!--row->refs)
+        free(row);
+}
+
+/*****************************************************************************//**
+  function to evict the coldest rows till the cache is in its budget
+
+  note:
+        must be called with the cache locked, a row still referenced is
+        free'ed when it is released
+*******************************************************************************/
+
+static void rows_evict (void)
+{
+    while (rows_budget && rows_counters.bytes > rows_budget && rows_lru.head) {
+        rows_unlink(rows_lru.head->data);
+        rows_counters.evictions++;
+    }
+}
+
+/*****************************************************************************//**
+  function to free the row cache
+
+ @return	nothing
+
+  note:
+        rows still referenced are free'ed when they are released
+*******************************************************************************/
+
+void rows_destroy (void)
+{
+    int i;
+
+    pthread_mutex_lock(&rows_lock);
+
+    while (rows_lru.head)
+        rows_unlink(rows_lru.head->data);
+
+    for (i = 0; i < ROWS_TABLES; i++)
+        hash_delete_all(&rows_tables[i]);
+
+    pthread_mutex_unlock(&rows_lock);
+}
+
+/*****************************************************************************//**
+  function to set the byte budget of the row cache
+
+ @param	bytes   the budget, 0 for no limit
+
+ @return	nothing
+
+  note:
+        the budget is separate from the one of the rendered mapfiles, a
+        mapfile evicted from there is rendered again from the rows here
+        without a query
+*******************************************************************************/
+
+void rows_set_budget (
+    size_t bytes)
+{
+    pthread_mutex_lock(&rows_lock);
+
+    rows_budget = bytes;
+    rows_evict();
+
+    pthread_mutex_unlock(&rows_lock);
+}
+
+/*****************************************************************************//**
+  function to set how long a row is kept
+
+ @param	seconds a row fetched this long ago is fetched again, 0 keeps it
+                till it is expired or evicted
+
+ @return	nothing
+
+  note:
+        with no notifications nothing expires a row, a mapfile rendered again
+        after its ttl would otherwise be rendered from the same rows
+*******************************************************************************/
+
+void rows_set_max_age (
+    unsigned int seconds)
+{
+    pthread_mutex_lock(&rows_lock);
+    rows_max_age = seconds;
+    pthread_mutex_unlock(&rows_lock);
+}
+
+/*****************************************************************************//**
+  function to get a row, fetching it from the db if it is not cached
+
+ @param	table   the kind of row
+ @param	row_id  the primary key of the row
+ @param	fetch   function to fetch the row if it is not cached
+ @param	err     set to a negative errno on failure
+
+ @return	the row with a reference held, release it with rows_release()
+ @return	NULL on failure
+
+  note:
+        the row is fetched with no lock held. a row shared by many
+        mapfiles, like a common layer, is fetched once for all of them
+*******************************************************************************/
+
+rows_row *rows_get (
+    int table,
+    int row_id,
+    rows_fetch_func fetch,
+    int *err)
+{
+    rows_row *row;
+    rows_row *found;
+    buffer buf = {0};
+    unsigned long serial;
+    int res;
+
+    if (table < 0 || table >= ROWS_TABLES) {
+        *err = -EINVAL;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&rows_lock);
+
+    /***** too old, it may have changed with no one saying so *****/
+
+    if ((row = hash_find(&rows_tables[table], row_id)) && rows_max_age &&
+        time(NULL) - row->fetched >= rows_max_age) {
+        rows_unlink(row);
+        rows_counters.expirations++;
+        row = NULL;
+    }
+
+    if (row) {
+        row->refs++;
+        DLList_move_tail(&rows_lru, row->lru);
+        rows_counters.hits++;
+        pthread_mutex_unlock(&rows_lock);
+        return row;
+    }
+
+    serial = rows_serial;
+
+    pthread_mutex_unlock(&rows_lock);
+
+    /***** fetch it with no lock held *****/
+
+    if ((res = fetch(&buf, table, row_id))) {
+        buffer_free(&buf);
+        *err = res;
+        return NULL;
+    }
+
+    if (!(row = malloc(sizeof(rows_row) + buf.used))) {
+        buffer_free(&buf);
+        *err = -ENOMEM;
+        return NULL;
+    }
+
+    row->table = table;
+    row->row_id = row_id;
+    row->refs = 1;
+    row->hashed = 0;
+    row->lru = NULL;
+    row->fetched = time(NULL);
+    row->length = buf.used;
+    memcpy(row->data, buf.buf, buf.used);
+    buffer_free(&buf);
+
+    pthread_mutex_lock(&rows_lock);
+
+    rows_counters.fetches++;
+
+    /***** someone else fetched it at the same time *****/
+
+    if ((found = hash_find(&rows_tables[table], row_id))) {
+        found->refs++;
+        DLList_move_tail(&rows_lru, found->lru);
+        pthread_mutex_unlock(&rows_lock);
+        free(row);
+        return found;
+    }
+
+    /***** a row that changed while it was fetched may have been read before
+           the change, use it this once but do not keep it *****/
+
+    if (serial == rows_serial && (row->lru = DLList_append(&rows_lru, row))) {
+        if (hash_insert(&rows_tables[table], row_id, row))
+            DLList_delete(&rows_lru, row->lru);
+        else {
+            row->hashed = 1;
+            row->refs++;
+            rows_counters.count++;
+            rows_counters.bytes += ROWS_BYTES(row);
+            rows_evict();
+        }
+    }
+
+    pthread_mutex_unlock(&rows_lock);
+
+    return row;
+}
+
+/*****************************************************************************//**
+  function to release a reference on a row
+
+ @param	row     the row from rows_get()
+
+ @return	nothing
+*******************************************************************************/
+
+void rows_release (
+    rows_row *row)
+{
+    unsigned int refs;
+
+    pthread_mutex_lock(&rows_lock);
+    refs = --row->refs;
+    pthread_mutex_unlock(&rows_lock);
+
+    if (!refs)
+        free(row);
+}
+
+/*****************************************************************************//**
+  function to take a row that changed out of the cache
+
+ @param	table   the kind of row
+ @param	row_id  the primary key of the row
+
+ @return	nothing
+
+  note:
+        a fetch of the row in flight is used by its caller but not kept
+*******************************************************************************/
+
+void rows_expire (
+    int table,
+    int row_id)
+{
+    rows_row *row;
+
+    if (table < 0 || table >= ROWS_TABLES)
+        return;
+
+    pthread_mutex_lock(&rows_lock);
+
+    rows_serial++;
+
+    if ((row = hash_find(&rows_tables[table], row_id))) {
+        rows_unlink(row);
+        rows_counters.expirations++;
+    }
+
+    pthread_mutex_unlock(&rows_lock);
+}
+
+/*****************************************************************************//**
+  function to take every row out of the cache
+
+ @return	nothing
+
+  note:
+        for when changes may have been missed
+*******************************************************************************/
+
+void rows_expire_all (void)
+{
+    pthread_mutex_lock(&rows_lock);
+
+    rows_serial++;
+
+    while (rows_lru.head) {
+        rows_unlink(rows_lru.head->data);
+        rows_counters.expirations++;
+    }
+
+    pthread_mutex_unlock(&rows_lock);
+}
+
+/*****************************************************************************//**
+  function to get the counters of the row cache
+
+ @param	stats   filled in with the counters
+
+ @return	nothing
+*******************************************************************************/
+
+void rows_get_stats (
+    rows_stats *stats)
+{
+    pthread_mutex_lock(&rows_lock);
+    *stats = rows_counters;
+    pthread_mutex_unlock(&rows_lock);
+}
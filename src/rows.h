@@ -0,0 +1,230 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+#ifndef rows_h
+#define rows_h
+
+/***** the mapfile row itself is kept as the kind after the ones in deps.h *****/
+
+#define ROWS_MAPFILE DEPS_TABLES
+#define ROWS_TABLES (DEPS_TABLES + 1)
+
+/*****************************************************************************//**
+  structure for a db row as it was fetched
+
+ @param	table   the kind of row, a deps_table or ROWS_MAPFILE
+ @param	row_id  the primary key of the row
+ @param	refs    number of references held, the cache holds one while the
+                row is in it
+ @param	hashed  non zero while the row is in the cache
+ @param	lru     the node of the row in the recency list
+ @param	fetched time the row was fetched
+ @param	length  number of bytes in data
+ @param	data    the row as the fetch function stored it, with the ids of
+                the child rows the render walks, such as the layers of a
+                mapfile or the classes of a layer
+
+  note:
+        a row never changes once fetched, when it changes in the db it is
+        taken out of the cache and the next get fetches it again
+*******************************************************************************/
+
+typedef struct {
+    int table;
+    int row_id;
+    unsigned int refs;
+    unsigned int hashed;
+    DLList_node *lru;
+    time_t fetched;
+    size_t length;
+    char data[];
+} rows_row;
+
+/*****************************************************************************//**
+  structure for the counters of the row cache
+
+ @param	hits        number of gets answered from the cache
+ @param	fetches     number of rows fetched from the db
+ @param	evictions   number of rows evicted to stay in the budget
+ @param	expirations number of rows taken out because they changed or got
+                    too old
+ @param	count       number of rows held
+ @param	bytes       bytes charged to the budget
+*******************************************************************************/
+
+typedef struct {
+    unsigned long hits;
+    unsigned long fetches;
+    unsigned long evictions;
+    unsigned long expirations;
+    unsigned long count;
+    size_t bytes;
+} rows_stats;
+
+/*****************************************************************************//**
+  type of function to pass to rows_get to fetch a row from the db
+
+ @param	buf     the buffer to store the row in, with buffer_write()
+ @param	table   the kind of row
+ @param	row_id  the primary key of the row
+
+ @return	0 on success
+ @return	a negative errno on failure, -ENOENT if there is no such row
+*******************************************************************************/
+
+typedef int (*rows_fetch_func) (
+    buffer *buf,
+    int table,
+    int row_id);
+
+/*****************************************************************************//**
+  function to setup the row cache
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+int rows_init (void);
+
+/*****************************************************************************//**
+  function to free the row cache
+
+ @return	nothing
+
+  note:
+        rows still referenced are free'ed when they are released
+*******************************************************************************/
+
+void rows_destroy (void);
+
+/*****************************************************************************//**
+  function to set the byte budget of the row cache
+
+ @param	bytes   the budget, 0 for no limit
+
+ @return	nothing
+
+  note:
+        the budget is separate from the one of the rendered mapfiles, a
+        mapfile evicted from there is rendered again from the rows here
+        without a query
+*******************************************************************************/
+
+void rows_set_budget (
+    size_t bytes);
+
+/*****************************************************************************//**
+  function to set how long a row is kept
+
+ @param	seconds a row fetched this long ago is fetched again, 0 keeps it
+                till it is expired or evicted
+
+ @return	nothing
+
+  note:
+        with no notifications nothing expires a row, a mapfile rendered again
+        after its ttl would otherwise be rendered from the same rows
+*******************************************************************************/
+
+void rows_set_max_age (
+    unsigned int seconds);
+
+/*****************************************************************************//**
+  function to get a row, fetching it from the db if it is not cached
+
+ @param	table   the kind of row
+ @param	row_id  the primary key of the row
+ @param	fetch   function to fetch the row if it is not cached
+ @param	err     set to a negative errno on failure
+
+ @return	the row with a reference held, release it with rows_release()
+ @return	NULL on failure
+
+  note:
+        the row is fetched with no lock held. a row shared by many
+        mapfiles, like a common layer, is fetched once for all of them
+*******************************************************************************/
+
+rows_row *rows_get (
+    int table,
+    int row_id,
+    rows_fetch_func fetch,
+    int *err);
+
+/*****************************************************************************//**
+  function to release a reference on a row
+
+ @param	row     the row from rows_get()
+
+ @return	nothing
+*******************************************************************************/
+
+void rows_release (
+    rows_row *row);
+
+/*****************************************************************************//**
+  function to take a row that changed out of the cache
+
+ @param	table   the kind of row
+ @param	row_id  the primary key of the row
+
+ @return	nothing
+
+  note:
+        a fetch of the row in flight is used by its caller but not kept
+*******************************************************************************/
+
+void rows_expire (
+    int table,
+    int row_id);
+
+/*****************************************************************************//**
+  function to take every row out of the cache
+
+ @return	nothing
+
+  note:
+        for when changes may have been missed
+*******************************************************************************/
+
+void rows_expire_all (void);
+
+/*****************************************************************************//**
+  function to get the counters of the row cache
+
+ @param	stats   filled in with the counters
+
+ @return	nothing
+*******************************************************************************/
+
+void rows_get_stats (
+    rows_stats *stats);
+
+#endif
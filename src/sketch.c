@@ -0,0 +1,177 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "sketch.h"
+
+static const uint64_t sketch_seeds[SKETCH_ROWS] = {
+    0x9E3779B97F4A7C15ULL,
+    0xC2B2AE3D27D4EB4FULL,
+    0x165667B19E3779F9ULL,
+    0xD6E8FEB86659FD93ULL
+};
+
+/*******************************************************************************
+  function to get the counter of a key in a row
+*******************************************************************************/
+
+static inline unsigned char *sketch_counter (
+    sketch *sk,
+    int row,
+    int key)
+{
+    uint64_t h = ((uint64_t)(unsigned int)key + 1) * sketch_seeds[row];
+
+    /***** the high bits of the product depend on every bit of the key *****/
+
+    return sk->counters + row * (sk->mask + 1) + ((h >> 32) & sk->mask);
+}
+
+/*******************************************************************************
+  function to setup a sketch
+
+  args:
+        sk      the sketch
+        width   number of counters in each row, rounded up to a power of 2
+
+  returns:
+        0 on success
+        -1 if malloc fails
+*******************************************************************************/
+
+int sketch_init (
+    sketch *sk,
+    size_t width)
+{
+    size_t size;
+
+    for (size = 1; size < width; size <<= 1);
+
+    if (!(sk->counters = calloc(SKETCH_ROWS, size)))
+        return -1;
+
+    sk->mask = size - 1;
+    sk->samples = 0;
+    sk->reset_at = size * 10;
+
+    return 0;
+}
+
+/*******************************************************************************
+  function to free a sketch
+
+  args:
+        sk      the sketch
+
+  returns:
+        nothing
+*******************************************************************************/
+
+void sketch_free (
+    sketch *sk)
+{
+    free(sk->counters);
+    sk->counters = NULL;
+}
+
+/*******************************************************************************
+  function to halve every counter so old popularity fades
+*******************************************************************************/
+
+static void sketch_age (
+    sketch *sk)
+{
+    size_t i;
+    size_t n = SKETCH_ROWS * (sk->mask + 1);
+
+    for (i = 0; i < n; i++)
+        sk->counters[i] >>= 1;
+
+    sk->samples /= 2;
+}
+
+/*******************************************************************************
+  function to count a key
+
+  args:
+        sk      the sketch
+        key     the key that was seen
+
+  returns:
+        nothing
+*******************************************************************************/
+
+void sketch_add (
+    sketch *sk,
+    int key)
+{
+    unsigned char *c;
+    int row;
+
+    for (row = 0; row < SKETCH_ROWS; row++) {
+        c = sketch_counter(sk, row, key);
+        if (*c < SKETCH_MAX)
+            (*c)++;
+    }
+
+    if (++sk->samples >= sk->reset_at)
+        sketch_age(sk);
+}
+
+/*******************************************************************************
+  function to estimate how often a key has been seen
+
+  args:
+        sk      the sketch
+        key     the key
+
+  returns:
+        the estimate, 0 to SKETCH_MAX
+*******************************************************************************/
+
+unsigned int sketch_estimate (
+    sketch *sk,
+    int key)
+{
+    unsigned int result = SKETCH_MAX;
+    unsigned char *c;
+    int row;
+
+    for (row = 0; row < SKETCH_ROWS; row++) {
+        c = sketch_counter(sk, row, key);
+        if (*c < result)
+            result = *c;
+    }
+
+    return result;
+}
+
@@ -0,0 +1,115 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef sketch_h
+#define sketch_h
+
+#include <stddef.h>
+
+/***** number of rows, each row hashes the key with its own seed *****/
+
+#define SKETCH_ROWS 4
+
+/***** counters saturate here, small counters make aging forget fast *****/
+
+#define SKETCH_MAX 15
+
+/*****************************************************************************//**
+  structure for a count-min sketch of how often integer keys are seen
+
+ @param	counters    SKETCH_ROWS rows of width counters
+ @param	mask        width minus 1, the width is a power of 2
+ @param	samples     number of keys added since the last aging
+ @param	reset_at    number of samples after which every counter is halved
+
+  note:
+        the estimate of a key is the smallest of its counters, it is never
+        less than the true count since the last aging and only more when
+        other keys collide with it in every row
+*******************************************************************************/
+
+typedef struct {
+    unsigned char *counters;
+    size_t mask;
+    size_t samples;
+    size_t reset_at;
+} sketch;
+
+/*****************************************************************************//**
+  function to setup a sketch
+
+ @param	sk      the sketch
+ @param	width   number of counters in each row, rounded up to a power of 2
+
+ @return	0 on success
+ @return	-1 if malloc fails
+*******************************************************************************/
+
+int sketch_init (
+    sketch *sk,
+    size_t width);
+
+/*****************************************************************************//**
+  function to free a sketch
+
+ @param	sk      the sketch
+
+ @return	nothing
+*******************************************************************************/
+
+void sketch_free (
+    sketch *sk);
+
+/*****************************************************************************//**
+  function to count a key
+
+ @param	sk      the sketch
+ @param	key     the key that was seen
+
+ @return	nothing
+*******************************************************************************/
+
+void sketch_add (
+    sketch *sk,
+    int key);
+
+/*****************************************************************************//**
+  function to estimate how often a key has been seen
+
+ @param	sk      the sketch
+ @param	key     the key
+
+ @return	the estimate, 0 to SKETCH_MAX
+*******************************************************************************/
+
+unsigned int sketch_estimate (
+    sketch *sk,
+    int key);
+
+#endif
@@ -0,0 +1,451 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hash.h"
+#include "DLList.h"
+#include "timer.h"
+#include "sketch.h"
+#include "buffer.h"
+#include "frag.h"
+#include "snap.h"
+#include "cache.h"
+
+static pthread_t snap_thread;
+static pthread_mutex_t snap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t snap_wake = PTHREAD_COND_INITIALIZER;
+static int snap_running = 0;
+static char *snap_path = NULL;
+static time_t snap_interval = 0;
+
+/*****************************************************************************//**
+  function to write a version to a snapshot
+
+ @param	fp      the snapshot
+ @param	version the version
+
+ @return	0 on success
+ @return	-1 on failure
+*******************************************************************************/
+
+static int snap_write_version (
+    FILE *fp,
+    cache_version *version)
+{
+    frag_piece *piece;
+    size_t i;
+
+    if (!version->gather)
+        return -(fwrite(version->buf->buf, 1, version->size, fp) !=
+                 version->size);
+
+    for (i = 0; i < version->gather->npieces; i++) {
+        piece = &version->gather->pieces[i];
+        if (fwrite(piece->data, 1, piece->length, fp) != piece->length)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to write the current versions in the cache to a snapshot
+
+ @param	path    the file to write, it is replaced atomically
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        the snapshot is written to path.tmp and renamed over path, a crash
+        while writing leaves the last one whole. the versions are pinned
+        while they are written, the cache is only locked to list them
+*******************************************************************************/
+
+int snap_save (
+    const char *path)
+{
+    cache_version **versions;
+    snap_header header = { SNAP_MAGIC, SNAP_FORMAT, 0, 0 };
+    snap_entry entry = {0};
+    char *tmp;
+    FILE *fp = NULL;
+    uint64_t off;
+    size_t length;
+    size_t i;
+    int res;
+
+    if ((res = cache_list_current(&versions, &length)))
+        return res;
+
+    if (!(tmp = malloc(strlen(path) + 5))) {
+        res = -ENOMEM;
+        goto done;
+    }
+    sprintf(tmp, "%s.tmp", path);
+
+    if (!(fp = fopen(tmp, "w"))) {
+        res = -errno;
+        goto done;
+    }
+
+    /***** the index with the offsets first, then the mapfiles *****/
+
+    off = sizeof(snap_header) + length * sizeof(snap_entry);
+
+    header.count = length;
+    header.length = off;
+    for (i = 0; i < length; i++)
+        header.length += versions[i]->size;
+
+    if (fwrite(&header, sizeof(header), 1, fp) != 1)
+        goto fail;
+
+    for (i = 0; i < length; i++) {
+        entry.mapfile_id = versions[i]->mapfile_id;
+        entry.serial = versions[i]->serial;
+        entry.mtime = versions[i]->mtime;
+        entry.etag = cache_etag(versions[i]);
+        entry.off = off;
+        entry.size = versions[i]->size;
+        off += entry.size;
+
+        if (fwrite(&entry, sizeof(entry), 1, fp) != 1)
+            goto fail;
+    }
+
+    for (i = 0; i < length; i++) {
+        if (snap_write_version(fp, versions[i]))
+            goto fail;
+    }
+
+    if (fflush(fp) || fsync(fileno(fp)))
+        goto fail;
+
+    res = fclose(fp);
+    fp = NULL;
+    if (res || rename(tmp, path))
+        goto fail;
+
+    res = 0;
+    goto done;
+
+fail:
+    res = errno ? -errno : -EIO;
+    if (fp)
+        fclose(fp);
+    unlink(tmp);
+
+done:
+    for (i = 0; i < length; i++)
+        cache_release(versions[i]);
+    free(versions);
+    free(tmp);
+
+    return res;
+}
+
+/*****************************************************************************//**
+  function to make a version of an entry in a mapped snapshot
+
+ @param	snap    the snapshot, a reference is taken for the version
+ @param	entry   the entry
+
+ @return	the version with one reference held
+ @return	NULL if malloc fails
+*******************************************************************************/
+
+static cache_version *snap_version (
+    snap_file *snap,
+    snap_entry *entry)
+{
+    cache_version *version;
+
+    if (!(version = calloc(1, sizeof(cache_version))) ||
+        !(version->buf = calloc(1, sizeof(buffer)))) {
+        free(version);
+        return NULL;
+    }
+
+    version->mapfile_id = entry->mapfile_id;
+    version->refs = 1;
+    version->serial = entry->serial;
+    version->mtime = entry->mtime;
+    version->size = entry->size;
+    version->etag = entry->etag;
+
+    /***** the pages are charged to the budget like an alloced buffer, they
+           are resident once read *****/
+
+    version->buf->buf = (char *) snap->base + entry->off;
+    version->buf->used = entry->size;
+    version->buf->alloced = entry->size;
+
+    __sync_fetch_and_add(&snap->refs, 1);
+    version->snap = snap;
+
+    return version;
+}
+
+/*****************************************************************************//**
+  function to restore the cache from a snapshot
+
+ @param	path    the file to read
+
+ @return	0 on success
+ @return	a negative errno on failure, -ENOENT if there is no snapshot
+
+  note:
+        the file is mapped, not read, the versions point into the map so
+        a restart serves its first hit without reading the db or copying
+        the mapfile. each one is checked against the db on its first get,
+        see cache_adopt(). call it after cache_init() and before
+        cache_start()
+*******************************************************************************/
+
+int snap_load (
+    const char *path)
+{
+    snap_file *snap;
+    snap_header *header;
+    snap_entry *index;
+    cache_version *version;
+    struct stat st;
+    size_t start;
+    uint32_t i;
+    int fd;
+    int res = 0;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return -errno;
+
+    if (fstat(fd, &st)) {
+        res = -errno;
+        close(fd);
+        return res;
+    }
+
+    if ((size_t) st.st_size < sizeof(snap_header)) {
+        close(fd);
+        return -EINVAL;
+    }
+
+    if (!(snap = malloc(sizeof(snap_file)))) {
+        close(fd);
+        return -ENOMEM;
+    }
+
+    snap->refs = 1;
+    snap->length = st.st_size;
+    snap->base = mmap(NULL, snap->length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (snap->base == MAP_FAILED) {
+        res = -errno;
+        free(snap);
+        return res;
+    }
+
+    header = snap->base;
+    index = (snap_entry *)(header + 1);
+    start = sizeof(snap_header) + (size_t) header->count * sizeof(snap_entry);
+
+    /***** a snapshot cut short or from another build is not used *****/
+
+    if (memcmp(header->magic, SNAP_MAGIC, sizeof(header->magic)) ||
+        header->format != SNAP_FORMAT || header->length != snap->length ||
+        start > snap->length) {
+        snap_release(snap);
+        return -EINVAL;
+    }
+
+    /***** start reading the pages in now, the first hits may be on any of
+           them *****/
+
+    madvise(snap->base, snap->length, MADV_WILLNEED);
+
+    for (i = 0; i < header->count && !res; i++) {
+        if (index[i].off < start || index[i].off > snap->length ||
+            index[i].size > snap->length - index[i].off ||
+            index[i].mapfile_id < 0)
+            continue;
+
+        if (!(version = snap_version(snap, &index[i])))
+            res = -ENOMEM;
+        else if ((res = cache_adopt(version)) == -EEXIST)
+            res = 0;
+    }
+
+    snap_release(snap);
+
+    return res;
+}
+
+/*****************************************************************************//**
+  function to release a reference on a mapped snapshot
+
+ @param	snap    the snapshot
+
+ @return	nothing
+
+  note:
+        the map is unmapped with the last reference
+*******************************************************************************/
+
+void snap_release (
+    snap_file *snap)
+{
+    if (__sync_sub_and_fetch(&snap->refs, 1))
+        return;
+
+    munmap(snap->base, snap->length);
+    free(snap);
+}
+
+/*****************************************************************************//**
+  function run on the snapshot thread
+*******************************************************************************/
+
+static void *snap_main (
+    void *arg)
+{
+    struct timespec when;
+    int res;
+
+    (void) arg;
+
+    pthread_mutex_lock(&snap_lock);
+
+    while (snap_running) {
+        clock_gettime(CLOCK_REALTIME, &when);
+        when.tv_sec += snap_interval;
+
+        while (snap_running &&
+               pthread_cond_timedwait(&snap_wake, &snap_lock, &when) !=
+               ETIMEDOUT);
+
+        if (!snap_running)
+            break;
+
+        pthread_mutex_unlock(&snap_lock);
+
+        if ((res = snap_save(snap_path)))
+            fprintf(stderr, "mapfileFS: snapshot %s: %s\n", snap_path,
+                    strerror(-res));
+
+        pthread_mutex_lock(&snap_lock);
+    }
+
+    pthread_mutex_unlock(&snap_lock);
+
+    return NULL;
+}
+
+/*****************************************************************************//**
+  function to start the thread that writes a snapshot periodically
+
+ @param	path        the file to write
+ @param	interval    seconds between snapshots
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        call this once the filesystem has daemonized
+*******************************************************************************/
+
+int snap_start (
+    const char *path,
+    time_t interval)
+{
+    int res;
+
+    if (snap_running)
+        return -EBUSY;
+
+    if (interval < 1)
+        return -EINVAL;
+
+    if (!(snap_path = strdup(path)))
+        return -ENOMEM;
+
+    snap_interval = interval;
+    snap_running = 1;
+
+    if ((res = -pthread_create(&snap_thread, NULL, snap_main, NULL))) {
+        snap_running = 0;
+        free(snap_path);
+        snap_path = NULL;
+    }
+
+    return res;
+}
+
+/*****************************************************************************//**
+  function to stop the snapshot thread and write a last snapshot
+
+ @return	nothing
+
+  note:
+        call this before cache_destroy()
+*******************************************************************************/
+
+void snap_stop (void)
+{
+    int res;
+
+    if (!snap_running)
+        return;
+
+    pthread_mutex_lock(&snap_lock);
+    snap_running = 0;
+    pthread_cond_signal(&snap_wake);
+    pthread_mutex_unlock(&snap_lock);
+
+    pthread_join(snap_thread, NULL);
+
+    if ((res = snap_save(snap_path)))
+        fprintf(stderr, "mapfileFS: snapshot %s: %s\n", snap_path,
+                strerror(-res));
+
+    free(snap_path);
+    snap_path = NULL;
+}
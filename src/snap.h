@@ -0,0 +1,185 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+#ifndef snap_h
+#define snap_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/***** first bytes of a snapshot and the version of the layout that
+       follows, a snapshot with another version is ignored *****/
+
+#define SNAP_MAGIC "mapfsnap"
+#define SNAP_FORMAT 1
+
+/*****************************************************************************//**
+  structure for the start of a snapshot file
+
+ @param	magic   SNAP_MAGIC with no nul
+ @param	format  SNAP_FORMAT
+ @param	count   number of entries in the index that follows
+ @param	length  length of the whole file
+
+  note:
+        the index follows the header, then the rendered mapfiles. the
+        numbers are in the byte order of the host that wrote it, a snapshot
+        is only meant to be read back by the same machine
+*******************************************************************************/
+
+typedef struct {
+    char magic[8];
+    uint32_t format;
+    uint32_t count;
+    uint64_t length;
+} snap_header;
+
+/*****************************************************************************//**
+  structure for an entry in the index of a snapshot
+
+ @param	mapfile_id  the id of the mapfile
+ @param	reserved    0
+ @param	serial      number of the version that was saved
+ @param	mtime       time the version was rendered
+ @param	etag        cache_etag() of the version, checked against a new render
+                    before the restored version is trusted
+ @param	off         offset of the rendered mapfile in the file
+ @param	size        length of the rendered mapfile
+
+  note:
+        the entries are in the order cache_list_current() gave them, coldest
+        first
+*******************************************************************************/
+
+typedef struct {
+    int32_t mapfile_id;
+    uint32_t reserved;
+    uint64_t serial;
+    int64_t mtime;
+    uint64_t etag;
+    uint64_t off;
+    uint64_t size;
+} snap_entry;
+
+/*****************************************************************************//**
+  structure for a snapshot mapped in to restore from
+
+ @param	refs    number of restored versions pointing into the map, plus one
+                while it is being restored
+ @param	base    the map
+ @param	length  length of the map
+
+  note:
+        the file is never written once renamed into place, a newer snapshot
+        is a new file, so the map stays valid until the last version is
+        released
+*******************************************************************************/
+
+typedef struct snap_file {
+    unsigned int refs;
+    void *base;
+    size_t length;
+} snap_file;
+
+/*****************************************************************************//**
+  function to write the current versions in the cache to a snapshot
+
+ @param	path    the file to write, it is replaced atomically
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+int snap_save (
+    const char *path);
+
+/*****************************************************************************//**
+  function to restore the cache from a snapshot
+
+ @param	path    the file to read
+
+ @return	0 on success
+ @return	a negative errno on failure, -ENOENT if there is no snapshot
+
+  note:
+        the file is mapped, not read, the versions point into the map so
+        a restart serves its first hit without reading the db or copying
+        the mapfile. each one is checked against the db on its first get,
+        see cache_adopt(). call it after cache_init() and before
+        cache_start()
+*******************************************************************************/
+
+int snap_load (
+    const char *path);
+
+/*****************************************************************************//**
+  function to release a reference on a mapped snapshot
+
+ @param	snap    the snapshot
+
+ @return	nothing
+
+  note:
+        the map is unmapped with the last reference
+*******************************************************************************/
+
+void snap_release (
+    snap_file *snap);
+
+/*****************************************************************************//**
+  function to start the thread that writes a snapshot periodically
+
+ @param	path        the file to write
+ @param	interval    seconds between snapshots
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        call this once the filesystem has daemonized
+*******************************************************************************/
+
+int snap_start (
+    const char *path,
+    time_t interval);
+
+/*****************************************************************************//**
+  function to stop the snapshot thread and write a last snapshot
+
+ @return	nothing
+
+  note:
+        call this before cache_destroy()
+*******************************************************************************/
+
+void snap_stop (void);
+
+#endif
@@ -0,0 +1,508 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "hash.h"
+#include "DLList.h"
+#include "timer.h"
+#include "sketch.h"
+#include "buffer.h"
+#include "frag.h"
+#include "cache.h"
+#include "deps.h"
+#include "rows.h"
+#include "listen.h"
+#include "pressure.h"
+#include "stats.h"
+
+/*****************************************************************************//**
+  structure for the histograms of one thread
+
+ @param	hists   the histograms, only the thread writes them
+ @param	counts  the counters, only the thread writes them
+ @param	node    the node of the thread in the list of threads
+*******************************************************************************/
+
+typedef struct {
+    stats_hist hists[STATS_HISTS];
+    unsigned long counts[STATS_COUNTERS];
+    DLList_node *node;
+} stats_thread;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;
+
+/***** the threads recording, and what threads that have exited recorded *****/
+
+static DLList stats_threads = {0};
+static stats_hist stats_retired[STATS_HISTS];
+static unsigned long stats_retired_counts[STATS_COUNTERS];
+
+static __thread stats_thread *stats_self = NULL;
+
+static const char *stats_ops[STATS_OPS] = {
+    "lookup",
+    "getattr",
+    "readdir",
+    "open",
+    "read",
+    "release"
+};
+
+/*****************************************************************************//**
+  function to add to a counter only the calling thread writes, others may read
+  it at any time
+*******************************************************************************/
+
+#define STATS_ADD(c, n) __atomic_store_n(&(c), \
+                            __atomic_load_n(&(c), __ATOMIC_RELAXED) + (n), \
+                            __ATOMIC_RELAXED)
+
+/*****************************************************************************//**
+  function to add one histogram into another
+*******************************************************************************/
+
+static void stats_sum (
+    stats_hist *to,
+    stats_hist *from)
+{
+    int i;
+
+    to->count += __atomic_load_n(&from->count, __ATOMIC_RELAXED);
+    to->sum += __atomic_load_n(&from->sum, __ATOMIC_RELAXED);
+
+    for (i = 0; i < STATS_BUCKETS; i++)
+        to->buckets[i] += __atomic_load_n(&from->buckets[i], __ATOMIC_RELAXED);
+}
+
+/*****************************************************************************//**
+  function called when a thread that recorded exits, its counts are kept
+*******************************************************************************/
+
+static void stats_thread_exit (
+    void *data)
+{
+    stats_thread *self = data;
+    int i;
+
+    pthread_mutex_lock(&stats_lock);
+
+    for (i = 0; i < STATS_HISTS; i++)
+        stats_sum(&stats_retired[i], &self->hists[i]);
+    for (i = 0; i < STATS_COUNTERS; i++)
+        stats_retired_counts[i] += self->counts[i];
+
+    DLList_delete(&stats_threads, self->node);
+
+    pthread_mutex_unlock(&stats_lock);
+
+    free(self);
+}
+
+static void stats_key_init (void)
+{
+    pthread_key_create(&stats_key, stats_thread_exit);
+}
+
+/*****************************************************************************//**
+  function to get the histograms of the calling thread
+
+ @return	the histograms
+ @return	NULL if malloc fails
+*******************************************************************************/
+
+static stats_thread *stats_thread_get (void)
+{
+    stats_thread *self;
+
+    if (stats_self)
+        return stats_self;
+
+    pthread_once(&stats_once, stats_key_init);
+
+    if (!(self = calloc(1, sizeof(stats_thread))))
+        return NULL;
+
+    pthread_mutex_lock(&stats_lock);
+    self->node = DLList_append(&stats_threads, self);
+    pthread_mutex_unlock(&stats_lock);
+
+    if (!self->node) {
+        free(self);
+        return NULL;
+    }
+
+    pthread_setspecific(stats_key, self);
+
+    return stats_self = self;
+}
+
+/*****************************************************************************//**
+  function to get a monotonic time to start timing from
+
+ @return	the time in microseconds
+*******************************************************************************/
+
+unsigned long stats_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/*****************************************************************************//**
+  function to record a latency
+
+ @param	id      what was timed
+ @param	start   the time from stats_now() it started
+
+ @return	nothing
+
+  note:
+        each thread records into its own histograms so the threads never
+        share a cache line, they are only summed when read
+*******************************************************************************/
+
+void stats_observe (
+    stats_id id,
+    unsigned long start)
+{
+    unsigned long us = stats_now() - start;
+    stats_thread *self;
+    stats_hist *hist;
+    int bucket;
+
+    if (!(self = stats_thread_get()))
+        return;
+
+    hist = &self->hists[id];
+
+    bucket = us ? 64 - __builtin_clzl(us) : 0;
+    if (bucket >= STATS_BUCKETS)
+        bucket = STATS_BUCKETS - 1;
+
+    STATS_ADD(hist->count, 1);
+    STATS_ADD(hist->sum, us);
+    STATS_ADD(hist->buckets[bucket], 1);
+}
+
+/*****************************************************************************//**
+  function to add one to a counter
+
+ @param	id      the counter
+
+ @return	nothing
+
+  note:
+        each thread counts into its own counters like stats_observe()
+*******************************************************************************/
+
+void stats_count (
+    stats_counter id)
+{
+    stats_thread *self;
+
+    if ((self = stats_thread_get()))
+        STATS_ADD(self->counts[id], 1);
+}
+
+/*****************************************************************************//**
+  function to get a counter summed over all the threads
+
+ @param	id      the counter
+
+ @return	the count
+*******************************************************************************/
+
+unsigned long stats_counted (
+    stats_counter id)
+{
+    DLList_node *node;
+    unsigned long count;
+
+    pthread_mutex_lock(&stats_lock);
+
+    count = stats_retired_counts[id];
+
+    for (node = stats_threads.head; node; node = node->next) {
+        count += __atomic_load_n(&((stats_thread *) node->data)->counts[id],
+                                 __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_unlock(&stats_lock);
+
+    return count;
+}
+
+/*****************************************************************************//**
+  function to get a latency histogram summed over all the threads
+
+ @param	id      what was timed
+ @param	hist    filled in with the histogram
+
+ @return	nothing
+*******************************************************************************/
+
+void stats_get (
+    stats_id id,
+    stats_hist *hist)
+{
+    DLList_node *node;
+
+    memset(hist, 0, sizeof(stats_hist));
+
+    pthread_mutex_lock(&stats_lock);
+
+    stats_sum(hist, &stats_retired[id]);
+
+    for (node = stats_threads.head; node; node = node->next)
+        stats_sum(hist, &((stats_thread *) node->data)->hists[id]);
+
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/*****************************************************************************//**
+  function to estimate a quantile of a histogram
+
+ @param	hist    the histogram
+ @param	q       the quantile, 0.5 for the median
+
+ @return	the latency in seconds, interpolated within its bucket
+*******************************************************************************/
+
+double stats_quantile (
+    stats_hist *hist,
+    double q)
+{
+    double rank = q * hist->count;
+    double below = 0;
+    double lo, hi;
+    int i;
+
+    if (!hist->count)
+        return 0;
+
+    for (i = 0; i < STATS_BUCKETS - 1; i++) {
+        if (below + hist->buckets[i] >= rank)
+            break;
+        below += hist->buckets[i];
+    }
+
+    /***** bucket i holds [2^(i-1), 2^i) microseconds *****/
+
+    lo = i ? (double)(1UL << (i - 1)) : 0;
+    hi = (double)(1UL << i);
+
+    if (hist->buckets[i])
+        lo += (hi - lo) * (rank - below) / hist->buckets[i];
+
+    return lo / 1e6;
+}
+
+/*****************************************************************************//**
+  function to print a histogram in the prometheus text format
+*******************************************************************************/
+
+static void stats_print_hist (
+    buffer *buf,
+    const char *name,
+    stats_hist *hist)
+{
+    unsigned long cumulative = 0;
+    int i;
+
+    buffer_printf(buf, "# TYPE %s histogram\n", name);
+
+    for (i = 0; i < STATS_BUCKETS - 1; i++) {
+        cumulative += hist->buckets[i];
+        buffer_printf(buf, "%s_bucket{le=\"%g\"} %lu\n", name,
+                      (double)(1UL << i) / 1e6, cumulative);
+    }
+
+    buffer_printf(buf, "%s_bucket{le=\"+Inf\"} %lu\n", name, hist->count);
+    buffer_printf(buf, "%s_sum %g\n", name, hist->sum / 1e6);
+    buffer_printf(buf, "%s_count %lu\n", name, hist->count);
+}
+
+/*****************************************************************************//**
+  function to print every counter in the prometheus text format
+
+ @param	buf     the buffer to print to
+
+ @return	nothing
+*******************************************************************************/
+
+void stats_print (
+    buffer *buf)
+{
+    cache_stats cs;
+    frag_stats fs;
+    listen_stats ls;
+    rows_stats rs;
+    pressure_stats ps;
+    stats_hist hist;
+    char labels[32];
+    int i;
+
+    cache_get_stats(&cs);
+    frag_get_stats(&fs);
+    listen_get_stats(&ls);
+    rows_get_stats(&rs);
+    pressure_get_stats(&ps);
+
+    buffer_printf(buf, "# TYPE mapfilefs_cache_hits_total counter\n");
+    buffer_printf(buf, "mapfilefs_cache_hits_total %lu\n", cs.hits);
+    buffer_printf(buf, "# TYPE mapfilefs_cache_misses_total counter\n");
+    buffer_printf(buf, "mapfilefs_cache_misses_total %lu\n", cs.misses);
+    buffer_printf(buf, "# TYPE mapfilefs_cache_stale_hits_total counter\n");
+    buffer_printf(buf, "mapfilefs_cache_stale_hits_total %lu\n", cs.stale);
+    buffer_printf(buf, "# TYPE mapfilefs_cache_coalesced_total counter\n");
+    buffer_printf(buf, "mapfilefs_cache_coalesced_total %lu\n", cs.coalesced);
+    buffer_printf(buf, "# TYPE mapfilefs_cache_evictions_total counter\n");
+    buffer_printf(buf, "mapfilefs_cache_evictions_total %lu\n", cs.evictions);
+    buffer_printf(buf, "# TYPE mapfilefs_cache_expirations_total counter\n");
+    buffer_printf(buf, "mapfilefs_cache_expirations_total %lu\n",
+                  cs.expirations);
+    buffer_printf(buf, "# TYPE mapfilefs_cache_refreshes_total counter\n");
+    buffer_printf(buf, "mapfilefs_cache_refreshes_total %lu\n", cs.refreshes);
+    buffer_printf(buf, "# TYPE mapfilefs_cache_negative_hits_total counter\n");
+    buffer_printf(buf, "mapfilefs_cache_negative_hits_total %lu\n",
+                  cs.negatives);
+    buffer_printf(buf, "# TYPE mapfilefs_cache_timeouts_total counter\n");
+    buffer_printf(buf, "mapfilefs_cache_timeouts_total %lu\n", cs.timeouts);
+    buffer_printf(buf, "# TYPE mapfilefs_cache_negative_dropped_total counter\n");
+    buffer_printf(buf, "mapfilefs_cache_negative_dropped_total %lu\n",
+                  cs.dropped);
+    buffer_printf(buf, "# TYPE mapfilefs_cache_refresh_ahead_total counter\n");
+    buffer_printf(buf, "mapfilefs_cache_refresh_ahead_total %lu\n", cs.ahead);
+    buffer_printf(buf,
+                  "# TYPE mapfilefs_cache_refresh_ahead_used_total counter\n");
+    buffer_printf(buf, "mapfilefs_cache_refresh_ahead_used_total %lu\n",
+                  cs.ahead_used);
+    buffer_printf(buf, "# TYPE mapfilefs_dir_rejects_total counter\n");
+    buffer_printf(buf, "mapfilefs_dir_rejects_total %lu\n",
+                  stats_counted(STATS_DIR_REJECTS));
+    buffer_printf(buf, "# TYPE mapfilefs_cache_restored_total counter\n");
+    buffer_printf(buf, "mapfilefs_cache_restored_total %lu\n", cs.restored);
+    buffer_printf(buf, "# TYPE mapfilefs_cache_revalidated_total counter\n");
+    buffer_printf(buf, "mapfilefs_cache_revalidated_total %lu\n",
+                  cs.revalidated);
+    buffer_printf(buf, "# TYPE mapfilefs_cache_cold_hits_total counter\n");
+    buffer_printf(buf, "mapfilefs_cache_cold_hits_total %lu\n", cs.cold_hits);
+    buffer_printf(buf, "# TYPE mapfilefs_cache_demotions_total counter\n");
+    buffer_printf(buf, "mapfilefs_cache_demotions_total %lu\n", cs.demotions);
+    buffer_printf(buf, "# TYPE mapfilefs_cache_promotions_total counter\n");
+    buffer_printf(buf, "mapfilefs_cache_promotions_total %lu\n",
+                  cs.promotions);
+    buffer_printf(buf, "# TYPE mapfilefs_cache_bytes gauge\n");
+    buffer_printf(buf, "mapfilefs_cache_bytes %zu\n", cs.bytes);
+    buffer_printf(buf, "# TYPE mapfilefs_cache_cold_bytes gauge\n");
+    buffer_printf(buf, "mapfilefs_cache_cold_bytes %zu\n", cs.cold_bytes);
+
+    buffer_printf(buf, "# TYPE mapfilefs_cache_loads_total counter\n");
+    buffer_printf(buf, "mapfilefs_cache_loads_total %lu\n", cs.loads);
+
+    buffer_printf(buf, "# TYPE mapfilefs_fragment_renders_total counter\n");
+    buffer_printf(buf, "mapfilefs_fragment_renders_total %lu\n", fs.renders);
+    buffer_printf(buf, "# TYPE mapfilefs_fragment_reuses_total counter\n");
+    buffer_printf(buf, "mapfilefs_fragment_reuses_total %lu\n", fs.reuses);
+    buffer_printf(buf, "# TYPE mapfilefs_fragment_bytes gauge\n");
+    buffer_printf(buf, "mapfilefs_fragment_bytes %zu\n", fs.bytes);
+    buffer_printf(buf, "# TYPE mapfilefs_fragment_stored_bytes gauge\n");
+    buffer_printf(buf, "mapfilefs_fragment_stored_bytes %zu\n", fs.stored);
+
+    buffer_printf(buf, "# TYPE mapfilefs_rows_hits_total counter\n");
+    buffer_printf(buf, "mapfilefs_rows_hits_total %lu\n", rs.hits);
+    buffer_printf(buf, "# TYPE mapfilefs_rows_fetches_total counter\n");
+    buffer_printf(buf, "mapfilefs_rows_fetches_total %lu\n", rs.fetches);
+    buffer_printf(buf, "# TYPE mapfilefs_rows_evictions_total counter\n");
+    buffer_printf(buf, "mapfilefs_rows_evictions_total %lu\n", rs.evictions);
+    buffer_printf(buf, "# TYPE mapfilefs_rows_count gauge\n");
+    buffer_printf(buf, "mapfilefs_rows_count %lu\n", rs.count);
+    buffer_printf(buf, "# TYPE mapfilefs_rows_bytes gauge\n");
+    buffer_printf(buf, "mapfilefs_rows_bytes %zu\n", rs.bytes);
+
+    buffer_printf(buf, "# TYPE mapfilefs_pressure_budget_bytes gauge\n");
+    buffer_printf(buf, "mapfilefs_pressure_budget_bytes %zu\n", ps.budget);
+    buffer_printf(buf, "# TYPE mapfilefs_pressure_shrinks_total counter\n");
+    buffer_printf(buf, "mapfilefs_pressure_shrinks_total %lu\n", ps.shrinks);
+    buffer_printf(buf, "# TYPE mapfilefs_pressure_grows_total counter\n");
+    buffer_printf(buf, "mapfilefs_pressure_grows_total %lu\n", ps.grows);
+    buffer_printf(buf, "# TYPE mapfilefs_pressure_trims_total counter\n");
+    buffer_printf(buf, "mapfilefs_pressure_trims_total %lu\n", ps.trims);
+    buffer_printf(buf, "# TYPE mapfilefs_pressure_stall_ratio gauge\n");
+    buffer_printf(buf, "mapfilefs_pressure_stall_ratio %g\n",
+                  ps.stall / 1000.0);
+    buffer_printf(buf, "# TYPE mapfilefs_pressure_cgroup_bytes gauge\n");
+    buffer_printf(buf, "mapfilefs_pressure_cgroup_bytes %zu\n", ps.current);
+    buffer_printf(buf, "# TYPE mapfilefs_pressure_cgroup_limit_bytes gauge\n");
+    buffer_printf(buf, "mapfilefs_pressure_cgroup_limit_bytes %zu\n",
+                  ps.limit);
+
+    buffer_printf(buf, "# TYPE mapfilefs_listen_events_total counter\n");
+    buffer_printf(buf, "mapfilefs_listen_events_total %lu\n", ls.events);
+    buffer_printf(buf, "# TYPE mapfilefs_listen_flushes_total counter\n");
+    buffer_printf(buf, "mapfilefs_listen_flushes_total %lu\n", ls.flushes);
+    buffer_printf(buf, "# TYPE mapfilefs_listen_expired_total counter\n");
+    buffer_printf(buf, "mapfilefs_listen_expired_total %lu\n", ls.expired);
+
+    /***** the count of the db fetch histogram is the number of fetches *****/
+
+    stats_get(STATS_DB_FETCH, &hist);
+    stats_print_hist(buf, "mapfilefs_db_fetch_seconds", &hist);
+
+    stats_get(STATS_RENDER, &hist);
+    stats_print_hist(buf, "mapfilefs_render_seconds", &hist);
+
+    buffer_printf(buf, "# TYPE mapfilefs_fuse_op_seconds summary\n");
+
+    for (i = 0; i < STATS_OPS; i++) {
+        stats_get(i, &hist);
+        snprintf(labels, sizeof(labels), "op=\"%s\"", stats_ops[i]);
+
+        buffer_printf(buf, "mapfilefs_fuse_op_seconds{%s,quantile=\"0.5\"} %g\n",
+                      labels, stats_quantile(&hist, 0.5));
+        buffer_printf(buf, "mapfilefs_fuse_op_seconds{%s,quantile=\"0.99\"} %g\n",
+                      labels, stats_quantile(&hist, 0.99));
+        buffer_printf(buf, "mapfilefs_fuse_op_seconds_sum{%s} %g\n",
+                      labels, hist.sum / 1e6);
+        buffer_printf(buf, "mapfilefs_fuse_op_seconds_count{%s} %lu\n",
+                      labels, hist.count);
+    }
+}
+
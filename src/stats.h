@@ -0,0 +1,190 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef stats_h
+#define stats_h
+
+/*****************************************************************************//**
+  the latencies that are timed
+
+  STATS_LOOKUP      fuse lookup
+  STATS_GETATTR     fuse getattr
+  STATS_READDIR     fuse readdir
+  STATS_OPEN        fuse open
+  STATS_READ        fuse read and read_buf
+  STATS_RELEASE     fuse release
+  STATS_DB_FETCH    one query against the db
+  STATS_RENDER      one render of a whole mapfile, db fetches included
+*******************************************************************************/
+
+typedef enum {
+    STATS_LOOKUP,
+    STATS_GETATTR,
+    STATS_READDIR,
+    STATS_OPEN,
+    STATS_READ,
+    STATS_RELEASE,
+    STATS_DB_FETCH,
+    STATS_RENDER,
+    STATS_HISTS
+} stats_id;
+
+/***** the fuse ops are the first STATS_OPS ids *****/
+
+#define STATS_OPS STATS_DB_FETCH
+
+/***** bucket i counts latencies under 2^i microseconds, the last bucket
+       counts the rest *****/
+
+#define STATS_BUCKETS 28
+
+/*****************************************************************************//**
+  the counters bumped on paths that must not write a shared cache line
+
+  STATS_CACHE_HITS      cache gets answered with a current version
+  STATS_CACHE_STALE     cache gets answered with an expired version
+  STATS_CACHE_NEGATIVE  cache gets and getattrs answered with ENOENT from a
+                        negative entry
+  STATS_CACHE_COLD      cache gets answered by decompressing from the cold
+                        tier
+  STATS_DIR_REJECTS     lookups of mapfiles the bloom filter says are not
+                        in the index
+*******************************************************************************/
+
+typedef enum {
+    STATS_CACHE_HITS,
+    STATS_CACHE_STALE,
+    STATS_CACHE_NEGATIVE,
+    STATS_CACHE_COLD,
+    STATS_DIR_REJECTS,
+    STATS_COUNTERS
+} stats_counter;
+
+/*****************************************************************************//**
+  structure for a latency histogram
+
+ @param	count   number of latencies
+ @param	sum     sum of the latencies in microseconds
+ @param	buckets number of latencies in each bucket, not cumulative
+*******************************************************************************/
+
+typedef struct {
+    unsigned long count;
+    unsigned long sum;
+    unsigned long buckets[STATS_BUCKETS];
+} stats_hist;
+
+/*****************************************************************************//**
+  function to get a monotonic time to start timing from
+
+ @return	the time in microseconds
+*******************************************************************************/
+
+unsigned long stats_now (void);
+
+/*****************************************************************************//**
+  function to record a latency
+
+ @param	id      what was timed
+ @param	start   the time from stats_now() it started
+
+ @return	nothing
+
+  note:
+        each thread records into its own histograms so the threads never
+        share a cache line, they are only summed when read
+*******************************************************************************/
+
+void stats_observe (
+    stats_id id,
+    unsigned long start);
+
+/*****************************************************************************//**
+  function to add one to a counter
+
+ @param	id      the counter
+
+ @return	nothing
+
+  note:
+        each thread counts into its own counters like stats_observe()
+*******************************************************************************/
+
+void stats_count (
+    stats_counter id);
+
+/*****************************************************************************//**
+  function to get a counter summed over all the threads
+
+ @param	id      the counter
+
+ @return	the count
+*******************************************************************************/
+
+unsigned long stats_counted (
+    stats_counter id);
+
+/*****************************************************************************//**
+  function to get a latency histogram summed over all the threads
+
+ @param	id      what was timed
+ @param	hist    filled in with the histogram
+
+ @return	nothing
+*******************************************************************************/
+
+void stats_get (
+    stats_id id,
+    stats_hist *hist);
+
+/*****************************************************************************//**
+  function to estimate a quantile of a histogram
+
+ @param	hist    the histogram
+ @param	q       the quantile, 0.5 for the median
+
+ @return	the latency in seconds, interpolated within its bucket
+*******************************************************************************/
+
+double stats_quantile (
+    stats_hist *hist,
+    double q);
+
+/*****************************************************************************//**
+  function to print every counter in the prometheus text format
+
+ @param	buf     the buffer to print to
+
+ @return	nothing
+*******************************************************************************/
+
+void stats_print (
+    buffer *buf);
+
+#endif
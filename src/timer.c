@@ -0,0 +1,381 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "epoch.h"
+#include "timer.h"
+
+static timer_entry *timer_wheel[TIMER_LEVELS][TIMER_SLOTS];
+
+/***** every deadline before this has been run *****/
+
+static time_t timer_base = 0;
+
+static pthread_t timer_thread;
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_wake = PTHREAD_COND_INITIALIZER;
+static int timer_running = 0;
+
+/***** what the callback running handed to timer_defer() *****/
+
+static void (*timer_reap_func) (void *data) = NULL;
+static void *timer_reap_data = NULL;
+
+#define TIMER_SLOT(t, level) \
+    (((t) >> ((level) * TIMER_BITS)) & (TIMER_SLOTS - 1))
+
+/*****************************************************************************//**
+  function to setup the timer wheel
+
+ @return	nothing
+
+  note:
+        entries may be added before timer_start(), they fire once the thread
+        runs. entries left pending from before are forgotten
+*******************************************************************************/
+
+void timer_init (void)
+{
+    memset(timer_wheel, 0, sizeof(timer_wheel));
+    timer_base = time(NULL);
+}
+
+/*****************************************************************************//**
+  function to link an entry into the slot its deadline falls in
+
+ @param	entry   the entry, not pending
+
+ @return	nothing
+
+  note:
+        must be called with timer_lock held. the level is picked by how far
+        off the deadline is from the base, so an entry is only looked at
+        again when the wheel turns to its slot, once for each level it has
+        to move down
+*******************************************************************************/
+
+static void timer_link (
+    timer_entry *entry)
+{
+    time_t deadline = entry->deadline;
+    time_t delta = deadline - timer_base;
+    timer_entry **slot;
+    int level;
+
+    if (delta < 0)
+        deadline = timer_base;
+    else if (delta >= (time_t)1 << (TIMER_LEVELS * TIMER_BITS))
+        deadline = timer_base + ((time_t)1 << (TIMER_LEVELS * TIMER_BITS)) - 1;
+
+    for (level = 0; level < TIMER_LEVELS - 1; level++) {
+        if (deadline - timer_base < (time_t)1 << ((level + 1) * TIMER_BITS))
+            break;
+    }
+
+    slot = &timer_wheel[level][TIMER_SLOT(deadline, level)];
+
+    if ((entry->next = *slot))
+        entry->next->pprev = &entry->next;
+    *slot = entry;
+    entry->pprev = slot;
+}
+
+/*****************************************************************************//**
+  function to unlink an entry
+
+ @param	entry   the entry, pending
+
+ @return	nothing
+
+  note:
+        must be called with timer_lock held
+*******************************************************************************/
+
+static void timer_unlink (
+    timer_entry *entry)
+{
+    if ((*entry->pprev = entry->next))
+        entry->next->pprev = entry->pprev;
+    entry->next = NULL;
+    entry->pprev = NULL;
+}
+
+/*****************************************************************************//**
+  function to set the deadline of an entry
+
+ @param	entry       the entry, if it is pending it is moved
+ @param	deadline    when the entry is due, a deadline passed is due on the
+                    next tick
+ @param	func        function to call when it is due
+
+ @return	nothing
+
+  note:
+        O(1), the entry is linked into the slot its deadline falls in and
+        only moves down a level as the wheel turns to it
+*******************************************************************************/
+
+void timer_add (
+    timer_entry *entry,
+    time_t deadline,
+    timer_func func)
+{
+    pthread_mutex_lock(&timer_lock);
+
+    if (entry->pprev)
+        timer_unlink(entry);
+
+    entry->deadline = deadline;
+    entry->func = func;
+    timer_link(entry);
+
+    pthread_mutex_unlock(&timer_lock);
+}
+
+/*****************************************************************************//**
+  function to cancel an entry
+
+ @param	entry   the entry
+
+ @return	non zero if the entry was pending
+
+  note:
+        O(1). an entry that was already taken off the wheel may still be in
+        its callback, the owner cancels it where it unlinks itself and
+        frees itself with epoch_defer() so the callback can still read it
+*******************************************************************************/
+
+int timer_cancel (
+    timer_entry *entry)
+{
+    int pending;
+
+    pthread_mutex_lock(&timer_lock);
+
+    if ((pending = entry->pprev != NULL))
+        timer_unlink(entry);
+
+    pthread_mutex_unlock(&timer_lock);
+
+    return pending;
+}
+
+/*****************************************************************************//**
+  function to free something a timer callback unlinked
+
+ @param	func    function to free it with
+ @param	data    what was unlinked
+
+ @return	nothing
+
+  note:
+        only from a timer callback and only once per call, the timer thread
+        passes it to epoch_defer() once it has left the read side section
+*******************************************************************************/
+
+void timer_defer (
+    void (*func) (void *data),
+    void *data)
+{
+    timer_reap_func = func;
+    timer_reap_data = data;
+}
+
+/*****************************************************************************//**
+  function to move the entries of a slot of an upper level down
+
+ @param	level   the level, above 0
+
+ @return	nothing
+
+  note:
+        must be called with timer_lock held
+*******************************************************************************/
+
+static void timer_cascade (
+    int level)
+{
+    timer_entry **slot = &timer_wheel[level][TIMER_SLOT(timer_base, level)];
+    timer_entry *entry;
+
+    while ((entry = *slot)) {
+        timer_unlink(entry);
+        timer_link(entry);
+    }
+}
+
+/*****************************************************************************//**
+  function to run the entries due in one tick
+
+ @return	nothing
+
+  note:
+        must be called with timer_lock held, it is dropped around each
+        callback. the due slot is moved to a list of its own first so an
+        entry added by a callback waits for its own tick, and an entry on
+        the list can still be cancelled or moved
+*******************************************************************************/
+
+static void timer_tick (void)
+{
+    timer_entry *due = NULL;
+    timer_entry **slot;
+    timer_entry *entry;
+    timer_func func;
+    int level;
+
+    /***** a slot of a level is cascaded when the level below wraps *****/
+
+    for (level = 1; level < TIMER_LEVELS; level++) {
+        if (TIMER_SLOT(timer_base, level - 1))
+            break;
+        timer_cascade(level);
+    }
+
+    slot = &timer_wheel[0][TIMER_SLOT(timer_base, 0)];
+
+    if ((due = *slot)) {
+        due->pprev = &due;
+        *slot = NULL;
+    }
+
+    timer_base++;
+
+    while (due) {
+        epoch_enter();
+
+        entry = due;
+        func = entry->func;
+        timer_unlink(entry);
+
+        pthread_mutex_unlock(&timer_lock);
+
+        func(entry);
+
+        epoch_exit();
+
+        if (timer_reap_func) {
+            epoch_defer(timer_reap_func, timer_reap_data);
+            timer_reap_func = NULL;
+        }
+
+        pthread_mutex_lock(&timer_lock);
+    }
+}
+
+/*****************************************************************************//**
+  function run on the timer thread
+*******************************************************************************/
+
+static void *timer_main (
+    void *arg)
+{
+    struct timespec when;
+
+    (void) arg;
+
+    pthread_mutex_lock(&timer_lock);
+
+    while (timer_running) {
+
+        /***** catch up a tick at a time, the clock may have jumped *****/
+
+        while (timer_running && timer_base <= time(NULL))
+            timer_tick();
+
+        when.tv_sec = timer_base;
+        when.tv_nsec = 0;
+
+        while (timer_running &&
+               pthread_cond_timedwait(&timer_wake, &timer_lock, &when) !=
+               ETIMEDOUT);
+    }
+
+    pthread_mutex_unlock(&timer_lock);
+
+    return NULL;
+}
+
+/*****************************************************************************//**
+  function to start the timer thread
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        threads do not survive a fork so this is called once the filesystem
+        has daemonized
+*******************************************************************************/
+
+int timer_start (void)
+{
+    int res;
+
+    if (timer_running)
+        return 0;
+
+    timer_running = 1;
+
+    if ((res = -pthread_create(&timer_thread, NULL, timer_main, NULL)))
+        timer_running = 0;
+
+    return res;
+}
+
+/*****************************************************************************//**
+  function to stop the timer thread
+
+ @return	nothing
+
+  note:
+        a callback in progress finishes first, pending entries stay in the
+        wheel and never fire
+*******************************************************************************/
+
+void timer_stop (void)
+{
+    if (!timer_running)
+        return;
+
+    pthread_mutex_lock(&timer_lock);
+    timer_running = 0;
+    pthread_cond_signal(&timer_wake);
+    pthread_mutex_unlock(&timer_lock);
+
+    pthread_join(timer_thread, NULL);
+}
@@ -0,0 +1,171 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+
+#ifndef timer_h
+#define timer_h
+
+#include <time.h>
+
+/***** the wheel has TIMER_LEVELS levels of TIMER_SLOTS slots, a slot of
+       level n spans TIMER_SLOTS^n seconds, 4 levels of 64 reach 194 days
+       and a later deadline waits in the last slot *****/
+
+#define TIMER_BITS 6
+#define TIMER_SLOTS (1 << TIMER_BITS)
+#define TIMER_LEVELS 4
+
+typedef struct timer_entry_struct timer_entry;
+
+/*****************************************************************************//**
+  type of function called when a timer entry is due
+
+ @param	entry   the entry, no longer pending
+
+ @return	nothing
+
+  note:
+        called on the timer thread with no lock held, in an epoch read side
+        section so the owner of the entry can not be freed under it. it must
+        not call epoch_defer(), it hands what it unlinked to timer_defer()
+*******************************************************************************/
+
+typedef void (*timer_func) (
+    timer_entry *entry);
+
+/*****************************************************************************//**
+  structure for a deadline, meant to be embedded in what it is the deadline
+  of
+
+ @param	next        next entry in the slot
+ @param	pprev       the pointer to this entry in the slot, NULL if the entry
+                    is not pending
+ @param	deadline    when the entry is due
+ @param	func        function to call when the entry is due
+*******************************************************************************/
+
+struct timer_entry_struct {
+    timer_entry *next;
+    timer_entry **pprev;
+    time_t deadline;
+    timer_func func;
+};
+
+/*****************************************************************************//**
+  function to setup the timer wheel
+
+ @return	nothing
+
+  note:
+        entries may be added before timer_start(), they fire once the thread
+        runs. entries left pending from before are forgotten
+*******************************************************************************/
+
+void timer_init (void);
+
+/*****************************************************************************//**
+  function to start the timer thread
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        threads do not survive a fork so this is called once the filesystem
+        has daemonized
+*******************************************************************************/
+
+int timer_start (void);
+
+/*****************************************************************************//**
+  function to stop the timer thread
+
+ @return	nothing
+
+  note:
+        a callback in progress finishes first, pending entries stay in the
+        wheel and never fire
+*******************************************************************************/
+
+void timer_stop (void);
+
+/*****************************************************************************//**
+  function to set the deadline of an entry
+
+ @param	entry       the entry, if it is pending it is moved
+ @param	deadline    when the entry is due, a deadline passed is due on the
+                    next tick
+ @param	func        function to call when it is due
+
+ @return	nothing
+
+  note:
+        O(1), the entry is linked into the slot its deadline falls in and
+        only moves down a level as the wheel turns to it
+*******************************************************************************/
+
+void timer_add (
+    timer_entry *entry,
+    time_t deadline,
+    timer_func func);
+
+/*****************************************************************************//**
+  function to cancel an entry
+
+ @param	entry   the entry
+
+ @return	non zero if the entry was pending
+
+  note:
+        O(1). an entry that was already taken off the wheel may still be in
+        its callback, the owner cancels it where it unlinks itself and
+        frees itself with epoch_defer() so the callback can still read it
+*******************************************************************************/
+
+int timer_cancel (
+    timer_entry *entry);
+
+/*****************************************************************************//**
+  function to free something a timer callback unlinked
+
+ @param	func    function to free it with
+ @param	data    what was unlinked
+
+ @return	nothing
+
+  note:
+        only from a timer callback and only once per call, the timer thread
+        passes it to epoch_defer() once it has left the read side section
+*******************************************************************************/
+
+void timer_defer (
+    void (*func) (void *data),
+    void *data);
+
+#endif
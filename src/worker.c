@@ -0,0 +1,203 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "DLList.h"
+#include "worker.h"
+
+/*****************************************************************************//**
+  structure for a queued job
+*******************************************************************************/
+
+typedef struct {
+    worker_func func;
+    void *arg;
+} worker_job;
+
+/*****************************************************************************//**
+  function run by each worker thread
+*******************************************************************************/
+
+static void *worker_main (
+    void *arg)
+{
+    worker_pool *pool = arg;
+    worker_job *job;
+
+    /***** on linux this lowers only the calling thread *****/
+
+    setpriority(PRIO_PROCESS, 0, 19);
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (;;) {
+        while (!pool->queue.head && !pool->stop)
+            pthread_cond_wait(&pool->ready, &pool->lock);
+
+        if (!pool->queue.head)
+            break;
+
+        job = DLList_delete(&pool->queue, pool->queue.head);
+
+        pthread_mutex_unlock(&pool->lock);
+
+        job->func(job->arg);
+        free(job);
+
+        pthread_mutex_lock(&pool->lock);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/*****************************************************************************//**
+  function to start a worker pool
+
+ @param	pool        the pool
+ @param	nthreads    number of threads to start
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        the threads run at the lowest priority so background work does not
+        take cpu from the threads answering the kernel
+*******************************************************************************/
+
+int worker_init (
+    worker_pool *pool,
+    int nthreads)
+{
+    int res;
+
+    pool->queue.length = 0;
+    pool->queue.head = NULL;
+    pool->queue.tail = NULL;
+    pool->nthreads = 0;
+    pool->stop = 0;
+
+    if (!(pool->threads = calloc(nthreads, sizeof(pthread_t))))
+        return -ENOMEM;
+
+    if (pthread_mutex_init(&pool->lock, NULL)) {
+        free(pool->threads);
+        return -ENOMEM;
+    }
+
+    if (pthread_cond_init(&pool->ready, NULL)) {
+        pthread_mutex_destroy(&pool->lock);
+        free(pool->threads);
+        return -ENOMEM;
+    }
+
+    for (; pool->nthreads < nthreads; pool->nthreads++) {
+        if ((res = pthread_create(pool->threads + pool->nthreads, NULL,
+                                  worker_main, pool))) {
+            worker_destroy(pool);
+            return -res;
+        }
+    }
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to queue a job on a worker pool
+
+ @param	pool    the pool
+ @param	func    the function to run on a worker thread
+ @param	arg     the arg to pass to func
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+int worker_queue (
+    worker_pool *pool,
+    worker_func func,
+    void *arg)
+{
+    worker_job *job;
+
+    if (!(job = malloc(sizeof(worker_job))))
+        return -ENOMEM;
+
+    job->func = func;
+    job->arg = arg;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (pool->stop || !DLList_append(&pool->queue, job)) {
+        pthread_mutex_unlock(&pool->lock);
+        free(job);
+        return pool->stop ? -ESHUTDOWN : -ENOMEM;
+    }
+
+    pthread_cond_signal(&pool->ready);
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return 0;
+}
+
+/*****************************************************************************//**
+  function to stop a worker pool, jobs still queued are run first
+
+ @param	pool    the pool
+
+ @return	nothing
+*******************************************************************************/
+
+void worker_destroy (
+    worker_pool *pool)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->ready);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    pool->threads = NULL;
+    pool->nthreads = 0;
+}
+
@@ -0,0 +1,111 @@
+/******************************************************************************
+ *
+ * Project:  mapfileFS
+ * Purpose:  
+ * Author:   Brian Case   rush@winkey.org
+ *
+ ******************************************************************************
+ * Copyright (c) 2015, Brian Case   rush@winkey.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef worker_h
+#define worker_h
+
+#include <pthread.h>
+
+/*****************************************************************************//**
+  type of function to queue on a worker pool
+
+ @param	arg     the arg passed to worker_queue
+
+ @return	nothing
+*******************************************************************************/
+
+typedef void (*worker_func) (
+    void *arg);
+
+/*****************************************************************************//**
+  structure for a pool of background worker threads
+
+ @param	lock        lock for the queue
+ @param	ready       signaled when a job is queued or the pool is stopping
+ @param	queue       the jobs waiting for a thread, oldest at the head
+ @param	threads     the worker threads
+ @param	nthreads    number of worker threads
+ @param	stop        non zero when the pool is stopping
+*******************************************************************************/
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    DLList queue;
+    pthread_t *threads;
+    int nthreads;
+    int stop;
+} worker_pool;
+
+/*****************************************************************************//**
+  function to start a worker pool
+
+ @param	pool        the pool
+ @param	nthreads    number of threads to start
+
+ @return	0 on success
+ @return	a negative errno on failure
+
+  note:
+        the threads run at the lowest priority so background work does not
+        take cpu from the threads answering the kernel
+*******************************************************************************/
+
+int worker_init (
+    worker_pool *pool,
+    int nthreads);
+
+/*****************************************************************************//**
+  function to queue a job on a worker pool
+
+ @param	pool    the pool
+ @param	func    the function to run on a worker thread
+ @param	arg     the arg to pass to func
+
+ @return	0 on success
+ @return	a negative errno on failure
+*******************************************************************************/
+
+int worker_queue (
+    worker_pool *pool,
+    worker_func func,
+    void *arg);
+
+/*****************************************************************************//**
+  function to stop a worker pool, jobs still queued are run first
+
+ @param	pool    the pool
+
+ @return	nothing
+*******************************************************************************/
+
+void worker_destroy (
+    worker_pool *pool);
+
+#endif